@@ -234,55 +234,66 @@ namespace agg
             for(;;)
             {
                 if(m_scan_y > m_outline.max_y()) return false;
-                sl.reset_spans();
-                unsigned num_cells = m_outline.scanline_num_cells(m_scan_y);
-                const cell_aa* const* cells = m_outline.scanline_cells(m_scan_y);
-                int cover = 0;
+                if(sweep_scanline(sl, m_scan_y)) break;
+                ++m_scan_y;
+            }
+            ++m_scan_y;
+            return true;
+        }
 
-                while(num_cells)
-                {
-                    const cell_aa* cur_cell = *cells;
-                    int x    = cur_cell->x;
-                    int area = cur_cell->area;
-                    unsigned alpha;
+        //--------------------------------------------------------------------
+        // Sweep the given scanline only, without moving the scan position.
+        // Returns false if the scanline has no spans.  Once the cells are
+        // sorted this only reads from the rasterizer, so distinct scanlines
+        // may be swept concurrently from several threads.
+        template<class Scanline> bool sweep_scanline(Scanline& sl, int y) const
+        {
+            if(y < m_outline.min_y() || y > m_outline.max_y()) return false;
+            sl.reset_spans();
+            unsigned num_cells = m_outline.scanline_num_cells(y);
+            const cell_aa* const* cells = m_outline.scanline_cells(y);
+            int cover = 0;
 
-                    cover += cur_cell->cover;
+            while(num_cells)
+            {
+                const cell_aa* cur_cell = *cells;
+                int x    = cur_cell->x;
+                int area = cur_cell->area;
+                unsigned alpha;
 
-                    //accumulate all cells with the same X
-                    while(--num_cells)
-                    {
-                        cur_cell = *++cells;
-                        if(cur_cell->x != x) break;
-                        area  += cur_cell->area;
-                        cover += cur_cell->cover;
-                    }
+                cover += cur_cell->cover;
+
+                //accumulate all cells with the same X
+                while(--num_cells)
+                {
+                    cur_cell = *++cells;
+                    if(cur_cell->x != x) break;
+                    area  += cur_cell->area;
+                    cover += cur_cell->cover;
+                }
 
-                    if(area)
+                if(area)
+                {
+                    alpha = calculate_alpha((cover << (poly_subpixel_shift + 1)) - area);
+                    if(alpha)
                     {
-                        alpha = calculate_alpha((cover << (poly_subpixel_shift + 1)) - area);
-                        if(alpha)
-                        {
-                            sl.add_cell(x, alpha);
-                        }
-                        x++;
+                        sl.add_cell(x, alpha);
                     }
+                    x++;
+                }
 
-                    if(num_cells && cur_cell->x > x)
+                if(num_cells && cur_cell->x > x)
+                {
+                    alpha = calculate_alpha(cover << (poly_subpixel_shift + 1));
+                    if(alpha)
                     {
-                        alpha = calculate_alpha(cover << (poly_subpixel_shift + 1));
-                        if(alpha)
-                        {
-                            sl.add_span(x, cur_cell->x - x, alpha);
-                        }
+                        sl.add_span(x, cur_cell->x - x, alpha);
                     }
                 }
-        
-                if(sl.num_spans()) break;
-                ++m_scan_y;
             }
 
-            sl.finalize(m_scan_y);
-            ++m_scan_y;
+            if(sl.num_spans() == 0) return false;
+            sl.finalize(y);
             return true;
         }
 
@@ -91,7 +91,9 @@ class RendererAgg(RendererBase):
         self.width = width
         self.height = height
         if __debug__: verbose.report('RendererAgg.__init__ width=%s, height=%s'%(width, height), 'debug-annoying')
-        self._renderer = _RendererAgg(int(width), int(height), dpi, debug=False)
+        self._renderer = _RendererAgg(int(width), int(height), dpi,
+                                      debug=False,
+                                      threads=rcParams['agg.threads'])
         self._filter_renderers = []
 
         if __debug__: verbose.report('RendererAgg.__init__ _RendererAgg done',
@@ -304,8 +306,62 @@ class RendererAgg(RendererBase):
                                      'debug-annoying')
         return self._renderer.buffer_rgba()
 
-    def clear(self):
-        self._renderer.clear()
+    def copy_pixels(self, out, format='rgba', damaged_only=False):
+        """
+        Convert the canvas into the writable buffer *out* (e.g. a
+        bytearray or a contiguous numpy array), in *format* channel
+        order: one of 'rgba', 'argb', 'bgra' or 'rgb'.  *out* must be
+        exactly the size of the converted canvas.  If *damaged_only* is
+        True, only the damaged area is converted, to its place in *out*;
+        see :meth:`set_damage_tracking`.
+
+        Unlike the tostring_* methods, this doesn't allocate any memory.
+        Use :meth:`buffer_rgba` to access the RGBA canvas without copying.
+        """
+        if __debug__: verbose.report('RendererAgg.copy_pixels',
+                                     'debug-annoying')
+        self._renderer.copy_pixels(out, format, damaged_only)
+
+    def clear(self, damaged_only=False):
+        """
+        Clear the canvas to the background color.  If *damaged_only* is
+        True and damage tracking is on, only the damaged area is cleared
+        (and it stays damaged); see :meth:`set_damage_tracking`.
+        """
+        self._renderer.clear(damaged_only)
+
+    def set_damage_tracking(self, enabled):
+        """
+        Turn damage tracking on or off.  While it is on, the renderer
+        records which parts of the canvas each draw call, clear and
+        restore_region touches, so that an incremental update only has
+        to clear, export or blit those::
+
+            damage = renderer.get_damage()
+            renderer.clear(damaged_only=True)   # erase the last frame
+            renderer.reset_damage()
+            ... draw the new frame ...
+            damage += renderer.get_damage()     # what to blit or export
+
+        The damage is reset whenever tracking is turned on or off.
+        """
+        self._renderer.set_damage_tracking(enabled)
+
+    def get_damage(self):
+        """
+        Return the area damaged since the last :meth:`reset_damage`, as
+        a list of non-overlapping :class:`~matplotlib.transforms.Bbox`
+        instances in display coordinates, pixel aligned.  These can be
+        passed straight to :meth:`copy_from_bbox`.
+        """
+        return [Bbox.from_extents(*extents)
+                for extents in self._renderer.get_damage()]
+
+    def reset_damage(self):
+        """
+        Forget the damage recorded so far.
+        """
+        self._renderer.reset_damage()
 
     def option_image_nocomposite(self):
         # It is generally faster to composite each image directly to
@@ -357,7 +413,8 @@ class RendererAgg(RendererBase):
         """
         self._filter_renderers.append(self._renderer)
         self._renderer = _RendererAgg(int(self.width), int(self.height),
-                                      self.dpi)
+                                      self.dpi,
+                                      threads=rcParams['agg.threads'])
         self._update_methods()
 
     def stop_filter(self, post_processing):
@@ -491,6 +548,15 @@ class FigureCanvasAgg(FigureCanvasBase):
                                      'debug-annoying')
         return self.renderer.buffer_rgba()
 
+    def copy_pixels(self, out, format='rgba', damaged_only=False):
+        """
+        Convert the canvas into the writable buffer *out*; see
+        :meth:`RendererAgg.copy_pixels`.
+        """
+        if __debug__: verbose.report('FigureCanvasAgg.copy_pixels',
+                                     'debug-annoying')
+        self.renderer.copy_pixels(out, format, damaged_only)
+
     def print_raw(self, filename_or_obj, *args, **kwargs):
         FigureCanvasAgg.draw(self)
         renderer = self.get_renderer()
@@ -2,11 +2,24 @@
 #include <stdlib.h>
 #include <map>
 #include <iostream>
+#include <new>
 
 #include "VoronoiDiagramGenerator.h"
 #include "delaunay_utils.h"
 #include "natneighbors.h"
 #include "numpy/noprefix.h"
+#include "src/mplthreads.h"
+
+// The SSE2 kernel below relies on every product and sum being rounded
+// on its own, so it is left out where the compiler may fuse them
+#if (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)) && !defined(__FMA__)
+#define DELAUNAY_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Each thread interpolates at least this many grid points
+#define MIN_LINEAR_POINTS_PER_THREAD (1<<15)
+#define MIN_NN_POINTS_PER_THREAD (1<<10)
 
 using namespace std;
 
@@ -258,10 +271,8 @@ static PyObject *linear_planes(int ntriangles, double *x, double *y, double *z,
 
 static double linear_interpolate_single(double targetx, double targety,
     double *x, double *y, int *nodes, int *neighbors,
-    PyObject *planes, double defvalue, int start_triangle, int *end_triangle)
+    double *planes_ptr, double defvalue, int start_triangle, int *end_triangle)
 {
-    double *planes_ptr;
-    planes_ptr = (double*)PyArray_DATA(planes);
     if (start_triangle == -1) start_triangle = 0;
     *end_triangle = walking_triangles(start_triangle, targetx, targety,
         x, y, nodes, neighbors);
@@ -271,41 +282,154 @@ static double linear_interpolate_single(double targetx, double targety,
                     INDEX3(planes_ptr,*end_triangle,2));
 }
 
+#ifdef DELAUNAY_SSE2
+// Interpolate the row points ix, ix+1, ... two at a time for as long as
+// both are inside triangle tri, where walking_triangles would stop
+// straight away, and return the index of the first point not done. The
+// containment tests and the plane are evaluated exactly as in the
+// scalar code, so the results are the same.
+static int linear_interpolate_pairs(int ix, int xsteps,
+    double x0, double dx, double targety, int tri,
+    double *x, double *y, int *nodes, double *planes_ptr, double *z_row)
+{
+    __m128d ex0[3], ey0[3], ex1[3], ey1[3];
+    for (int i=0; i<3; i++) {
+        int j = INDEX3(nodes, tri, EDGE0(i));
+        int k = INDEX3(nodes, tri, EDGE1(i));
+        ex0[i] = _mm_set1_pd(x[j]);
+        ey0[i] = _mm_set1_pd(y[j]);
+        ex1[i] = _mm_set1_pd(x[k]);
+        ey1[i] = _mm_set1_pd(y[k]);
+    }
+    const __m128d ty = _mm_set1_pd(targety);
+    const __m128d a = _mm_set1_pd(INDEX3(planes_ptr, tri, 0));
+    const __m128d by = _mm_set1_pd(targety*INDEX3(planes_ptr, tri, 1));
+    const __m128d c = _mm_set1_pd(INDEX3(planes_ptr, tri, 2));
+    const __m128d vx0 = _mm_set1_pd(x0);
+    const __m128d vdx = _mm_set1_pd(dx);
+    const __m128d two = _mm_set1_pd(2.0);
+    __m128d vix = _mm_set_pd(ix + 1, ix);
+
+    for (; ix+1 < xsteps; ix+=2) {
+        __m128d tx = _mm_add_pd(vx0, _mm_mul_pd(vdx, vix));
+        __m128d right = _mm_setzero_pd();
+        for (int i=0; i<3; i++) {
+            // ONRIGHT(x0, y0, x1, y1, tx, ty)
+            right = _mm_or_pd(right, _mm_cmpgt_pd(
+                _mm_mul_pd(_mm_sub_pd(ey0[i], ty), _mm_sub_pd(ex1[i], tx)),
+                _mm_mul_pd(_mm_sub_pd(ex0[i], tx), _mm_sub_pd(ey1[i], ty))));
+        }
+        if (_mm_movemask_pd(right)) break;
+        _mm_storeu_pd(z_row + ix,
+            _mm_add_pd(_mm_add_pd(_mm_mul_pd(tx, a), by), c));
+        vix = _mm_add_pd(vix, two);
+    }
+    return ix;
+}
+#endif
+
+// Interpolates whole rows of the grid, each walk starting from the
+// triangle found for the row by grid_rows.
+struct LinearGridRows
+{
+    double x0, dx, y0, dy;
+    int xsteps;
+    double *planes_ptr, defvalue;
+    double *x, *y;
+    int *nodes, *neighbors;
+    const vector<int> *start;
+    const vector<double> *xmin, *xmax;
+    double *z_ptr;
+
+    void operator()(int begin, int end)
+    {
+        int ix, iy, coltri, tri;
+        double targetx, targety;
+
+        for (iy=begin; iy<end; iy++) {
+            targety = y0 + dy*iy;
+            double lo = (*xmin)[iy], hi = (*xmax)[iy];
+            double *z_row = z_ptr + (npy_intp)xsteps*iy;
+            tri = (*start)[iy];
+            ix = 0;
+            while (ix < xsteps) {
+#ifdef DELAUNAY_SSE2
+                if (tri != -1) {
+                    ix = linear_interpolate_pairs(ix, xsteps, x0, dx,
+                        targety, tri, x, y, nodes, planes_ptr, z_row);
+                    if (ix == xsteps) break;
+                }
+#endif
+                targetx = x0 + dx*ix;
+                if ((targetx < lo) || (targetx > hi)) {
+                    z_row[ix] = defvalue;
+                } else {
+                    z_row[ix] = linear_interpolate_single(
+                        targetx, targety,
+                        x, y, nodes, neighbors, planes_ptr, defvalue, tri, &coltri);
+                    if (coltri != -1) tri = coltri;
+                }
+                ix++;
+            }
+        }
+    }
+};
+
 static PyObject *linear_interpolate_grid(double x0, double x1, int xsteps,
     double y0, double y1, int ysteps,
     PyObject *planes, double defvalue,
-    int npoints, double *x, double *y, int *nodes, int *neighbors)
+    int npoints, double *x, double *y, int ntriangles, int *nodes, int *neighbors,
+    int threads)
 {
-    int ix, iy;
-    double dx, dy, targetx, targety;
-    int rowtri, coltri, tri;
+    double dx, dy;
     PyObject *z;
-    double *z_ptr;
     intp dims[2];
+    vector<int> start;
+    vector<double> xmin, xmax;
 
     dims[0] = ysteps;
     dims[1] = xsteps;
     z = PyArray_SimpleNew(2, dims, PyArray_DOUBLE);
     if (!z) return NULL;
-    z_ptr = (double*)PyArray_DATA(z);
 
     dx = ( xsteps==1 ? 0 : (x1 - x0) / (xsteps-1) );
     dy = ( ysteps==1 ? 0 : (y1 - y0) / (ysteps-1) );
 
-    rowtri = 0;
-    for (iy=0; iy<ysteps; iy++) {
-        targety = y0 + dy*iy;
-        rowtri = walking_triangles(rowtri, x0, targety, x, y, nodes, neighbors);
-        tri = rowtri;
-        for (ix=0; ix<xsteps; ix++) {
-            targetx = x0 + dx*ix;
-            INDEXN(z_ptr, xsteps, iy, ix) = linear_interpolate_single(
-                targetx, targety,
-                x, y, nodes, neighbors, planes, defvalue, tri, &coltri);
-            if (coltri != -1) tri = coltri;
-        }
+    LinearGridRows task;
+    task.x0 = x0;
+    task.dx = dx;
+    task.y0 = y0;
+    task.dy = dy;
+    task.xsteps = xsteps;
+    task.planes_ptr = (double*)PyArray_DATA(planes);
+    task.defvalue = defvalue;
+    task.x = x;
+    task.y = y;
+    task.nodes = nodes;
+    task.neighbors = neighbors;
+    task.start = &start;
+    task.xmin = &xmin;
+    task.xmax = &xmax;
+    task.z_ptr = (double*)PyArray_DATA(z);
+
+    threads = (int)min((npy_intp)mpl::resolve_num_threads(threads),
+                       PyArray_SIZE(z) / MIN_LINEAR_POINTS_PER_THREAD);
+
+    bool ok = true;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        grid_rows(x0, y0, dy, ysteps, x, y, ntriangles, nodes, neighbors,
+            start, xmin, xmax);
+        mpl::parallel_for(0, ysteps, threads, task);
+    } catch (bad_alloc&) {
+        ok = false;
+    }
+    Py_END_ALLOW_THREADS
+
+    if (!ok) {
+        Py_DECREF(z);
+        return PyErr_NoMemory();
     }
-
     return z;
 }
 
@@ -375,11 +499,16 @@ static PyObject *linear_interpolate_method(PyObject *self, PyObject *args)
     int xsteps, ysteps;
     PyObject *pyplanes, *pyx, *pyy, *pynodes, *pyneighbors, *grid;
     PyObject *planes = NULL, *x = NULL, *y = NULL, *nodes = NULL, *neighbors = NULL;
-    int npoints;
+    int npoints, ntriangles;
+    int threads = 0;
 
 
-    if (!PyArg_ParseTuple(args, "ddiddidOOOOO", &x0, &x1, &xsteps, &y0, &y1, &ysteps,
-           &defvalue, &pyplanes, &pyx, &pyy, &pynodes, &pyneighbors)) {
+    if (!PyArg_ParseTuple(args, "ddiddidOOOOO|i", &x0, &x1, &xsteps, &y0, &y1, &ysteps,
+           &defvalue, &pyplanes, &pyx, &pyy, &pynodes, &pyneighbors, &threads)) {
+        return NULL;
+    }
+    if (threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "threads must be non-negative");
         return NULL;
     }
     x = PyArray_FROMANY(pyx, PyArray_DOUBLE, 1, 1, NPY_IN_ARRAY);
@@ -412,11 +541,12 @@ static PyObject *linear_interpolate_method(PyObject *self, PyObject *args)
         PyErr_SetString(PyExc_ValueError, "neighbors must be a 2-D array of ints");
         goto fail;
     }
+    ntriangles = PyArray_DIM(neighbors, 0);
 
     grid = linear_interpolate_grid(x0, x1, xsteps, y0, y1, ysteps,
         (PyObject*)planes, defvalue, npoints,
-        (double*)PyArray_DATA(x), (double*)PyArray_DATA(y),
-        (int*)PyArray_DATA(nodes), (int*)PyArray_DATA(neighbors));
+        (double*)PyArray_DATA(x), (double*)PyArray_DATA(y), ntriangles,
+        (int*)PyArray_DATA(nodes), (int*)PyArray_DATA(neighbors), threads);
 
     Py_DECREF(x);
     Py_DECREF(y);
@@ -579,11 +709,16 @@ static PyObject *nn_interpolate_method(PyObject *self, PyObject *args)
     double x0, x1, y0, y1, defvalue;
     int xsteps, ysteps;
     int npoints, ntriangles;
+    int threads = 0;
     intp dims[2];
 
-    if (!PyArg_ParseTuple(args, "ddiddidOOOOOO", &x0, &x1, &xsteps,
+    if (!PyArg_ParseTuple(args, "ddiddidOOOOOO|i", &x0, &x1, &xsteps,
         &y0, &y1, &ysteps, &defvalue, &pyx, &pyy, &pyz, &pycenters, &pynodes,
-        &pyneighbors)) {
+        &pyneighbors, &threads)) {
+        return NULL;
+    }
+    if (threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "threads must be non-negative");
         return NULL;
     }
     x = PyArray_FROMANY(pyx, PyArray_DOUBLE, 1, 1, NPY_IN_ARRAY);
@@ -648,14 +783,27 @@ static PyObject *nn_interpolate_method(PyObject *self, PyObject *args)
         (double*)PyArray_DATA(x), (double*)PyArray_DATA(y),
         (double*)PyArray_DATA(centers), (int*)PyArray_DATA(nodes),
         (int*)PyArray_DATA(neighbors));
-    nn.interpolate_grid((double*)PyArray_DATA(z),
-        x0, x1, xsteps,
-        y0, y1, ysteps,
-        (double*)PyArray_DATA(grid),
-        defvalue, 0);
+    threads = (int)min((npy_intp)mpl::resolve_num_threads(threads),
+                       PyArray_SIZE(grid) / MIN_NN_POINTS_PER_THREAD);
+    bool ok = true;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        nn.interpolate_grid((double*)PyArray_DATA(z),
+            x0, x1, xsteps,
+            y0, y1, ysteps,
+            (double*)PyArray_DATA(grid),
+            defvalue, 0, threads);
+    } catch (bad_alloc&) {
+        ok = false;
+    }
+    Py_END_ALLOW_THREADS
 
     CLEANUP
 
+    if (!ok) {
+        Py_DECREF(grid);
+        return PyErr_NoMemory();
+    }
     return grid;
 
 }
@@ -718,9 +866,15 @@ static PyMethodDef delaunay_methods[] = {
     {"compute_planes", (PyCFunction)compute_planes_method, METH_VARARGS,
         ""},
     {"linear_interpolate_grid", (PyCFunction)linear_interpolate_method, METH_VARARGS,
-        ""},
+        "grid = linear_interpolate_grid(x0, x1, xsteps, y0, y1, ysteps, defvalue,\n"
+        "    planes, x, y, nodes, neighbors, threads=0)\n\n"
+        "The rows of the grid are shared between threads threads (0 means one\n"
+        "per processor); the result does not depend on their number."},
     {"nn_interpolate_grid", (PyCFunction)nn_interpolate_method, METH_VARARGS,
-        ""},
+        "grid = nn_interpolate_grid(x0, x1, xsteps, y0, y1, ysteps, defvalue,\n"
+        "    x, y, z, centers, nodes, neighbors, threads=0)\n\n"
+        "The rows of the grid are shared between threads threads (0 means one\n"
+        "per processor); the result does not depend on their number."},
     {"nn_interpolate_unstructured", (PyCFunction)nn_interpolate_unstructured_method, METH_VARARGS,
         ""},
     {NULL, NULL, 0, NULL}
@@ -3,6 +3,7 @@
 #include <queue>
 #include <vector>
 #include <iostream>
+#include <math.h>
 
 using namespace std;
 
@@ -31,6 +32,79 @@ int walking_triangles(int start, double targetx, double targety,
     return t;
 }
 
+// Prepare the rows of a grid for walking_triangles. For each row iy, at
+// y0 + dy*iy, start[iy] is the triangle containing its first point x0,
+// as found by walking from the previous row's one, or -1 if it is
+// outside. Walking from there gives the same triangles, row by row, as
+// walking through the whole grid, so the rows can be interpolated
+// independently. Points of the row left of xmin[iy] or right of
+// xmax[iy] are certainly outside the convex hull and need no walk:
+// the range is that of the boundary edges crossing the row, padded for
+// rounding, and empty (xmin > xmax) for rows that miss the hull.
+void grid_rows(double x0, double y0, double dy, int ysteps,
+    double *x, double *y, int ntriangles, int *nodes, int *neighbors,
+    vector<int>& start, vector<double>& xmin, vector<double>& xmax)
+{
+    int i, t, iy, rowtri;
+    double targety, pad = 0.0;
+    vector<double> edges; // xa, ya, xb, yb of each boundary edge
+
+    for (t=0; t<ntriangles; t++) {
+        for (i=0; i<3; i++) {
+            if (INDEX3(neighbors, t, i) != -1) continue;
+            int a = INDEX3(nodes, t, EDGE0(i));
+            int b = INDEX3(nodes, t, EDGE1(i));
+            edges.push_back(x[a]);
+            edges.push_back(y[a]);
+            edges.push_back(x[b]);
+            edges.push_back(y[b]);
+            pad = max(pad, max(max(fabs(x[a]), fabs(y[a])),
+                               max(fabs(x[b]), fabs(y[b]))));
+        }
+    }
+    pad *= HULL_PAD_EPS;
+
+    start.resize(ysteps);
+    xmin.resize(ysteps);
+    xmax.resize(ysteps);
+    rowtri = 0;
+    for (iy=0; iy<ysteps; iy++) {
+        targety = y0 + dy*iy;
+        double lo = HUGE_VAL, hi = -HUGE_VAL;
+        if (targety != targety) {
+            // Leave NaNs to the walk
+            lo = -HUGE_VAL;
+            hi = HUGE_VAL;
+        }
+        for (i=0; i<(int)edges.size(); i+=4) {
+            double xa = edges[i], ya = edges[i+1];
+            double xb = edges[i+2], yb = edges[i+3];
+            if ((targety < min(ya, yb) - pad) || (targety > max(ya, yb) + pad)) {
+                continue;
+            }
+            if (ya == yb) {
+                lo = min(lo, min(xa, xb));
+                hi = max(hi, max(xa, xb));
+            } else {
+                double s = min(max((targety - ya) / (yb - ya), 0.0), 1.0);
+                double xs = xa + s*(xb - xa);
+                lo = min(lo, xs);
+                hi = max(hi, xs);
+            }
+        }
+        xmin[iy] = lo - pad;
+        xmax[iy] = hi + pad;
+
+        if ((x0 < xmin[iy]) || (x0 > xmax[iy])) {
+            rowtri = -1;
+        } else {
+            rowtri = walking_triangles(rowtri, x0, targety,
+                x, y, nodes, neighbors);
+        }
+        start[iy] = rowtri;
+    }
+}
+
 void getminmax(double *arr, int n, double& minimum, double& maximum)
 {
     int i;
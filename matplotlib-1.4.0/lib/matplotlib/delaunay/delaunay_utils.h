@@ -19,10 +19,14 @@ using namespace std;
 #define TOLERANCE_EPS (4e-13)
 #define PERTURB_EPS (1e-3)
 #define GINORMOUS (1e100)
+#define HULL_PAD_EPS (1e-9)
 
 extern int walking_triangles(int start, double targetx, double targety, 
     double *x, double *y, int *nodes, int *neighbors);
 extern void getminmax(double *arr, int n, double& minimum, double& maximum);
+extern void grid_rows(double x0, double y0, double dy, int ysteps,
+    double *x, double *y, int ntriangles, int *nodes, int *neighbors,
+    vector<int>& start, vector<double>& xmin, vector<double>& xmax);
 extern bool circumcenter(double x0, double y0,
                          double x1, double y1,
                          double x2, double y2,
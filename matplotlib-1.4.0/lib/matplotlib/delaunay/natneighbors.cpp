@@ -9,6 +9,10 @@
 #include <math.h>
 #include <iostream>
 #include <iterator>
+#include <algorithm>
+#include <new>
+
+#include "src/mplthreads.h"
 
 using namespace std;
 
@@ -256,30 +260,87 @@ double NaturalNeighbors::interpolate_one(double *z, double targetx, double targe
     return f;
 }
 
+namespace {
+
+// Interpolates whole rows of the grid, each walk starting from the
+// triangle found for the row by grid_rows.
+struct GridRows
+{
+    NaturalNeighbors *nn;
+    double *z;
+    double x0, dx, y0, dy;
+    int xsteps;
+    double *output, defvalue;
+    const vector<int> *start;
+    const vector<double> *xmin, *xmax;
+    vector<char> *failed;
+
+    void operator()(int begin, int end)
+    {
+        int ix, iy, coltri, tri;
+        double targetx, targety;
+
+        for (iy=begin; iy<end; iy++) {
+            targety = y0 + dy*iy;
+            double lo = (*xmin)[iy], hi = (*xmax)[iy];
+            double *row = output + (size_t)xsteps*iy;
+            tri = (*start)[iy];
+            try {
+                for (ix=0; ix<xsteps; ix++) {
+                    targetx = x0 + dx*ix;
+                    if ((targetx < lo) || (targetx > hi)) {
+                        row[ix] = defvalue;
+                        continue;
+                    }
+                    coltri = tri;
+                    row[ix] = nn->interpolate_one(z, targetx, targety,
+                        defvalue, coltri);
+                    if (coltri != -1) tri = coltri;
+                }
+            } catch (bad_alloc&) {
+                (*failed)[iy] = 1;
+            }
+        }
+    }
+};
+
+} // namespace
+
 void NaturalNeighbors::interpolate_grid(double *z,
     double x0, double x1, int xsteps,
     double y0, double y1, int ysteps,
     double *output,
-    double defvalue, int start_triangle)
+    double defvalue, int start_triangle, int threads)
 {
-    int ix, iy, rowtri, coltri, tri;
-    double dx, dy, targetx, targety;
+    double dx, dy;
+    vector<int> start;
+    vector<double> xmin, xmax;
+    vector<char> failed(ysteps, 0);
 
     dx = (x1 - x0) / (xsteps-1);
     dy = (y1 - y0) / (ysteps-1);
 
-    rowtri = 0;
-    for (iy=0; iy<ysteps; iy++) {
-        targety = y0 + dy*iy;
-        rowtri = find_containing_triangle(x0, targety, rowtri);
-        tri = rowtri;
-        for (ix=0; ix<xsteps; ix++) {
-            targetx = x0 + dx*ix;
-            coltri = tri;
-            INDEXN(output, xsteps, iy, ix) = interpolate_one(z, targetx, targety,
-                defvalue, coltri);
-            if (coltri != -1) tri = coltri;
-        }
+    grid_rows(x0, y0, dy, ysteps, x, y, ntriangles, nodes, neighbors,
+        start, xmin, xmax);
+
+    GridRows task;
+    task.nn = this;
+    task.z = z;
+    task.x0 = x0;
+    task.dx = dx;
+    task.y0 = y0;
+    task.dy = dy;
+    task.xsteps = xsteps;
+    task.output = output;
+    task.defvalue = defvalue;
+    task.start = &start;
+    task.xmin = &xmin;
+    task.xmax = &xmax;
+    task.failed = &failed;
+    mpl::parallel_for(0, ysteps, threads, task);
+
+    if (find(failed.begin(), failed.end(), 1) != failed.end()) {
+        throw bad_alloc();
     }
 }
 
@@ -17,7 +17,8 @@ public:
     void interpolate_grid(double *z, 
         double x0, double x1, int xsteps,
         double y0, double y1, int ysteps,
-        double *output, double defvalue, int start_triangle);
+        double *output, double defvalue, int start_triangle,
+        int threads = 1);
 
     void interpolate_unstructured(double *z, int size, 
         double *intx, double *inty, double *output, double defvalue);
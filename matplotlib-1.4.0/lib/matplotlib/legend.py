@@ -907,15 +907,19 @@ class Legend(Artist):
 
         #tx, ty = self.legendPatch.get_x(), self.legendPatch.get_y()
 
+        # Look up the overlaps of all the candidates at once
+        overlaps = Bbox.index(bboxes).count_overlaps(
+            [(l, b, l + width, b + height) for l, b in consider])
+
         candidates = []
-        for l, b in consider:
+        for (l, b), overlap in zip(consider, overlaps):
             legendBox = Bbox.from_bounds(l, b, width, height)
             badness = 0
             # XXX TODO: If markers are present, it would be good to
             # take their into account when checking vertex overlaps in
             # the next line.
             badness = legendBox.count_contains(verts)
-            badness += legendBox.count_overlaps(bboxes)
+            badness += int(overlap)
             for line in lines:
                 # FIXME: the following line is ill-suited for lines
                 # that 'spiral' around the center, because the bbox
@@ -176,8 +176,8 @@ class Path(object):
         internals : dict or None
             The attributes that the resulting path should have.
             Allowed keys are ``readonly``, ``should_simplify``,
-            ``simplify_threshold``, ``has_nonfinite`` and
-            ``interpolation_steps``.
+            ``simplify_threshold``, ``should_decimate``, ``has_nonfinite``
+            and ``interpolation_steps``.
 
         """
         internals = internals or {}
@@ -188,6 +188,8 @@ class Path(object):
         pth.should_simplify = internals.pop('should_simplify', True)
         pth.simplify_threshold = internals.pop('simplify_threshold',
                                           rcParams['path.simplify_threshold'])
+        pth.should_decimate = internals.pop('should_decimate',
+                                            rcParams['path.decimate'])
         pth._has_nonfinite = internals.pop('has_nonfinite', False)
         pth._interpolation_steps = internals.pop('interpolation_steps', 1)
         if internals:
@@ -202,6 +204,7 @@ class Path(object):
             (len(self._vertices) >= 128 and
             (self._codes is None or np.all(self._codes <= Path.LINETO))))
         self._simplify_threshold = rcParams['path.simplify_threshold']
+        self._should_decimate = rcParams['path.decimate']
         self._has_nonfinite = not np.isfinite(self._vertices).all()
 
     @property
@@ -267,6 +270,19 @@ class Path(object):
     def should_simplify(self, should_simplify):
         self._should_simplify = should_simplify
 
+    @property
+    def should_decimate(self):
+        """
+        `True` if, when the path is simplified, runs of vertices that
+        fall within the same pixel column should also be reduced to
+        their first, minimum, maximum and last vertices.
+        """
+        return self._should_decimate
+
+    @should_decimate.setter
+    def should_decimate(self, should_decimate):
+        self._should_decimate = should_decimate
+
     @property
     def readonly(self):
         """
@@ -444,6 +460,7 @@ class Path(object):
         internals = {'should_simplify': self.should_simplify and not simplify,
                      'has_nonfinite': self.has_nonfinite and not remove_nans,
                      'simplify_threshold': self.simplify_threshold,
+                     'should_decimate': self.should_decimate,
                      'interpolation_steps': self._interpolation_steps}
         return Path._fast_from_codes_and_verts(vertices, codes, internals)
 
@@ -492,6 +509,33 @@ class Path(object):
         result = _path.points_in_path(points, radius, self, transform)
         return result
 
+    def prepare(self, transform=None, radius=0.0):
+        """
+        Returns an object for testing many points against this path.
+
+        The edges of the path are indexed once up front, so each test
+        only looks at the few edges near the point.  The returned
+        object has the methods:
+
+          - *contains_point(x, y)*: like :meth:`contains_point`
+
+          - *contains_points(points, threads=1)*: like
+            :meth:`contains_points`, splitting the points between
+            *threads* threads (0 means one per processor)
+
+        The results are the same as for the methods of the path
+        itself.  Later changes to the path are not reflected.
+
+        If *transform* is not *None*, the path will be transformed
+        before performing the tests.
+
+        *radius* allows the path to be made slightly larger or
+        smaller.
+        """
+        if transform is not None:
+            transform = transform.frozen()
+        return _path.prepare_path(self, transform, radius)
+
     def contains_path(self, path, transform=None):
         """
         Returns *True* if this path completely contains the given path.
@@ -531,6 +575,18 @@ class Path(object):
         """
         return _path.path_intersects_path(self, other, filled)
 
+    def intersects_paths(self, others, filled=True):
+        """
+        Returns a boolean array telling for each path in the sequence
+        *others* whether this path intersects it, as
+        :meth:`intersects_path` would.
+
+        The segments of this path are only indexed once, so this is
+        much faster than calling :meth:`intersects_path` for each path
+        when this one is large.
+        """
+        return _path.path_intersects_paths(self, others, filled)
+
     def intersects_bbox(self, bbox, filled=True):
         """
         Returns *True* if this path intersects a given
@@ -935,6 +991,36 @@ class Path(object):
         paths = [Path(poly) for poly in verts]
         return self.make_compound_path(*paths)
 
+    _boolean_operations = {'intersection': 0, 'union': 1, 'difference': 2}
+
+    def clip_to_path(self, other, operation='intersection',
+                     transform=None, other_transform=None):
+        """
+        Returns the path bounding the region obtained by combining the
+        regions filled by this path and *other*.
+
+        *operation* is one of 'intersection', 'union' or 'difference'
+        (the part of this path's region outside of *other*).
+
+        Both paths are treated as closed polygons filled with the
+        even-odd rule; curves are approximated by line segments.
+        *transform* and *other_transform*, if given, are applied to
+        the paths first.  The result is made up of closed polygons,
+        outer boundaries counterclockwise and holes clockwise, and is
+        empty if the region is.  Vertices, and the points where edges
+        cross, are rounded to a grid of a few parts in 10**8 of the size
+        of both paths, so that edges which overlap, or cross at one
+        point, are combined consistently.
+        """
+        if operation not in self._boolean_operations:
+            raise ValueError(
+                "operation must be one of %s, not %r" %
+                (', '.join(sorted(self._boolean_operations)), operation))
+        vertices, codes = _path.clip_path_to_path(
+            self, transform, other, other_transform,
+            self._boolean_operations[operation])
+        return Path(vertices, codes)
+
 
 def get_path_collection_extents(
         master_transform, paths, transforms, offsets, offset_transform):
@@ -764,10 +764,12 @@ defaultParams = {
 
     'path.simplify': [True, validate_bool],
     'path.simplify_threshold': [1.0 / 9.0, ValidateInterval(0.0, 1.0)],
+    'path.decimate': [False, validate_bool],
     'path.snap': [True, validate_bool],
     'path.sketch': [None, validate_sketch],
     'path.effects': [[], validate_any],
     'agg.path.chunksize': [0, validate_int],       # 0 to disable chunking;
+    'agg.threads': [1, validate_int],  # 0 for one thread per processor
 
     # key-mappings (multi-character mappings should be a list/tuple)
     'keymap.fullscreen':   [('f', 'ctrl+f'), validate_stringlist],
@@ -6,9 +6,13 @@ import six
 import io
 import os
 
-from numpy.testing import assert_array_almost_equal
+import numpy as np
+from numpy.testing import (assert_array_almost_equal, assert_array_equal,
+                           assert_raises)
 
+from matplotlib import rc_context
 from matplotlib.image import imread
+from matplotlib.backends import _backend_agg
 from matplotlib.backends.backend_agg import FigureCanvasAgg as FigureCanvas
 from matplotlib.figure import Figure
 from matplotlib.testing.decorators import cleanup
@@ -47,6 +51,395 @@ def test_repeated_save_with_alpha():
                               decimal=3)
 
 
+def _render_to_array(draw, size=(8, 6), dpi=100):
+    fig = Figure(size, dpi=dpi)
+    canvas = FigureCanvas(fig)
+    draw(fig)
+    canvas.draw()
+    return np.frombuffer(canvas.buffer_rgba(), np.uint8).copy()
+
+
+def _draw_threaded_scene(fig):
+    from matplotlib.patches import Circle, Polygon
+
+    ax = fig.add_subplot(111)
+    x = np.linspace(0, 10, 20000)
+    ax.plot(x, np.sin(x * 7) * np.cos(x), lw=2)
+    ax.plot(x, np.cos(x * 3), 'r--', lw=5, antialiased=False)
+    ax.add_patch(Polygon([[1, -1], [9, -0.5], [5, 1]], alpha=0.5, hatch='/'))
+    circle = Circle((5, 0), 0.8, transform=ax.transData)
+    ax.fill_between(x, -1, np.sin(x), facecolor='g', alpha=0.4,
+                    clip_path=circle)
+    ax.set_xlim(0, 10)
+    ax.set_ylim(-1.2, 1.2)
+
+
+@cleanup
+def test_threaded_rasterization_identical():
+    with rc_context({'agg.threads': 1}):
+        serial = _render_to_array(_draw_threaded_scene)
+    for threads in (0, 2, 3, 7):
+        with rc_context({'agg.threads': threads}):
+            threaded = _render_to_array(_draw_threaded_scene)
+        assert_array_equal(serial, threaded)
+
+
+def _draw_gouraud_scene(fig):
+    from matplotlib.patches import Circle
+    import matplotlib.tri as mtri
+
+    rs = np.random.RandomState(0)
+    x = rs.rand(1000)
+    y = rs.rand(1000)
+    triang = mtri.Triangulation(x, y)
+    ax = fig.add_subplot(121)
+    ax.tripcolor(triang, np.sin(x * 6) * np.cos(y * 6), shading='gouraud',
+                 alpha=0.7)
+    ax = fig.add_subplot(122)
+    circle = Circle((0.5, 0.5), 0.4, transform=ax.transData)
+    collection = ax.tripcolor(triang, x * y, shading='gouraud')
+    collection.set_clip_path(circle)
+    ax.set_xlim(-0.2, 1.1)
+
+
+@cleanup
+def test_threaded_gouraud_identical():
+    with rc_context({'agg.threads': 1}):
+        serial = _render_to_array(_draw_gouraud_scene)
+    for threads in (2, 5):
+        with rc_context({'agg.threads': threads}):
+            threaded = _render_to_array(_draw_gouraud_scene)
+        assert_array_equal(serial, threaded)
+
+
+def _draw_marker_scene(marker, mew):
+    def draw(fig):
+        ax = fig.add_subplot(111)
+        x = np.linspace(0, 1, 500)
+        ax.plot(x, x ** 2, marker, ms=12, mew=mew, mfc='y', mec='k')
+        ax.plot(x, np.sqrt(x), marker, ms=12, mew=mew, mfc='none')
+    return draw
+
+
+@cleanup
+def test_marker_cache_reuse():
+    first = _render_to_array(_draw_marker_scene('o', 1))
+    other = _render_to_array(_draw_marker_scene('o', 3))
+    assert (first != other).any()
+    # Drawing the first scene again is served from the marker cache
+    before = _backend_agg.cache_info()
+    assert_array_equal(first, _render_to_array(_draw_marker_scene('o', 1)))
+    after = _backend_agg.cache_info()
+    assert after['marker_misses'] == before['marker_misses']
+    assert after['marker_hits'] >= before['marker_hits'] + 2
+    assert_array_equal(other, _render_to_array(_draw_marker_scene('o', 3)))
+
+
+def _draw_clip_scene(shared):
+    from matplotlib.patches import Circle
+
+    def draw(fig):
+        ax = fig.add_subplot(111)
+        ax.set_xlim(0, 10)
+        ax.set_ylim(0, 10)
+        rs = np.random.RandomState(0)
+        # More clip paths than the renderer keeps, some partly off canvas
+        centers = [(i % 5 * 3 - 1, i // 5 * 3 - 1) for i in range(20)]
+        circles = [Circle(c, 2, transform=ax.transData) for c in centers]
+        for i in range(60):
+            if shared:
+                clip = circles[i * 7 % 20]
+            else:
+                clip = Circle(centers[i * 7 % 20], 2, transform=ax.transData)
+            ax.plot(rs.rand(5) * 10, rs.rand(5) * 10, lw=3, clip_path=clip)
+    return draw
+
+
+@cleanup
+def test_clip_mask_cache():
+    shared = _render_to_array(_draw_clip_scene(True))
+    fresh = _render_to_array(_draw_clip_scene(False))
+    assert_array_equal(shared, fresh)
+    assert (shared != 255).any()
+
+
+def _draw_hatch_scene(color):
+    def draw(fig):
+        ax = fig.add_subplot(111)
+        for i, hatch in enumerate(['/', 'x', '/', 'o']):
+            ax.bar(np.arange(30) + i * 0.2, np.linspace(0.1, 1, 30),
+                   width=0.2, hatch=hatch, color='w', edgecolor=color)
+    return draw
+
+
+@cleanup
+def test_hatch_cache_reuse():
+    first = _render_to_array(_draw_hatch_scene('k'))
+    other = _render_to_array(_draw_hatch_scene('r'))
+    assert (first != other).any()
+    # Drawing the first scene again is served from the hatch cache
+    before = _backend_agg.cache_info()
+    assert_array_equal(first, _render_to_array(_draw_hatch_scene('k')))
+    after = _backend_agg.cache_info()
+    assert after['hatch_misses'] == before['hatch_misses']
+    assert after['hatch_hits'] >= before['hatch_hits'] + 3
+    assert_array_equal(other, _render_to_array(_draw_hatch_scene('r')))
+
+
+@cleanup
+def test_path_collection_array_styles():
+    from matplotlib.backends.backend_agg import RendererAgg
+    from matplotlib.path import Path
+    from matplotlib.transforms import IdentityTransform
+
+    def render(linewidths, antialiaseds):
+        renderer = RendererAgg(100, 100, 72)
+        gc = renderer.new_gc()
+        paths = [Path([[0, 0], [10, 0], [10, 10], [0, 10]], closed=True),
+                 Path([[0, 0], [5, 8], [8, 3]], closed=True)]
+        offsets = np.arange(40.0).reshape(20, 2) * 4
+        facecolors = np.array([[1, 0, 0, 0.5], [0, 0, 1, 0.8]])
+        edgecolors = np.array([[0, 0, 0, 1], [0, 1, 0, 1], [0, 1, 1, 1]])
+        renderer.draw_path_collection(
+            gc, IdentityTransform().frozen(), paths, [], offsets,
+            IdentityTransform().frozen(), facecolors, edgecolors,
+            linewidths, [(None, None)], antialiaseds, [None], 'screen')
+        return np.frombuffer(renderer.buffer_rgba(), np.uint8).copy()
+
+    expected = render([0.5, 2, 1.5], [True, False])
+    assert_array_equal(expected,
+                       render(np.array([0.5, 2, 1.5]), np.array([1, 0])))
+    assert (expected != render([1], [True])).any()
+
+
+@cleanup
+def test_rectilinear_quad_mesh():
+    from matplotlib.backends.backend_agg import RendererAgg
+    from matplotlib.path import Path
+    from matplotlib.transforms import (Affine2D, Bbox, IdentityTransform,
+                                       TransformedPath)
+
+    rs = np.random.RandomState(0)
+    x = np.cumsum(rs.rand(31))
+    y = np.cumsum(rs.rand(21))[::-1]
+    coordinates = np.dstack(np.meshgrid(x, y))
+    facecolors = rs.rand(600, 4)
+    edgecolors = np.zeros((0, 4))
+    trans = Affine2D().scale(3.1, 4.3).translate(0.3, 0.45).frozen()
+
+    def render(offsets, antialiased, clip_path=None):
+        renderer = RendererAgg(100, 100, 72)
+        gc = renderer.new_gc()
+        gc.set_clip_rectangle(Bbox([[2.5, 3], [95, 90.5]]))
+        if clip_path is not None:
+            gc.set_clip_path(TransformedPath(clip_path, IdentityTransform()))
+        renderer.draw_quad_mesh(gc, trans, 30, 20, coordinates, offsets,
+                                IdentityTransform().frozen(), facecolors,
+                                antialiased, edgecolors)
+        return np.frombuffer(renderer.buffer_rgba(), np.uint8).copy()
+
+    # A single offset takes the direct rasterization of rectilinear
+    # meshes, several (even if all zero) the generic collection code
+    clip_path = Path.circle((48.3, 51.7), 40.2)
+    for antialiased in (True, False):
+        assert_array_equal(render(np.zeros((1, 2)), antialiased),
+                           render(np.zeros((2, 2)), antialiased))
+        assert_array_equal(render(np.zeros((1, 2)), antialiased, clip_path),
+                           render(np.zeros((2, 2)), antialiased, clip_path))
+
+
+@cleanup
+def test_alpha_blending():
+    from matplotlib.backends.backend_agg import RendererAgg
+    from matplotlib.path import Path
+    from matplotlib.transforms import IdentityTransform
+
+    def blend(dest, color, alpha):
+        # blender_rgba_plain, in exact integer arithmetic
+        dest = dest.astype(np.int64)
+        a = dest[..., 3:]
+        rgb = dest[..., :3] * a
+        new_a = ((alpha + a) << 8) - alpha * a
+        out = np.empty_like(dest)
+        out[..., :3] = (((color[:3] << 8) - rgb) * alpha + (rgb << 8)) // new_a
+        out[..., 3:] = new_a >> 8
+        return out.astype(np.uint8)
+
+    renderer = RendererAgg(23, 7, 72)
+    expected = np.zeros((7, 23, 4), np.uint8)
+    expected[...] = [255, 255, 255, 0]
+    rs = np.random.RandomState(0)
+    for i in range(20):
+        # Pixel aligned rectangles, so every pixel is fully covered
+        x0, x1 = sorted(rs.randint(0, 24, 2))
+        y0, y1 = sorted(rs.randint(0, 8, 2))
+        color = rs.randint(0, 256, 4)
+        gc = renderer.new_gc()
+        gc.set_linewidth(0)
+        gc.set_snap(False)
+        path = Path([[x0, y0], [x1, y0], [x1, y1], [x0, y1], [x0, y0]],
+                    [Path.MOVETO] + [Path.LINETO] * 3 + [Path.CLOSEPOLY])
+        renderer.draw_path(gc, path, IdentityTransform(),
+                           tuple(color / 255.0))
+        region = expected[7 - y1:7 - y0, x0:x1]
+        if color[3] == 255:
+            region[...] = color
+        elif color[3]:
+            region[...] = blend(region, color, color[3])
+    assert_array_equal(
+        np.frombuffer(renderer.buffer_rgba(), np.uint8).reshape(7, 23, 4),
+        expected)
+
+
+@cleanup
+def test_pixel_export():
+    def draw(fig):
+        ax = fig.add_subplot(111)
+        ax.scatter(np.arange(20), np.arange(20) ** 0.5, c=np.arange(20),
+                   s=200, alpha=0.6)
+
+    # An odd width exercises the leftover pixels of the conversions
+    fig = Figure((2.33, 1.5))
+    canvas = FigureCanvas(fig)
+    draw(fig)
+    canvas.draw()
+    width, height = canvas.get_width_height()
+    rgba = np.frombuffer(canvas.buffer_rgba(), np.uint8).reshape(
+        height, width, 4)
+    expected = {'rgba': rgba,
+                'argb': rgba[..., [3, 0, 1, 2]],
+                'bgra': rgba[..., [2, 1, 0, 3]],
+                'rgb': rgba[..., :3]}
+
+    for format in ('rgb', 'argb'):
+        string = getattr(canvas, 'tostring_' + format)()
+        assert_array_equal(
+            np.frombuffer(string, np.uint8).reshape(expected[format].shape),
+            expected[format])
+
+    for format, pixels in six.iteritems(expected):
+        out = np.zeros(pixels.shape, np.uint8)
+        canvas.copy_pixels(out, format)
+        assert_array_equal(out, pixels)
+        out = bytearray(pixels.size)
+        canvas.copy_pixels(out, format)
+        assert_array_equal(np.frombuffer(out, np.uint8), pixels.ravel())
+
+    assert_raises(ValueError, canvas.copy_pixels,
+                  bytearray(rgba.size - 1))
+    assert_raises(ValueError, canvas.copy_pixels,
+                  bytearray(rgba.size), 'abgr')
+
+
+@cleanup
+def test_damage_tracking():
+    from matplotlib.patches import Circle, Rectangle
+
+    fig = Figure((4, 3))
+    canvas = FigureCanvas(fig)
+    ax = fig.add_axes([0.1, 0.1, 0.8, 0.8])
+    ax.set_xlim(0, 10)
+    ax.set_ylim(0, 10)
+    canvas.draw()
+    renderer = canvas.get_renderer()
+    width, height = canvas.get_width_height()
+
+    def pixels():
+        return np.frombuffer(renderer.buffer_rgba(), np.uint8).reshape(
+            height, width, 4).copy()
+
+    def damage_mask():
+        mask = np.zeros((height, width), bool)
+        for bbox in renderer.get_damage():
+            x0, y0, x1, y1 = [int(v) for v in bbox.extents]
+            mask[height - y1:height - y0, x0:x1] = True
+        return mask
+
+    rs = np.random.RandomState(0)
+    circle = Circle((5, 5), 1, transform=ax.transData)
+    artists = [
+        ax.plot([1, 3, 2], [1, 2, 5], lw=3)[0],
+        ax.plot(rs.rand(20) * 3 + 6, rs.rand(20) * 3, 'o', ms=10)[0],
+        ax.scatter(rs.rand(20) * 3, rs.rand(20) * 3 + 6, s=100,
+                   c=rs.rand(20)),
+        ax.add_patch(Rectangle((4, 4), 2, 2, hatch='//', fc='none')),
+        ax.text(4, 1, 'Hello', size=20),
+        ax.pcolormesh(np.array([0, 1, 2.]), np.array([7, 8, 9.5]),
+                      rs.rand(2, 2)),
+        ax.plot([4, 6], [4, 6], lw=8, clip_path=circle)[0]]
+
+    renderer.set_damage_tracking(True)
+    for artist in artists:
+        renderer.reset_damage()
+        before = pixels()
+        artist.draw(renderer)
+        changed = (pixels() != before).any(axis=-1)
+        mask = damage_mask()
+        assert changed.any()
+        assert not (changed & ~mask).any()
+        assert mask.sum() < width * height / 10
+
+    # An incremental update of a mirror of the canvas
+    mirror = pixels()
+    renderer.clear(damaged_only=True)
+    artists[0].draw(renderer)
+    renderer.copy_pixels(mirror, damaged_only=True)
+    assert_array_equal(mirror, pixels())
+
+    renderer.reset_damage()
+    renderer.clear()
+    assert damage_mask().all()
+    renderer.set_damage_tracking(False)
+    artists[0].draw(renderer)
+    assert renderer.get_damage() == []
+
+
+@cleanup
+def test_damage_not_overlapping():
+    from matplotlib.backend_bases import GraphicsContextBase
+    from matplotlib.backends.backend_agg import RendererAgg
+    from matplotlib.path import Path
+    from matplotlib.transforms import Affine2D
+
+    renderer = RendererAgg(200, 100, 72)
+    gc = GraphicsContextBase()
+    renderer.set_damage_tracking(True)
+
+    def fill(x0, y0, x1, y1):
+        renderer.draw_path(gc, Path.unit_rectangle(),
+                           Affine2D().scale(x1 - x0, y1 - y0)
+                           .translate(x0, y0), (1, 0, 0, 1))
+
+    def check(drawn):
+        extents = [bbox.extents for bbox in renderer.get_damage()]
+        for i, a in enumerate(extents):
+            for b in extents[:i]:
+                assert not (a[0] < b[2] and b[0] < a[2] and
+                            a[1] < b[3] and b[1] < a[3])
+        mask = np.zeros((100, 200), bool)
+        for x0, y0, x1, y1 in extents:
+            mask[int(y0):int(y1), int(x0):int(x1)] = True
+        for x0, y0, x1, y1 in drawn:
+            assert mask[y0:y1, x0:x1].all()
+
+    # The third rectangle bridges the first two
+    drawn = [(10, 40, 20, 50), (40, 40, 50, 50), (15, 40, 45, 50)]
+    for rect in drawn:
+        fill(*rect)
+    check(drawn)
+    assert len(renderer.get_damage()) == 1
+
+    # More rectangles than are kept separately
+    renderer.reset_damage()
+    rs = np.random.RandomState(0)
+    drawn = []
+    for i in range(60):
+        x0, y0 = rs.randint(0, 180), rs.randint(0, 90)
+        drawn.append((x0, y0, x0 + rs.randint(2, 20), y0 + rs.randint(2, 10)))
+        fill(*drawn[-1])
+        check(drawn)
+
+
 def report_memory(i):
     pid = os.getpid()
     a2 = os.popen('ps -p %d -o rss,sz' % pid).readlines()
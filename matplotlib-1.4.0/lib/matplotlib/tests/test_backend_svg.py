@@ -72,6 +72,35 @@ def test_text_urls():
     assert expected in buf
 
 
+def test_convert_to_svg():
+    from matplotlib import _path
+    from matplotlib.path import Path
+
+    np.random.seed(0)
+    values = np.random.uniform(-1, 1, 20000) * \
+        10.0 ** np.random.randint(-7, 9, 20000)
+    values[:8] = [0, 1e-4, 0.5, 2.5, 999999.5, 123456.5, 1e6, -1e300]
+    vertices = values.reshape(-1, 2)
+    path = Path(vertices)
+
+    for precision in (3, 6, 12):
+        expected = ''.join(
+            '\n%s%.*g %.*g' % ('L' if i else 'M', precision, x, precision, y)
+            for i, (x, y) in enumerate(vertices))
+        assert _path.convert_to_svg(path, None, None, False,
+                                    precision) == expected
+
+        chunks = []
+
+        class File(object):
+            def write(self, data):
+                chunks.append(data)
+
+        assert _path.convert_to_svg(path, None, None, False, precision,
+                                    File()) is None
+        assert ''.join(chunks) == expected
+
+
 if __name__ == '__main__':
     import nose
     nose.runmodule(argv=['-s', '--with-doctest'], exit=False)
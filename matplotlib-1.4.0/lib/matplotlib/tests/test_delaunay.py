@@ -208,6 +208,42 @@ def test_0d_grid():
     res = ref_interpolator[3:3:1j,1:1:1j]
     assert np.allclose(res, [[1.6]], rtol=0)
 
+def test_grid_interpolators():
+    # A plane, on a grid that reaches past the convex hull
+    from matplotlib import _delaunay
+    from matplotlib.path import Path
+    np.random.seed(0)
+    x, y = np.random.rand(2, 1000)
+    tri = Triangulation(x, y)
+    z = 2*x + 3*y + 1
+    key = (slice(-0.1, 1.1, 300j), slice(-0.1, 1.1, 250j))
+    gy, gx = np.mgrid[key]
+    hull = Path(np.column_stack([x[tri.hull], y[tri.hull]]))
+    inside = hull.contains_points(np.column_stack([gx.ravel(), gy.ravel()]))
+    inside = inside.reshape(gx.shape)
+
+    linear = tri.linear_interpolator(z)
+    nn = tri.nn_interpolator(z)
+    for interp in (linear, nn):
+        grid = interp[key]
+        assert np.array_equal(np.isnan(grid), ~inside)
+        assert np.allclose(grid[inside], (2*gx + 3*gy + 1)[inside])
+
+    # The rows may be shared between any number of threads (the grid is
+    # large enough for the linear interpolator to use more than one)
+    spec = (-0.1, 1.1, 250, -0.1, 1.1, 300, np.nan)
+    nodes, neighbors = tri.triangle_nodes, tri.triangle_neighbors
+    for threads in (1, 3):
+        for grid, expected in [
+                (_delaunay.linear_interpolate_grid(*(spec + (
+                    linear.planes, x, y, nodes, neighbors, threads))),
+                 linear[key]),
+                (_delaunay.nn_interpolate_grid(*(spec + (
+                    x, y, z, tri.circumcenters, nodes, neighbors, threads))),
+                 nn[key])]:
+            assert np.array_equal(grid[inside], expected[inside])
+            assert np.isnan(grid[~inside]).all()
+
 @image_comparison(baseline_images=['delaunay-1d-interp'], extensions=['png'])
 def test_1d_plots():
     x_range = slice(0.25,9.75,20j)
@@ -4,6 +4,7 @@ from __future__ import (absolute_import, division, print_function,
 import six
 
 import numpy as np
+from numpy.testing import assert_almost_equal
 
 from matplotlib.path import Path
 from nose.tools import assert_raises
@@ -36,6 +37,199 @@ def test_contains_points_negative_radius():
 
     assert np.all(path.contains_points(points, radius=-0.5) == expected)
 
+
+def test_prepared_path():
+    # A star with a hole and an unclosed extra subpath, tested on a grid
+    # that hits vertices and edges exactly
+    theta = np.linspace(0, 2 * np.pi, 11)[:-1]
+    radii = np.where(np.arange(10) % 2, 0.5, 1.0)
+    star = np.column_stack([radii * np.cos(theta), radii * np.sin(theta)])
+    verts = np.concatenate([star, [star[0]], star * 0.25, [star[0] * 0.25],
+                            [(1, 1), (2, 1), (2, 2)]])
+    codes = ([Path.MOVETO] + [Path.LINETO] * 9 + [Path.CLOSEPOLY]) * 2 + \
+        [Path.MOVETO, Path.LINETO, Path.LINETO]
+    path = Path(verts, codes)
+    points = np.mgrid[-1.5:2.5:33j, -1.5:2.5:33j].reshape(2, -1).T
+    points = np.concatenate([points, verts, [(np.nan, 0.0)]])
+
+    for radius in (0.0, 0.1):
+        # Fewer than 16 points at a time are tested edge by edge
+        expected = np.concatenate(
+            [path.contains_points(points[i:i + 8], radius=radius)
+             for i in range(0, len(points), 8)])
+        assert np.all(path.contains_points(points, radius=radius) ==
+                      expected)
+        prepared = path.prepare(radius=radius)
+        assert np.all(prepared.contains_points(points) == expected)
+        # Enough points for more than one thread
+        assert np.all(prepared.contains_points(np.tile(points, (8, 1)), 3) ==
+                      np.tile(expected, 8))
+        assert [bool(prepared.contains_point(x, y)) for x, y in points] == \
+            list(expected)
+
+
+def test_intersects_large_paths():
+    # Random walks on an integer grid, so that many segments touch at
+    # end points or are collinear
+    np.random.seed(0)
+    walks = [Path(np.cumsum(np.random.randint(-2, 3, (400, 2)), axis=0) +
+                  np.random.randint(-40, 40, 2) * 3)
+             for i in range(12)]
+    walks.append(Path(walks[0].vertices[::-1] + (0, 200)))
+    walks.append(Path(walks[0].vertices[100:102] + (0.5, 0)))
+    path = walks[0]
+
+    def chunked_intersects(other):
+        # Paths of 32 vertices or less are tested segment by segment
+        return any(Path(path.vertices[i:i + 32]).intersects_path(
+            other, filled=False) for i in range(0, len(path.vertices), 31))
+
+    expected = [chunked_intersects(other) for other in walks]
+    assert True in expected and False in expected
+    assert [path.intersects_path(other, filled=False)
+            for other in walks] == expected
+    assert list(path.intersects_paths(walks, filled=False)) == expected
+    assert list(path.intersects_paths(walks)) == \
+        [path.intersects_path(other) for other in walks]
+
+
+def _polygons_area(path):
+    return sum(0.5 * np.sum(poly[:-1, 0] * poly[1:, 1] -
+                            poly[1:, 0] * poly[:-1, 1])
+               for poly in path.to_polygons())
+
+
+def _even_odd_area(*polygons):
+    # No edges cross within the vertical slabs between the x coordinates
+    # of the vertices and crossings, so each slab is a stack of trapezoids
+    edges = np.concatenate([np.column_stack([poly, np.roll(poly, -1, 0)])
+                            for poly in polygons])
+    x0, y0, x1, y1 = edges.T
+    dx, dy = x1 - x0, y1 - y0
+    wx, wy = x0 - x0[:, None], y0 - y0[:, None]
+    with np.errstate(divide='ignore', invalid='ignore'):
+        den = np.outer(dx, dy) - np.outer(dy, dx)
+        t = (wx * dy - wy * dx) / den
+        u = (wx * dy[:, None] - wy * dx[:, None]) / den
+    crossing = (t > 0) & (t < 1) & (u > 0) & (u < 1)
+    xs = np.unique(np.concatenate(
+        [x0, x1, (x0[:, None] + t * dx[:, None])[crossing]]))
+
+    area = 0
+    for left, right in zip(xs[:-1], xs[1:]):
+        xm = (left + right) / 2
+        spans = (np.minimum(x0, x1) < xm) & (np.maximum(x0, x1) > xm)
+        ys = np.sort(y0[spans] + (xm - x0[spans]) * dy[spans] / dx[spans])
+        area += (ys[1::2] - ys[::2]).sum() * (right - left)
+    return area
+
+
+def test_clip_to_path():
+    square = Path.unit_rectangle()
+    shifted = Path(square.vertices + 0.5, square.codes)
+    beside = Path(square.vertices + (1, 0), square.codes)
+    hole = Path(square.vertices * 0.5 + 0.25, square.codes)
+
+    for other, areas in [(shifted, (0.25, 1.75, 0.75)),
+                         (beside, (0, 2, 1)),
+                         (square, (1, 1, 0)),
+                         (hole, (0.25, 1, 0.75))]:
+        for operation, area in zip(['intersection', 'union', 'difference'],
+                                   areas):
+            result = square.clip_to_path(other, operation)
+            assert_almost_equal(_polygons_area(result), area)
+
+    # Edges shared with the other path are merged away
+    assert len(square.clip_to_path(beside, 'union').vertices) == 5
+    assert len(square.clip_to_path(hole, 'difference').to_polygons()) == 2
+
+    # Self-intersecting polygons, against sampled even-odd insideness
+    np.random.seed(1)
+    x = (np.arange(200) + 0.5) / 200
+    points = np.column_stack([c.ravel() for c in np.meshgrid(x, x)])
+
+    def inside(path):
+        result = np.zeros(len(points), bool)
+        for poly in path.to_polygons():
+            result ^= Path(poly).contains_points(points)
+        return result
+
+    for i in range(5):
+        a = Path(np.random.rand(8, 2))
+        b = Path(np.random.rand(8, 2))
+        in_a, in_b = inside(a), inside(b)
+        for operation, expected in [('intersection', in_a & in_b),
+                                    ('union', in_a | in_b),
+                                    ('difference', in_a & ~in_b)]:
+            result = a.clip_to_path(b, operation)
+            assert_almost_equal(_polygons_area(result), expected.mean(),
+                                decimal=2)
+
+    # Degenerate cases, against the exact even-odd area: a path with
+    # itself, paths sharing edges, and vertices on a coarse grid, where
+    # edges run along each other and several cross at one point
+    def check(a, b, scale=1):
+        area_a, area_b = _even_odd_area(a), _even_odd_area(b)
+        both = (area_a + area_b - _even_odd_area(a, b)) / 2
+        for operation, area in [('intersection', both),
+                                ('union', area_a + area_b - both),
+                                ('difference', area_a - both)]:
+            result = Path(a * scale).clip_to_path(Path(b * scale), operation)
+            result = Path(result.vertices / scale, result.codes)
+            assert_almost_equal(_polygons_area(result), area, decimal=6)
+
+    bowtie = np.array([[0.25, 0], [0.25, 0.75], [0.75, 0], [0.625, 0],
+                       [0.5, 0.625]])
+    check(bowtie, bowtie)
+    # Without overflowing
+    check(bowtie, bowtie, 1e200)
+    check(bowtie, bowtie + 0.125, 1e200)
+
+    for i in range(20):
+        a = np.random.rand(8, 2)
+        check(a, a)
+        check(a, a[::-1])
+        grid = np.random.randint(0, 5, (8, 2)) / 4
+        check(grid, grid)
+        shared = grid.copy()
+        shared[0] = np.random.randint(0, 5, 2) / 4
+        check(grid, shared)
+        check(grid, np.random.randint(0, 5, (8, 2)) / 4)
+
+    assert_raises(ValueError, square.clip_to_path, square, 'xor')
+
+
+def test_path_collection_extents():
+    from matplotlib import _path
+    from matplotlib.path import get_path_collection_extents, get_paths_extents
+    from matplotlib.transforms import Affine2D
+
+    np.random.seed(0)
+    offsets = np.random.randn(200000, 2)
+    offsets[5] = (np.nan, 100.0)
+    path = Path.unit_circle()
+    transform = Affine2D().scale(2)
+    bbox = get_path_collection_extents(
+        transform, [path], [], offsets, Affine2D())
+    # Offsets with a NaN coordinate are skipped altogether
+    valid = np.delete(offsets, 5, axis=0)
+    assert_almost_equal(bbox.extents,
+                        np.concatenate([valid.min(axis=0) - 2,
+                                        valid.max(axis=0) + 2]))
+    assert_almost_equal(get_paths_extents([path]).extents, [-1, -1, 1, 1])
+
+    # Per item transforms and several paths, by any number of threads
+    paths = [path, Path(np.random.rand(30, 2))]
+    transforms = np.array([Affine2D().rotate(a).get_matrix()
+                           for a in np.random.rand(1000)])
+    for args in [([path], transforms, offsets),
+                 (paths, [], offsets),
+                 (paths, list(transforms[:7]), offsets[:100000])]:
+        expected = _path.get_path_collection_extents(
+            transform, *(args + (Affine2D(), 1)))
+        assert _path.get_path_collection_extents(
+            transform, *(args + (Affine2D(), 3))) == expected
+
 if __name__ == '__main__':
     import nose
     nose.runmodule(argv=['-s', '--with-doctest'], exit=False)
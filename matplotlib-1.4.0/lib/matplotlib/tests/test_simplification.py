@@ -13,6 +13,7 @@ import numpy as np
 from matplotlib import patches, path, transforms
 
 from nose.tools import raises
+from numpy.testing import assert_array_equal
 import io
 
 nan = np.nan
@@ -84,6 +85,55 @@ def test_sine_plus_noise():
 
     assert len(simplified) == 876
 
+@cleanup
+def test_decimate_columns():
+    np.random.seed(0)
+    x = np.linspace(0, 100, 100000, endpoint=False)
+    y = np.cumsum(np.random.uniform(-1, 1, size=x.shape))
+
+    p = Path(np.column_stack([x, y]))
+    assert not p.should_decimate
+    p.should_decimate = True
+    cleaned = p.cleaned(simplify=True)
+    assert cleaned.codes[-1] == Path.STOP
+    decimated = cleaned.vertices[:-1]
+
+    # At most the first, lowest, highest and last vertex of each column
+    assert len(decimated) <= 4 * 100
+    assert_array_equal(decimated[0], [x[0], y[0]])
+    assert_array_equal(decimated[-1], [x[-1], y[-1]])
+    columns = np.floor(decimated[:, 0])
+    for i in (0, 37, 99):
+        column = y[i * 1000:(i + 1) * 1000]
+        assert decimated[columns == i, 1].min() == column.min()
+        assert decimated[columns == i, 1].max() == column.max()
+
+    p.should_decimate = False
+    assert len(p.cleaned(simplify=True).vertices) > 4 * 100
+
+def test_block_transformer():
+    # Paths without codes are transformed and stripped of NaNs a block
+    # at a time, with NaN runs that cross blocks
+    np.random.seed(0)
+    vertices = np.random.randn(2000, 2) * 100
+    vertices[np.random.rand(2000) < 0.2, 0] = np.nan
+    vertices[250:600, 1] = np.inf
+    vertices[-3:] = np.nan
+    trans = transforms.Affine2D().rotate(0.3).scale(2, 3).translate(5, 7)
+    transformed = trans.transform(vertices)
+
+    cleaned = Path(vertices).cleaned(transform=trans, remove_nans=False)
+    assert_array_equal(cleaned.vertices[:-1], transformed)
+
+    # Each vertex after a run of non-finite ones starts a new subpath
+    cleaned = Path(vertices).cleaned(transform=trans, remove_nans=True)
+    finite = np.isfinite(transformed).all(axis=1)
+    codes = np.where(np.concatenate([[True], ~finite[:-1]]),
+                     Path.MOVETO, Path.LINETO)
+    assert_array_equal(cleaned.vertices[:-1], transformed[finite])
+    assert_array_equal(cleaned.codes[:-1], codes[finite])
+    assert cleaned.codes[-1] == Path.STOP
+
 @image_comparison(baseline_images=['simplify_curve'], remove_text=True)
 def test_simplify_curve():
     pp1 = patches.PathPatch(
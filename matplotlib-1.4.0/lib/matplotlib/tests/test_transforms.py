@@ -187,6 +187,40 @@ def test_Affine2D_from_values():
     assert_almost_equal(actual,expected)
 
 
+def test_affine_transform_out():
+    from matplotlib._path import affine_transform
+
+    rs = np.random.RandomState(0)
+    # Enough points for two threads
+    n = 2 ** 19 + 1000
+    points = rs.randn(n, 2) * 1e3
+    mtx = mtrans.Affine2D().rotate(0.3).scale(2, 3).translate(
+        1, -7).get_matrix()
+    a, b, c, d, e, f = mtx[:2].T.flatten()
+    x, y = points[:, 0], points[:, 1]
+    expected = np.column_stack([a * x + c * y + e, b * x + d * y + f])
+
+    np_test.assert_array_equal(affine_transform(points, mtx), expected)
+    # Strided input
+    np_test.assert_array_equal(
+        affine_transform(np.asfortranarray(points), mtx), expected)
+    np_test.assert_array_equal(
+        affine_transform(points[::2], mtx), expected[::2])
+    # Split between threads, into a given output and in place
+    np_test.assert_array_equal(affine_transform(points, mtx, None, 3),
+                               expected)
+    out = np.empty_like(points)
+    assert affine_transform(points, mtx, out) is out
+    np_test.assert_array_equal(out, expected)
+    affine_transform(points, mtx, points)
+    np_test.assert_array_equal(points, expected)
+
+    assert_raises(ValueError, affine_transform, points, mtx,
+                  np.empty((n - 1, 2)))
+    assert_raises(ValueError, affine_transform, points, mtx,
+                  np.empty((n, 2), np.float32))
+
+
 def test_clipping_of_log():
     # issue 804
     M,L,C = Path.MOVETO, Path.LINETO, Path.CLOSEPOLY
@@ -476,6 +510,32 @@ def test_bbox_intersection():
     assert_bbox_eq(inter(r1, r5), bbox_from_ext(1, 1, 1, 1))
 
 
+def test_bbox_index():
+    np.random.seed(0)
+    # Boxes on a coarse grid, so that many of them touch, some flipped
+    # and some with a NaN coordinate
+    extents = np.round(np.random.uniform(0, 20, size=(2000, 4)))
+    extents[:, 2:] = extents[:, :2] + np.random.randint(-3, 4, (2000, 2))
+    extents[::97, 1] = np.nan
+    bboxes = [mtrans.Bbox.from_extents(*e) for e in extents]
+    queries = np.round(np.random.uniform(0, 20, size=(50, 4)))
+    queries[7, 2] = np.nan
+
+    index = mtrans.Bbox.index(bboxes)
+    counts = index.count_overlaps(queries)
+    overlapping = index.overlapping(queries)
+    for query, count, found in zip(queries, counts, overlapping):
+        query = mtrans.Bbox.from_extents(*query)
+        expected = [i for i, bbox in enumerate(bboxes)
+                    if query.count_overlaps([bbox])]
+        assert_equal(count, len(expected))
+        assert_equal(list(found), expected)
+        assert_equal(query.count_overlaps(index), len(expected))
+
+    assert_equal(list(mtrans.Bbox.index([]).count_overlaps(queries)),
+                 [0] * len(queries))
+
+
 if __name__=='__main__':
     import nose
     nose.runmodule(argv=['-s','--with-doctest'], exit=False)
@@ -192,6 +192,37 @@ def test_no_modify():
     assert_array_equal(old_triangles, triangles)
 
 
+def test_edges_neighbors():
+    # Edges and neighbors of a masked triangulation, against the edges of the
+    # unmasked triangles matched up in python.
+    np.random.seed(19680801)
+    x, y = np.random.rand(2, 500)
+    triang = mtri.Triangulation(x, y)
+    triang.set_mask(np.random.rand(len(triang.triangles)) < 0.2)
+    triangles = triang.get_masked_triangles()
+    tri_index = np.nonzero(~triang.mask)[0]
+
+    half_edges = {}
+    for tri, points in zip(tri_index, triangles):
+        for edge in range(3):
+            half_edges[points[edge], points[(edge+1) % 3]] = tri
+    edges = sorted(set((max(edge), min(edge)) for edge in half_edges))
+    assert_array_equal(triang.edges, edges)
+
+    neighbors = -np.ones((len(triang.triangles), 3), dtype=np.int32)
+    for tri, points in zip(tri_index, triangles):
+        for edge in range(3):
+            neighbors[tri, edge] = half_edges.get(
+                (points[(edge+1) % 3], points[edge]), -1)
+    assert_array_equal(triang.neighbors, neighbors)
+
+    # With every triangle masked there are no edges and no neighbors.
+    triang = mtri.Triangulation(x, y)
+    triang.set_mask(np.ones(len(triang.triangles), dtype=bool))
+    assert_equal(triang.edges.shape, (0, 2))
+    assert_array_equal(triang.neighbors, -1)
+
+
 def test_trifinder():
     # Test points within triangles of masked triangulation.
     x, y = np.meshgrid(np.arange(4), np.arange(4))
@@ -285,6 +316,63 @@ def test_trifinder():
     assert_array_equal(tris, [-1, -1, 1, -1])
 
 
+def test_trifinder_many_points():
+    # Many points are searched in a different order, and by any number of
+    # threads, but give the same triangles as a few points at a time.
+    np.random.seed(19680801)
+    x, y = np.random.rand(2, 200)
+    triang = mtri.Triangulation(x, y)
+    trifinder = triang.get_trifinder()
+
+    xs, ys = np.meshgrid(np.linspace(-0.1, 1.1, 300),
+                         np.linspace(-0.1, 1.1, 300))
+    xs[0, 0] = np.nan
+    xs[0, 1:len(x)+1] = x
+    ys[0, 1:len(x)+1] = y
+    expected = np.array([trifinder(xs[i], ys[i]) for i in range(len(xs))])
+    for threads in (1, 3):
+        tris = trifinder._cpp_trifinder.find_many(xs, ys, threads)
+        assert_array_equal(tris, expected)
+    assert_equal(expected[0, 0], -1)
+    assert np.all(expected[0, 1:len(x)+1] >= 0)
+
+
+def test_trifinder_pickle():
+    # A triangulation and its trifinder are unpickled without being built
+    # again, whichever of the two is pickled.
+    from six.moves import cPickle as pickle
+    np.random.seed(19680801)
+    x, y = np.random.rand(2, 500)
+    triang = mtri.Triangulation(x, y)
+    triang.set_mask(np.random.rand(len(triang.triangles)) < 0.1)
+    trifinder = triang.get_trifinder()
+    xs, ys = np.random.rand(2, 2000) * 1.2 - 0.1
+    expected = trifinder(xs, ys)
+
+    triang2 = pickle.loads(pickle.dumps(triang, 2))
+    assert_array_equal(triang2._neighbors, triang.neighbors)
+    assert_array_equal(triang2._edges, triang.edges)
+    trifinder2 = triang2.get_trifinder()
+    assert trifinder2._triangulation is triang2
+    assert_array_equal(trifinder2(xs, ys), expected)
+    assert_equal(trifinder2._get_tree_stats(), trifinder._get_tree_stats())
+
+    trifinder3 = pickle.loads(pickle.dumps(trifinder, 2))
+    assert trifinder3._triangulation.get_trifinder() is trifinder3
+    assert_array_equal(trifinder3(xs, ys), expected)
+
+    # The state must be that of the same triangulation.
+    state = trifinder._cpp_trifinder.get_state()
+    other = mtri.Triangulation(x[:100], y[:100])
+    assert_raises(ValueError, other.get_trifinder()._cpp_trifinder.set_state,
+                  state)
+    nodes = state[4].copy()
+    nodes[-1, 2] = len(nodes) - 1
+    assert_raises(ValueError, trifinder._cpp_trifinder.set_state,
+                  state[:4] + (nodes,))
+    assert_array_equal(trifinder(xs, ys), expected)
+
+
 def test_triinterp():
     # Test points within triangles of masked triangulation.
     x, y = np.meshgrid(np.arange(4), np.arange(4))
@@ -726,6 +814,39 @@ def test_triinterp_transformations():
             assert_array_almost_equal(interpz, interp_z0[interp_key])
 
 
+def test_tricontour_levels():
+    # Contours generated for many levels at once, by any number of threads,
+    # are the same as those generated one level at a time.
+    from matplotlib import _tri
+    np.random.seed(19680801)
+    x, y = np.random.rand(2, 400)
+    triang = mtri.Triangulation(x, y)
+    triang.set_mask(np.random.rand(len(triang.triangles)) < 0.1)
+    z = np.round(np.sin(5.0*x) * np.cos(4.0*y), 1)
+    C = _tri.TriContourGenerator(triang.get_cpp_triangulation(), z)
+    levels = list(np.linspace(-1.1, 1.1, 23)) + [0.3, np.nan]
+
+    expected = [C.create_contour(level) for level in levels]
+    expected_filled = [C.create_filled_contour(lower, upper)
+                       for lower, upper in zip(levels[:-1], levels[1:])]
+    for threads in (1, 3):
+        contours = C.create_contours(levels, threads)
+        assert_equal(len(contours), len(levels))
+        for segs, expected_segs in zip(contours, expected):
+            assert_equal(len(segs), len(expected_segs))
+            for seg, expected_seg in zip(segs, expected_segs):
+                assert_array_equal(seg, expected_seg)
+
+        filled = C.create_filled_contours(levels[:-1], levels[1:], threads)
+        assert_equal(len(filled), len(levels) - 1)
+        for (segs, kinds), (expected_segs, expected_kinds) in zip(
+                filled, expected_filled):
+            assert_array_equal(segs, expected_segs)
+            assert_array_equal(kinds, expected_kinds)
+
+    assert_raises(ValueError, C.create_filled_contours, [0.0], [0.5, 1.0])
+
+
 @image_comparison(baseline_images=['tri_smooth_contouring'],
                   extensions=['png'], remove_text=True)
 def test_tri_smooth_contouring():
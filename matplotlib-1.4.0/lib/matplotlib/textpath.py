@@ -449,6 +449,7 @@ class TextPath(Path):
 
         self._should_simplify = False
         self._simplify_threshold = rcParams['path.simplify_threshold']
+        self._should_decimate = False
         self._has_nonfinite = False
         self._interpolation_steps = _interpolation_steps
 
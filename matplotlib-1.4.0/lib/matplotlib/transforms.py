@@ -37,7 +37,7 @@ import six
 import numpy as np
 from numpy import ma
 from matplotlib._path import (affine_transform, count_bboxes_overlapping_bbox,
-    update_path_extents)
+    bbox_index, update_path_extents)
 from numpy.linalg import inv
 
 from weakref import WeakValueDictionary
@@ -659,7 +659,8 @@ class BboxBase(TransformNode):
         """
         Count the number of bounding boxes that overlap this one.
 
-        bboxes is a sequence of :class:`BboxBase` objects
+        bboxes is a sequence of :class:`BboxBase` objects, or an index
+        of them made by :meth:`index`
         """
         return count_bboxes_overlapping_bbox(self, bboxes)
 
@@ -739,6 +740,30 @@ class BboxBase(TransformNode):
 
         return Bbox.from_extents(x0, y0, x1, y1)
 
+    @staticmethod
+    def index(bboxes):
+        """
+        Return an index of the given bboxes for fast overlap queries.
+
+        *bboxes* is a sequence of :class:`BboxBase` objects, or an Nx4
+        array of their (*x0*, *y0*, *x1*, *y1*) extents.  The returned
+        object has the methods:
+
+          - *count_overlaps(extents)*: for each row of the Mx4 array
+            *extents*, the number of the bboxes that overlap it, as
+            counted by :meth:`count_overlaps`
+
+          - *overlapping(extents)*: for each row of *extents*, an
+            array of the indices of the bboxes that overlap it
+
+        It can also be passed to :meth:`count_overlaps` in place of
+        the bboxes themselves.  Later changes to the bboxes are not
+        reflected.
+        """
+        if not isinstance(bboxes, np.ndarray):
+            bboxes = [bbox.extents for bbox in bboxes]
+        return bbox_index(bboxes)
+
     @staticmethod
     def intersection(bbox1, bbox2):
         """
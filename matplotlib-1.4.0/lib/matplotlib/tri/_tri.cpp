@@ -7,9 +7,13 @@
  */
 #include "_tri.h"
 #include "src/mplutils.h"
+#include "src/MPL_isnan.h"
+#include "src/mplthreads.h"
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
+#include <new>
 #include <set>
 
 #define MOVETO 1
@@ -307,33 +311,221 @@ void Triangulation::calculate_boundaries()
     }
 }
 
-void Triangulation::calculate_edges()
+// The fewest triangles worth handing to a thread of their own when
+// sorting out their edges.
+#define MIN_TRIANGLES_PER_THREAD (1 << 15)
+
+namespace
 {
-    _VERBOSE("Triangulation::calculate_edges");
-    Py_XDECREF(_edges);
+    // Orders half-edges (3*tri + edge) by the smaller point index of the
+    // edge, then by half-edge index.
+    struct HalfEdgeLess
+    {
+        HalfEdgeLess(const int* triangles_) : triangles(triangles_) {}
+
+        int min_point(int half_edge) const
+        {
+            int start = triangles[half_edge];
+            int end = triangles[half_edge - half_edge%3 + (half_edge+1)%3];
+            return std::min(start, end);
+        }
+
+        bool operator()(int a, int b) const
+        {
+            int min_a = min_point(a), min_b = min_point(b);
+            return min_a != min_b ? min_a < min_b : a < b;
+        }
+
+        const int* triangles;
+    };
+
+    // Sorts each bucket of half-edges with HalfEdgeLess, and counts the
+    // distinct edges in it.
+    struct SortHalfEdges
+    {
+        SortHalfEdges(const int* triangles_, const std::vector<int>& offsets_,
+                      std::vector<int>& half_edges_, std::vector<int>& counts_)
+            : less(triangles_), offsets(offsets_), half_edges(half_edges_),
+              counts(counts_)
+        {}
+
+        void operator()(int start, int end)
+        {
+            // With every triangle masked there is nothing to sort, and no
+            // element to take the address of.
+            if (half_edges.empty())
+                return;
+            for (int bucket = start; bucket < end; ++bucket) {
+                int* first = &half_edges[0] + offsets[bucket];
+                int* last = &half_edges[0] + offsets[bucket+1];
+                std::sort(first, last, less);
+                int count = 0;
+                for (int* it = first; it != last; ++it) {
+                    if (it == first ||
+                        less.min_point(*it) != less.min_point(*(it-1)))
+                        ++count;
+                }
+                counts[bucket] = count;
+            }
+        }
 
-    // Create set of all edges, storing them with start point index less than
-    // end point index.
-    typedef std::set<Edge> EdgeSet;
-    EdgeSet edge_set;
+        HalfEdgeLess less;
+        const std::vector<int>& offsets;
+        std::vector<int>& half_edges;
+        std::vector<int>& counts;
+    };
+
+    // Writes the distinct edges of each bucket, as (bucket, min point)
+    // pairs, starting at index counts[bucket] of the edges array.
+    struct WriteEdges
+    {
+        WriteEdges(const int* triangles_, const std::vector<int>& offsets_,
+                   const std::vector<int>& half_edges_,
+                   const std::vector<int>& counts_, int* edges_)
+            : less(triangles_), offsets(offsets_), half_edges(half_edges_),
+              counts(counts_), edges(edges_)
+        {}
+
+        void operator()(int start, int end)
+        {
+            for (int bucket = start; bucket < end; ++bucket) {
+                int* edge = edges + 2*counts[bucket];
+                for (int i = offsets[bucket]; i < offsets[bucket+1]; ++i) {
+                    if (i == offsets[bucket] ||
+                        less.min_point(half_edges[i]) !=
+                            less.min_point(half_edges[i-1])) {
+                        *edge++ = bucket;
+                        *edge++ = less.min_point(half_edges[i]);
+                    }
+                }
+            }
+        }
+
+        HalfEdgeLess less;
+        const std::vector<int>& offsets;
+        const std::vector<int>& half_edges;
+        const std::vector<int>& counts;
+        int* edges;
+    };
+
+    // Pairs up the half-edges of each edge as neighbors.  The half-edges of
+    // an edge are taken in index order, and each one is paired with the
+    // latest still unpaired one running the other way, the same as
+    // matching them through a map from edge to half-edge would.  In a
+    // valid triangulation an edge has at most one half-edge each way.
+    struct PairHalfEdges
+    {
+        PairHalfEdges(const int* triangles_, const std::vector<int>& offsets_,
+                      const std::vector<int>& half_edges_, int* neighbors_)
+            : less(triangles_), offsets(offsets_), half_edges(half_edges_),
+              neighbors(neighbors_)
+        {}
+
+        void operator()(int start, int end)
+        {
+            for (int bucket = start; bucket < end; ++bucket) {
+                int group = offsets[bucket];
+                while (group < offsets[bucket+1]) {
+                    int min_point = less.min_point(half_edges[group]);
+                    int pending[2] = {-1, -1};  // Unpaired, by direction.
+                    int i = group;
+                    for (; i < offsets[bucket+1] &&
+                           less.min_point(half_edges[i]) == min_point; ++i) {
+                        int half_edge = half_edges[i];
+                        // Direction 0 runs from the larger point to the
+                        // smaller one; an edge from a point to itself is
+                        // its own reverse.
+                        int dir = (less.triangles[half_edge] == bucket ? 0 : 1);
+                        int other = (bucket == min_point ? dir : 1 - dir);
+                        if (pending[other] != -1) {
+                            neighbors[half_edge] = pending[other] / 3;
+                            neighbors[pending[other]] = half_edge / 3;
+                            pending[other] = -1;
+                        }
+                        else
+                            pending[dir] = half_edge;
+                    }
+                    group = i;
+                }
+            }
+        }
+
+        HalfEdgeLess less;
+        const std::vector<int>& offsets;
+        const std::vector<int>& half_edges;
+        int* neighbors;
+    };
+}
+
+void Triangulation::sort_half_edges(std::vector<int>& offsets,
+                                    std::vector<int>& half_edges,
+                                    std::vector<int>& counts,
+                                    int& threads) const
+{
+    // Counting sort of the half-edges of the unmasked triangles by the
+    // larger point index of their edge, keeping them in index order.
+    const int* triangles = get_triangles_ptr();
+    int npoints = 0;
+    for (int i = 0; i < 3*_ntri; ++i)
+        npoints = std::max(npoints, triangles[i] + 1);
+
+    offsets.assign(npoints+1, 0);
     for (int tri = 0; tri < _ntri; ++tri) {
         if (!is_masked(tri)) {
-            for (int edge = 0; edge < 3; edge++) {
-                int start = get_triangle_point(tri, edge);
-                int end   = get_triangle_point(tri, (edge+1)%3);
-                edge_set.insert(start > end ? Edge(start,end) : Edge(end,start));
+            for (int edge = 0; edge < 3; ++edge) {
+                int start = triangles[3*tri + edge];
+                int end = triangles[3*tri + (edge+1)%3];
+                ++offsets[std::max(start, end) + 1];
             }
         }
     }
+    for (int point = 0; point < npoints; ++point)
+        offsets[point+1] += offsets[point];
+
+    half_edges.resize(offsets[npoints]);
+    std::vector<int> next(offsets.begin(), offsets.end() - 1);
+    for (int tri = 0; tri < _ntri; ++tri) {
+        if (!is_masked(tri)) {
+            for (int edge = 0; edge < 3; ++edge) {
+                int start = triangles[3*tri + edge];
+                int end = triangles[3*tri + (edge+1)%3];
+                half_edges[next[std::max(start, end)]++] = 3*tri + edge;
+            }
+        }
+    }
+
+    // Then each bucket is sorted by the smaller point index.
+    threads = std::min(mpl::resolve_num_threads(0),
+                       _ntri / MIN_TRIANGLES_PER_THREAD);
+    counts.assign(npoints, 0);
+    SortHalfEdges task(triangles, offsets, half_edges, counts);
+    mpl::parallel_for(0, npoints, threads, task);
+}
+
+void Triangulation::calculate_edges()
+{
+    _VERBOSE("Triangulation::calculate_edges");
+    Py_XDECREF(_edges);
+
+    // The distinct edges, as (larger point index, smaller point index)
+    // pairs in increasing order, come from the sorted half-edges.
+    std::vector<int> offsets, half_edges, counts;
+    int threads;
+    sort_half_edges(offsets, half_edges, counts, threads);
+
+    int nedges = 0;
+    for (size_t point = 0; point < counts.size(); ++point) {
+        int count = counts[point];
+        counts[point] = nedges;
+        nedges += count;
+    }
 
     // Convert to python _edges array.
-    npy_intp dims[2] = {static_cast<npy_intp>(edge_set.size()), 2};
+    npy_intp dims[2] = {static_cast<npy_intp>(nedges), 2};
     _edges = (PyArrayObject*)PyArray_SimpleNew(2, dims, PyArray_INT);
-    int* edges_ptr = (int*)PyArray_DATA(_edges);
-    for (EdgeSet::const_iterator it = edge_set.begin(); it != edge_set.end(); ++it) {
-        *edges_ptr++ = it->start;
-        *edges_ptr++ = it->end;
-    }
+    WriteEdges task(get_triangles_ptr(), offsets, half_edges, counts,
+                    (int*)PyArray_DATA(_edges));
+    mpl::parallel_for(0, (int)counts.size(), threads, task);
 }
 
 void Triangulation::calculate_neighbors()
@@ -348,36 +540,18 @@ void Triangulation::calculate_neighbors()
     std::fill(neighbors_ptr, neighbors_ptr + 3*_ntri, -1);
 
     // For each triangle edge (start to end point), find corresponding neighbor
-    // edge from end to start point.  Do this by traversing all edges and
-    // storing them in a map from edge to TriEdge.  If corresponding neighbor
-    // edge is already in the map, don't need to store new edge as neighbor
-    // already found.
-    typedef std::map<Edge, TriEdge> EdgeToTriEdgeMap;
-    EdgeToTriEdgeMap edge_to_tri_edge_map;
-    for (int tri = 0; tri < _ntri; ++tri) {
-        if (!is_masked(tri)) {
-            for (int edge = 0; edge < 3; ++edge) {
-                int start = get_triangle_point(tri, edge);
-                int end   = get_triangle_point(tri, (edge+1)%3);
-                EdgeToTriEdgeMap::iterator it =
-                    edge_to_tri_edge_map.find(Edge(end,start));
-                if (it == edge_to_tri_edge_map.end()) {
-                    // No neighbor edge exists in the edge_to_tri_edge_map, so
-                    // add this edge to it.
-                    edge_to_tri_edge_map[Edge(start,end)] = TriEdge(tri,edge);
-                } else {
-                    // Neighbor edge found, set the two elements of _neighbors
-                    // and remove edge from edge_to_tri_edge_map.
-                    neighbors_ptr[3*tri + edge] = it->second.tri;
-                    neighbors_ptr[3*it->second.tri + it->second.edge] = tri;
-                    edge_to_tri_edge_map.erase(it);
-                }
-            }
-        }
-    }
+    // edge from end to start point.  Sorting the half-edges by their edge
+    // brings the ones that may be neighbors together.
+    std::vector<int> offsets, half_edges, counts;
+    int threads;
+    sort_half_edges(offsets, half_edges, counts, threads);
+
+    PairHalfEdges task(get_triangles_ptr(), offsets, half_edges,
+                       neighbors_ptr);
+    mpl::parallel_for(0, (int)offsets.size() - 1, threads, task);
 
-    // Note that remaining edges in the edge_to_tri_edge_map correspond to
-    // boundary edges, but the boundaries are calculated separately elsewhere.
+    // Note that half-edges left unpaired correspond to boundary edges, but
+    // the boundaries are calculated separately elsewhere.
 }
 
 Py::Object Triangulation::calculate_plane_coefficients(const Py::Tuple &args)
@@ -662,10 +836,7 @@ void Triangulation::write_boundaries() const
 TriContourGenerator::TriContourGenerator(Py::Object triangulation,
                                          PyArrayObject* z)
     : _triangulation(triangulation),
-      _z(z),
-      _interior_visited(2*get_triangulation().get_ntri()),
-      _boundaries_visited(0),
-      _boundaries_used(0)
+      _z(z)
 {
     _VERBOSE("TriContourGenerator::TriContourGenerator");
 }
@@ -676,32 +847,36 @@ TriContourGenerator::~TriContourGenerator()
     Py_XDECREF(_z);
 }
 
-void TriContourGenerator::clear_visited_flags(bool include_boundaries)
+TriContourGenerator::Visited::Visited(int ntri, const Boundaries& boundaries)
+    : interior(2*ntri),
+      boundaries_used(boundaries.size())
 {
-    // Clear _interiorVisited.
-    std::fill(_interior_visited.begin(), _interior_visited.end(), false);
-
-    if (include_boundaries) {
-        if (_boundaries_visited.empty()) {
-            const Boundaries& boundaries = get_boundaries();
-
-            // Initialise _boundaries_visited.
-            _boundaries_visited.reserve(boundaries.size());
-            for (Boundaries::const_iterator it = boundaries.begin();
-                    it != boundaries.end(); ++it)
-                _boundaries_visited.push_back(BoundaryVisited(it->size()));
+    this->boundaries.reserve(boundaries.size());
+    for (Boundaries::const_iterator it = boundaries.begin();
+            it != boundaries.end(); ++it)
+        this->boundaries.push_back(BoundaryVisited(it->size()));
+}
 
-            // Initialise _boundaries_used.
-            _boundaries_used = BoundariesUsed(boundaries.size());
-        }
+void TriContourGenerator::clear_visited_flags(Visited& visited,
+                                              const TriRange& tris,
+                                              bool include_boundaries) const
+{
+    // Clear the interior flags of the triangles that can have been visited.
+    int ntri = get_triangulation().get_ntri();
+    for (const int* tri = tris.begin; tri != tris.end; ++tri) {
+        visited.interior[*tri] = false;
+        visited.interior[*tri + ntri] = false;
+    }
 
-        // Clear _boundaries_visited.
-        for (BoundariesVisited::iterator it = _boundaries_visited.begin();
-                it != _boundaries_visited.end(); ++it)
+    if (include_boundaries) {
+        // Clear boundaries visited.
+        for (BoundariesVisited::iterator it = visited.boundaries.begin();
+                it != visited.boundaries.end(); ++it)
             std::fill(it->begin(), it->end(), false);
 
-        // Clear _boundaries_used.
-        std::fill(_boundaries_used.begin(), _boundaries_used.end(), false);
+        // Clear boundaries used.
+        std::fill(visited.boundaries_used.begin(),
+                  visited.boundaries_used.end(), false);
     }
 }
 
@@ -764,15 +939,35 @@ Py::Object TriContourGenerator::create_contour(const Py::Tuple &args)
     _VERBOSE("TriContourGenerator::create_contour");
     args.verify_length(1);
 
-    double level = (Py::Float)args[0];
+    std::vector<double> levels(1, (Py::Float)args[0]);
+    std::vector<Contour> contours;
+    generate_contours(levels, levels, false, 1, contours);
 
-    clear_visited_flags(false);
-    Contour contour;
+    return contour_to_segs(contours[0]);
+}
+
+Py::Object TriContourGenerator::create_contours(const Py::Tuple &args)
+{
+    _VERBOSE("TriContourGenerator::create_contours");
+    args.verify_length(1, 2);
+
+    Py::SeqBase<Py::Object> levels_obj = args[0];
+    std::vector<double> levels;
+    levels.reserve(levels_obj.length());
+    for (Py::SeqBase<Py::Object>::size_type i = 0; i < levels_obj.length(); ++i)
+        levels.push_back(Py::Float(levels_obj[i]));
 
-    find_boundary_lines(contour, level);
-    find_interior_lines(contour, level, false, false);
+    int threads = (args.size() > 1 ? (int)Py::Int(args[1]) : 0);
+    if (threads < 0)
+        throw Py::ValueError("threads must be non-negative");
 
-    return contour_to_segs(contour);
+    std::vector<Contour> contours;
+    generate_contours(levels, levels, false, threads, contours);
+
+    Py::List result(contours.size());
+    for (std::vector<Contour>::size_type i = 0; i < contours.size(); ++i)
+        result[i] = contour_to_segs(contours[i]);
+    return result;
 }
 
 Py::Object TriContourGenerator::create_filled_contour(const Py::Tuple &args)
@@ -780,17 +975,44 @@ Py::Object TriContourGenerator::create_filled_contour(const Py::Tuple &args)
     _VERBOSE("TriContourGenerator::create_filled_contour");
     args.verify_length(2);
 
-    double lower_level = (Py::Float)args[0];
-    double upper_level = (Py::Float)args[1];
+    std::vector<double> lower_levels(1, (Py::Float)args[0]);
+    std::vector<double> upper_levels(1, (Py::Float)args[1]);
+    std::vector<Contour> contours;
+    generate_contours(lower_levels, upper_levels, true, 1, contours);
+
+    return contour_to_segs_and_kinds(contours[0]);
+}
 
-    clear_visited_flags(true);
-    Contour contour;
+Py::Object TriContourGenerator::create_filled_contours(const Py::Tuple &args)
+{
+    _VERBOSE("TriContourGenerator::create_filled_contours");
+    args.verify_length(2, 3);
 
-    find_boundary_lines_filled(contour, lower_level, upper_level);
-    find_interior_lines(contour, lower_level, false, true);
-    find_interior_lines(contour, upper_level, true,  true);
+    Py::SeqBase<Py::Object> lower_obj = args[0];
+    Py::SeqBase<Py::Object> upper_obj = args[1];
+    if (lower_obj.length() != upper_obj.length())
+        throw Py::ValueError(
+            "lower_levels and upper_levels must have the same length");
+
+    std::vector<double> lower_levels, upper_levels;
+    lower_levels.reserve(lower_obj.length());
+    upper_levels.reserve(upper_obj.length());
+    for (Py::SeqBase<Py::Object>::size_type i = 0; i < lower_obj.length(); ++i) {
+        lower_levels.push_back(Py::Float(lower_obj[i]));
+        upper_levels.push_back(Py::Float(upper_obj[i]));
+    }
 
-    return contour_to_segs_and_kinds(contour);
+    int threads = (args.size() > 2 ? (int)Py::Int(args[2]) : 0);
+    if (threads < 0)
+        throw Py::ValueError("threads must be non-negative");
+
+    std::vector<Contour> contours;
+    generate_contours(lower_levels, upper_levels, true, threads, contours);
+
+    Py::List result(contours.size());
+    for (std::vector<Contour>::size_type i = 0; i < contours.size(); ++i)
+        result[i] = contour_to_segs_and_kinds(contours[i]);
+    return result;
 }
 
 XY TriContourGenerator::edge_interp(int tri, int edge, const double& level)
@@ -801,6 +1023,7 @@ XY TriContourGenerator::edge_interp(int tri, int edge, const double& level)
 }
 
 void TriContourGenerator::find_boundary_lines(Contour& contour,
+                                              Visited& visited,
                                               const double& level)
 {
     // Traverse boundaries to find starting points for all contour lines that
@@ -826,13 +1049,15 @@ void TriContourGenerator::find_boundary_lines(Contour& contour,
                 contour.push_back(ContourLine());
                 ContourLine& contour_line = contour.back();
                 TriEdge tri_edge = *itb;
-                follow_interior(contour_line, tri_edge, true, level, false);
+                follow_interior(contour_line, visited, tri_edge, true, level,
+                                false);
             }
         }
     }
 }
 
 void TriContourGenerator::find_boundary_lines_filled(Contour& contour,
+                                                     Visited& visited,
                                                      const double& lower_level,
                                                      const double& upper_level)
 {
@@ -844,7 +1069,7 @@ void TriContourGenerator::find_boundary_lines_filled(Contour& contour,
     for (Boundaries::size_type i = 0; i < boundaries.size(); ++i) {
         const Boundary& boundary = boundaries[i];
         for (Boundary::size_type j = 0; j < boundary.size(); ++j) {
-            if (!_boundaries_visited[i][j]) {
+            if (!visited.boundaries[i][j]) {
                 // z values of start and end of this boundary edge.
                 double z_start = get_z(triang.get_triangle_point(boundary[j]));
                 double z_end = get_z(triang.get_triangle_point(
@@ -865,10 +1090,11 @@ void TriContourGenerator::find_boundary_lines_filled(Contour& contour,
                     // Traverse interior and boundaries until return to start.
                     bool on_upper = incr_upper;
                     do {
-                        follow_interior(contour_line, tri_edge, true,
+                        follow_interior(contour_line, visited, tri_edge, true,
                             on_upper ? upper_level : lower_level, on_upper);
-                        on_upper = follow_boundary(contour_line, tri_edge,
-                                       lower_level, upper_level, on_upper);
+                        on_upper = follow_boundary(contour_line, visited,
+                                       tri_edge, lower_level, upper_level,
+                                       on_upper);
                     } while (tri_edge != start_tri_edge);
 
                     // Filled contour lines must not have same first and last
@@ -883,9 +1109,9 @@ void TriContourGenerator::find_boundary_lines_filled(Contour& contour,
 
     // Add full boundaries that lie between the lower and upper levels.  These
     // are boundaries that have not been touched by an internal contour line
-    // which are stored in _boundaries_used.
+    // which are stored in visited.boundaries_used.
     for (Boundaries::size_type i = 0; i < boundaries.size(); ++i) {
-        if (!_boundaries_used[i]) {
+        if (!visited.boundaries_used[i]) {
             const Boundary& boundary = boundaries[i];
             double z = get_z(triang.get_triangle_point(boundary[0]));
             if (z >= lower_level && z < upper_level) {
@@ -900,19 +1126,24 @@ void TriContourGenerator::find_boundary_lines_filled(Contour& contour,
 }
 
 void TriContourGenerator::find_interior_lines(Contour& contour,
+                                              Visited& visited,
                                               const double& level,
                                               bool on_upper,
-                                              bool filled)
+                                              bool filled,
+                                              const TriRange& tris)
 {
+    // Only the unmasked triangles that the level passes through need to be
+    // considered, in increasing index order.
     const Triangulation& triang = get_triangulation();
     int ntri = triang.get_ntri();
-    for (int tri = 0; tri < ntri; ++tri) {
+    for (const int* it = tris.begin; it != tris.end; ++it) {
+        int tri = *it;
         int visited_index = (on_upper ? tri+ntri : tri);
 
-        if (_interior_visited[visited_index] || triang.is_masked(tri))
-            continue;  // Triangle has already been visited or is masked.
+        if (visited.interior[visited_index])
+            continue;  // Triangle has already been visited.
 
-        _interior_visited[visited_index] = true;
+        visited.interior[visited_index] = true;
 
         // Determine edge via which to leave this triangle.
         int edge = get_exit_edge(tri, level, on_upper);
@@ -924,7 +1155,8 @@ void TriContourGenerator::find_interior_lines(Contour& contour,
         contour.push_back(ContourLine());
         ContourLine& contour_line = contour.back();
         TriEdge tri_edge = triang.get_neighbor_edge(tri, edge);
-        follow_interior(contour_line, tri_edge, false, level, on_upper);
+        follow_interior(contour_line, visited, tri_edge, false, level,
+                        on_upper);
 
         if (!filled)
             // Non-filled contour lines must be closed.
@@ -937,6 +1169,7 @@ void TriContourGenerator::find_interior_lines(Contour& contour,
 }
 
 bool TriContourGenerator::follow_boundary(ContourLine& contour_line,
+                                          Visited& visited,
                                           TriEdge& tri_edge,
                                           const double& lower_level,
                                           const double& upper_level,
@@ -948,15 +1181,15 @@ bool TriContourGenerator::follow_boundary(ContourLine& contour_line,
     // Have TriEdge to start at, need equivalent boundary edge.
     int boundary, edge;
     triang.get_boundary_edge(tri_edge, boundary, edge);
-    _boundaries_used[boundary] = true;
+    visited.boundaries_used[boundary] = true;
 
     bool stop = false;
     bool first_edge = true;
     double z_start, z_end = 0;
     while (!stop)
     {
-        assert(!_boundaries_visited[boundary][edge] && "Boundary already visited");
-        _boundaries_visited[boundary][edge] = true;
+        assert(!visited.boundaries[boundary][edge] && "Boundary already visited");
+        visited.boundaries[boundary][edge] = true;
 
         // z values of start and end points of boundary edge.
         if (first_edge)
@@ -1001,6 +1234,7 @@ bool TriContourGenerator::follow_boundary(ContourLine& contour_line,
 }
 
 void TriContourGenerator::follow_interior(ContourLine& contour_line,
+                                          Visited& visited,
                                           TriEdge& tri_edge,
                                           bool end_on_boundary,
                                           const double& level,
@@ -1018,14 +1252,14 @@ void TriContourGenerator::follow_interior(ContourLine& contour_line,
             visited_index += get_triangulation().get_ntri();
 
         // Check for end not on boundary.
-        if (!end_on_boundary && _interior_visited[visited_index])
+        if (!end_on_boundary && visited.interior[visited_index])
             break;  // Reached start point, so return.
 
         // Determine edge by which to leave this triangle.
         edge = get_exit_edge(tri, level, on_upper);
         assert(edge >= 0 && edge < 3 && "Invalid exit edge");
 
-        _interior_visited[visited_index] = true;
+        visited.interior[visited_index] = true;
 
         // Append new point to point set.
         assert(edge >= 0 && edge < 3 && "Invalid triangle edge");
@@ -1043,6 +1277,164 @@ void TriContourGenerator::follow_interior(ContourLine& contour_line,
     }
 }
 
+void TriContourGenerator::generate_contour(Contour& contour,
+                                           Visited& visited,
+                                           const double& lower_level,
+                                           const double& upper_level,
+                                           const TriRange& lower_tris,
+                                           const TriRange& upper_tris,
+                                           bool filled)
+{
+    if (filled) {
+        find_boundary_lines_filled(contour, visited, lower_level, upper_level);
+        find_interior_lines(contour, visited, lower_level, false, true,
+                            lower_tris);
+        find_interior_lines(contour, visited, upper_level, true, true,
+                            upper_tris);
+        clear_visited_flags(visited, upper_tris, true);
+    }
+    else {
+        find_boundary_lines(contour, visited, lower_level);
+        find_interior_lines(contour, visited, lower_level, false, false,
+                            lower_tris);
+    }
+    clear_visited_flags(visited, lower_tris, false);
+}
+
+// The fewest triangle crossings, summed over the contour levels, worth
+// handing to a thread of their own.
+#define MIN_CONTOUR_TRIANGLES_PER_THREAD (1 << 14)
+
+struct TriContourGenerator::GenerateContours
+{
+    GenerateContours(TriContourGenerator& generator_,
+                     const std::vector<double>& lower_levels_,
+                     const std::vector<double>& upper_levels_,
+                     const std::vector<TriRange>& lower_tris_,
+                     const std::vector<TriRange>& upper_tris_,
+                     bool filled_,
+                     std::vector<Contour>& contours_,
+                     std::vector<char>& failed_)
+        : generator(generator_), lower_levels(lower_levels_),
+          upper_levels(upper_levels_), lower_tris(lower_tris_),
+          upper_tris(upper_tris_), filled(filled_), contours(contours_),
+          failed(failed_)
+    {}
+
+    void operator()(int start, int end)
+    {
+        try {
+            Visited visited(generator.get_triangulation().get_ntri(),
+                            generator.get_boundaries());
+            for (int i = start; i < end; ++i)
+                generator.generate_contour(contours[i], visited,
+                                           lower_levels[i], upper_levels[i],
+                                           lower_tris[i], upper_tris[i],
+                                           filled);
+        }
+        catch (std::bad_alloc&) {
+            failed[start] = true;
+        }
+    }
+
+    TriContourGenerator& generator;
+    const std::vector<double>& lower_levels;
+    const std::vector<double>& upper_levels;
+    const std::vector<TriRange>& lower_tris;
+    const std::vector<TriRange>& upper_tris;
+    bool filled;
+    std::vector<Contour>& contours;
+    std::vector<char>& failed;
+};
+
+void TriContourGenerator::generate_contours(
+    const std::vector<double>& lower_levels,
+    const std::vector<double>& upper_levels,
+    bool filled,
+    int threads,
+    std::vector<Contour>& contours)
+{
+    const Triangulation& triang = get_triangulation();
+    int ntri = triang.get_ntri();
+    int ncontours = (int)lower_levels.size();
+
+    // Ensure the boundaries and neighbors have been created before any
+    // threads use them.
+    get_boundaries();
+
+    // Distinct levels in increasing order.  NaN levels never pass through a
+    // triangle.
+    std::vector<double> levels;
+    for (int i = 0; i < ncontours; ++i) {
+        if (lower_levels[i] == lower_levels[i])
+            levels.push_back(lower_levels[i]);
+        if (filled && upper_levels[i] == upper_levels[i])
+            levels.push_back(upper_levels[i]);
+    }
+    std::sort(levels.begin(), levels.end());
+    levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+
+    // Counting sort of the unmasked triangles by the levels that pass through
+    // them, keeping each level's triangles in index order.  The triangles
+    // that any level passes through are found in a single pass, and kept as
+    // (tri, first, last) triples for the second.
+    int nlevels = (int)levels.size();
+    std::vector<int> offsets(nlevels+1, 0);
+    std::vector<int> ranges;
+    int first, last;
+    for (int tri = 0; tri < ntri; ++tri) {
+        if (!triang.is_masked(tri)) {
+            get_level_range(tri, levels, first, last);
+            if (first < last) {
+                ranges.push_back(tri);
+                ranges.push_back(first);
+                ranges.push_back(last);
+                for (int level = first; level < last; ++level)
+                    ++offsets[level+1];
+            }
+        }
+    }
+    for (int level = 0; level < nlevels; ++level)
+        offsets[level+1] += offsets[level];
+
+    std::vector<int> tris(offsets[nlevels]);
+    std::vector<int> next(offsets.begin(), offsets.end() - 1);
+    for (std::vector<int>::size_type i = 0; i < ranges.size(); i += 3) {
+        for (int level = ranges[i+1]; level < ranges[i+2]; ++level)
+            tris[next[level]++] = ranges[i];
+    }
+
+    // Triangles that each contour's level(s) pass through.
+    const int* tris_ptr = (tris.empty() ? 0 : &tris[0]);
+    std::vector<TriRange> lower_tris(ncontours), upper_tris(ncontours);
+    long crossings = 0;
+    for (int i = 0; i < ncontours; ++i) {
+        for (int upper = 0; upper < (filled ? 2 : 1); ++upper) {
+            const double& value = (upper ? upper_levels : lower_levels)[i];
+            if (value != value)
+                continue;
+            int level = (int)(std::lower_bound(levels.begin(), levels.end(),
+                                               value) - levels.begin());
+            TriRange range(tris_ptr + offsets[level],
+                           tris_ptr + offsets[level+1]);
+            (upper ? upper_tris : lower_tris)[i] = range;
+            crossings += range.end - range.begin;
+        }
+    }
+
+    threads = (int)std::min((long)mpl::resolve_num_threads(threads),
+                            crossings / MIN_CONTOUR_TRIANGLES_PER_THREAD);
+
+    contours.assign(ncontours, Contour());
+    std::vector<char> failed(ncontours, false);
+    GenerateContours task(*this, lower_levels, upper_levels, lower_tris,
+                          upper_tris, filled, contours, failed);
+    mpl::parallel_for(0, ncontours, threads, task);
+
+    if (std::find(failed.begin(), failed.end(), true) != failed.end())
+        throw Py::MemoryError("Could not allocate memory for contours");
+}
+
 const TriContourGenerator::Boundaries& TriContourGenerator::get_boundaries() const
 {
     return get_triangulation().get_boundaries();
@@ -1087,6 +1479,37 @@ const double& TriContourGenerator::get_z(int point) const
     return ((const double*)PyArray_DATA(_z))[point];
 }
 
+void TriContourGenerator::get_level_range(int tri,
+                                          const std::vector<double>& levels,
+                                          int& first,
+                                          int& last) const
+{
+    // A level passes through the triangle if at least one of its points is
+    // above (or the same as) the level and at least one is not, a NaN z-value
+    // never being above.
+    const Triangulation& triang = get_triangulation();
+    double zmin = std::numeric_limits<double>::infinity();
+    double zmax = -std::numeric_limits<double>::infinity();
+    bool below_all = false;
+    for (int i = 0; i < 3; ++i) {
+        double z = get_z(triang.get_triangle_point(tri, i));
+        if (z != z)
+            below_all = true;
+        else {
+            zmin = std::min(zmin, z);
+            zmax = std::max(zmax, z);
+        }
+    }
+
+    // So the levels in (zmin, zmax], or up to zmax if there is a NaN.
+    first = (below_all ? 0 : (int)(std::upper_bound(levels.begin(),
+                                                    levels.end(), zmin) -
+                                   levels.begin()));
+    last = (int)(std::upper_bound(levels.begin(), levels.end(), zmax) -
+                 levels.begin());
+    last = std::max(first, last);
+}
+
 void TriContourGenerator::init_type()
 {
     _VERBOSE("TriContourGenerator::init_type");
@@ -1100,6 +1523,12 @@ void TriContourGenerator::init_type()
     add_varargs_method("create_filled_contour",
                        &TriContourGenerator::create_filled_contour,
                        "create_filled_contour(lower_level, upper_level)");
+    add_varargs_method("create_contours",
+                       &TriContourGenerator::create_contours,
+                       "create_contours(levels, threads=0)");
+    add_varargs_method("create_filled_contours",
+                       &TriContourGenerator::create_filled_contours,
+                       "create_filled_contours(lower_levels, upper_levels, threads=0)");
 }
 
 XY TriContourGenerator::interp(int point1,
@@ -1360,12 +1789,107 @@ TrapezoidMapTriFinder::clear()
     _tree = 0;
 }
 
+// The fewest points worth handing to a thread of their own, and worth putting
+// into an order that keeps nearby points together.
+#define MIN_TRIFINDER_POINTS_PER_THREAD (1 << 14)
+#define MIN_TRIFINDER_POINTS_TO_SORT (1 << 16)
+
+// Points are sorted into cells of a 2^TRIFINDER_CELL_BITS square grid over
+// their bounding box, with the cells in Z-order.
+#define TRIFINDER_CELL_BITS 8
+
+namespace
+{
+    // Spread the lowest TRIFINDER_CELL_BITS bits of i over the even bits of
+    // the result.
+    inline unsigned int spread_bits(unsigned int i)
+    {
+        unsigned int result = 0;
+        for (int bit = 0; bit < TRIFINDER_CELL_BITS; ++bit)
+            result |= ((i >> bit) & 1u) << (2*bit);
+        return result;
+    }
+
+    // Z-order index of the grid cell that a point lies in.
+    struct CellIndex
+    {
+        CellIndex(const double* x, const double* y, npy_intp n)
+        {
+            xmin = ymin = std::numeric_limits<double>::infinity();
+            double xmax = -xmin, ymax = -ymin;
+            for (npy_intp i = 0; i < n; ++i) {
+                if (MPL_notisfinite64(x[i]) || MPL_notisfinite64(y[i]))
+                    continue;
+                xmin = std::min(xmin, x[i]);
+                xmax = std::max(xmax, x[i]);
+                ymin = std::min(ymin, y[i]);
+                ymax = std::max(ymax, y[i]);
+            }
+            const double cells = 1 << TRIFINDER_CELL_BITS;
+            xscale = (xmax > xmin ? cells / (xmax - xmin) : 0.0);
+            yscale = (ymax > ymin ? cells / (ymax - ymin) : 0.0);
+        }
+
+        unsigned int operator()(const double& x, const double& y) const
+        {
+            return spread_bits(cell(x, xmin, xscale)) |
+                   spread_bits(cell(y, ymin, yscale)) << 1;
+        }
+
+        static unsigned int cell(const double& value, const double& min,
+                                 const double& scale)
+        {
+            // Values that are not finite go in the first cell.
+            double index = (value - min)*scale;
+            const unsigned int max_cell = (1u << TRIFINDER_CELL_BITS) - 1;
+            if (!(index >= 0.0))
+                return 0;
+            return (index >= max_cell ? max_cell : (unsigned int)index);
+        }
+
+        double xmin, ymin, xscale, yscale;
+    };
+}
+
+// Searches the n points in blocks of block points each, so that any number
+// of points can be counted in the int range of mpl::parallel_for.
+struct TrapezoidMapTriFinder::FindMany
+{
+    FindMany(TrapezoidMapTriFinder& finder_, const double* x_,
+             const double* y_, const npy_intp* order_, int* tri_,
+             npy_intp n_, npy_intp block_)
+        : finder(finder_), x(x_), y(y_), order(order_), tri(tri_), n(n_),
+          block(block_)
+    {}
+
+    void operator()(int start, int end)
+    {
+        npy_intp stop = std::min(end*block, n);
+        for (npy_intp i = start*block; i < stop; ++i) {
+            npy_intp j = (order ? order[i] : i);
+            tri[j] = finder.find_one(XY(x[j], y[j]));
+        }
+    }
+
+    TrapezoidMapTriFinder& finder;
+    const double* x;
+    const double* y;
+    const npy_intp* order;  // Order to search the points in, or 0.
+    int* tri;
+    npy_intp n;
+    npy_intp block;
+};
+
 Py::Object
 TrapezoidMapTriFinder::find_many(const Py::Tuple& args)
 {
-    args.verify_length(2);
+    args.verify_length(2, 3);
 
     // Check input arguments.
+    int threads = (args.size() > 2 ? (int)Py::Int(args[2]) : 0);
+    if (threads < 0)
+        throw Py::ValueError("threads must be non-negative");
+
     PyArrayObject* x = (PyArrayObject*)PyArray_ContiguousFromObject(
                            args[0].ptr(), PyArray_DOUBLE, 0, 0);
     PyArrayObject* y = (PyArrayObject*)PyArray_ContiguousFromObject(
@@ -1385,13 +1909,47 @@ TrapezoidMapTriFinder::find_many(const Py::Tuple& args)
     PyArrayObject* tri = (PyArrayObject*)PyArray_SimpleNew(
                              ndim, PyArray_DIMS(x), PyArray_INT);
 
+    const double* x_ptr = (const double*)PyArray_DATA(x);
+    const double* y_ptr = (const double*)PyArray_DATA(y);
+    npy_intp n = PyArray_SIZE(tri);
+
+    std::vector<npy_intp> order, offsets;
+    if (n >= MIN_TRIFINDER_POINTS_TO_SORT) {
+        try {
+            order.resize(n);
+            offsets.resize((1 << 2*TRIFINDER_CELL_BITS) + 1);
+        }
+        catch (std::bad_alloc&) {
+            // Search the points in their own order instead.
+            order.clear();
+        }
+    }
+
+    threads = std::min((npy_intp)mpl::resolve_num_threads(threads),
+                       n / MIN_TRIFINDER_POINTS_PER_THREAD);
+
+    Py_BEGIN_ALLOW_THREADS
+
+    if (!order.empty()) {
+        // Counting sort of the points by grid cell, keeping the points in
+        // each cell in their own order.
+        CellIndex cell_index(x_ptr, y_ptr, n);
+        for (npy_intp i = 0; i < n; ++i)
+            ++offsets[cell_index(x_ptr[i], y_ptr[i]) + 1];
+        for (std::vector<npy_intp>::size_type cell = 1; cell < offsets.size();
+                ++cell)
+            offsets[cell] += offsets[cell-1];
+        for (npy_intp i = 0; i < n; ++i)
+            order[offsets[cell_index(x_ptr[i], y_ptr[i])]++] = i;
+    }
+
     // Fill returned array.
-    double* x_ptr = (double*)PyArray_DATA(x);
-    double* y_ptr = (double*)PyArray_DATA(y);
-    int* tri_ptr = (int*)PyArray_DATA(tri);
-    int* tri_end = tri_ptr + PyArray_SIZE(tri);
-    while (tri_ptr < tri_end)
-        *tri_ptr++ = find_one(XY(*x_ptr++, *y_ptr++));
+    npy_intp block = n / std::numeric_limits<int>::max() + 1;
+    FindMany task(*this, x_ptr, y_ptr, order.empty() ? 0 : &order[0],
+                  (int*)PyArray_DATA(tri), n, block);
+    mpl::parallel_for(0, (int)((n + block - 1) / block), threads, task);
+
+    Py_END_ALLOW_THREADS
 
     Py_XDECREF(x);
     Py_XDECREF(y);
@@ -1468,6 +2026,142 @@ TrapezoidMapTriFinder::get_tree_stats()
     return list;
 }
 
+int
+TrapezoidMapTriFinder::get_node_state(
+    const Node* node,
+    std::vector<int>& nodes,
+    std::vector<const Trapezoid*>& trapezoids) const
+{
+    if (node->_state_index != -1)
+        return node->_state_index;
+
+    // Children first.
+    int state[4] = {node->_type, -1, -1, -1};
+    switch (node->_type) {
+        case Node::Type_XNode:
+            state[1] = (int)(node->_union.xnode.point - _points);
+            state[2] = get_node_state(node->_union.xnode.left, nodes,
+                                      trapezoids);
+            state[3] = get_node_state(node->_union.xnode.right, nodes,
+                                      trapezoids);
+            break;
+        case Node::Type_YNode:
+            state[1] = (int)(node->_union.ynode.edge - &_edges[0]);
+            state[2] = get_node_state(node->_union.ynode.below, nodes,
+                                      trapezoids);
+            state[3] = get_node_state(node->_union.ynode.above, nodes,
+                                      trapezoids);
+            break;
+        case Node::Type_TrapezoidNode:
+            state[1] = (int)trapezoids.size();
+            trapezoids.push_back(node->_union.trapezoid);
+            break;
+    }
+
+    node->_state_index = (int)nodes.size() / 4;
+    nodes.insert(nodes.end(), state, state + 4);
+    return node->_state_index;
+}
+
+void
+TrapezoidMapTriFinder::clear_node_state(const Node* node) const
+{
+    if (node->_state_index == -1)
+        return;
+    node->_state_index = -1;
+    switch (node->_type) {
+        case Node::Type_XNode:
+            clear_node_state(node->_union.xnode.left);
+            clear_node_state(node->_union.xnode.right);
+            break;
+        case Node::Type_YNode:
+            clear_node_state(node->_union.ynode.below);
+            clear_node_state(node->_union.ynode.above);
+            break;
+        default:  // Type_TrapezoidNode:
+            break;
+    }
+}
+
+Py::Object
+TrapezoidMapTriFinder::get_state()
+{
+    _VERBOSE("TrapezoidMapTriFinder::get_state");
+
+    if (_tree == 0)
+        throw Py::RuntimeError("TrapezoidMapTriFinder is not initialized");
+
+    std::vector<int> nodes;
+    std::vector<const Trapezoid*> trapezoids;
+    get_node_state(_tree, nodes, trapezoids);
+
+    // Points.
+    npy_intp npoints = get_triangulation().get_npoints() + 4;
+    npy_intp points_dims[2] = {npoints, 2};
+    PyArrayObject* points = (PyArrayObject*)PyArray_SimpleNew(
+                                2, points_dims, PyArray_DOUBLE);
+    PyArrayObject* point_tris = (PyArrayObject*)PyArray_SimpleNew(
+                                    1, points_dims, PyArray_INT);
+    double* points_ptr = (double*)PyArray_DATA(points);
+    int* point_tris_ptr = (int*)PyArray_DATA(point_tris);
+    for (npy_intp i = 0; i < npoints; ++i) {
+        *points_ptr++ = _points[i].x;
+        *points_ptr++ = _points[i].y;
+        *point_tris_ptr++ = _points[i].tri;
+    }
+
+    // Edges.
+    npy_intp edges_dims[2] = {static_cast<npy_intp>(_edges.size()), 6};
+    PyArrayObject* edges = (PyArrayObject*)PyArray_SimpleNew(
+                               2, edges_dims, PyArray_INT);
+    int* edges_ptr = (int*)PyArray_DATA(edges);
+    for (Edges::const_iterator it = _edges.begin(); it != _edges.end(); ++it) {
+        *edges_ptr++ = (int)(it->left - _points);
+        *edges_ptr++ = (int)(it->right - _points);
+        *edges_ptr++ = it->triangle_below;
+        *edges_ptr++ = it->triangle_above;
+        *edges_ptr++ = it->point_below == 0 ? -1 : (int)(it->point_below - _points);
+        *edges_ptr++ = it->point_above == 0 ? -1 : (int)(it->point_above - _points);
+    }
+
+    // Trapezoids, whose neighbors are found by way of their Nodes.
+    npy_intp trapezoids_dims[2] = {static_cast<npy_intp>(trapezoids.size()), 8};
+    PyArrayObject* trapezoids_array = (PyArrayObject*)PyArray_SimpleNew(
+                                          2, trapezoids_dims, PyArray_INT);
+    int* trapezoids_ptr = (int*)PyArray_DATA(trapezoids_array);
+    for (std::vector<const Trapezoid*>::const_iterator it = trapezoids.begin();
+            it != trapezoids.end(); ++it) {
+        const Trapezoid* trapezoid = *it;
+        *trapezoids_ptr++ = (int)(trapezoid->left - _points);
+        *trapezoids_ptr++ = (int)(trapezoid->right - _points);
+        *trapezoids_ptr++ = (int)(&trapezoid->below - &_edges[0]);
+        *trapezoids_ptr++ = (int)(&trapezoid->above - &_edges[0]);
+        const Trapezoid* neighbors[4] = {
+            trapezoid->lower_left, trapezoid->lower_right,
+            trapezoid->upper_left, trapezoid->upper_right};
+        for (int i = 0; i < 4; ++i) {
+            int node = (neighbors[i] == 0 ?
+                        -1 : neighbors[i]->trapezoid_node->_state_index);
+            *trapezoids_ptr++ = (node == -1 ? -1 : nodes[4*node + 1]);
+        }
+    }
+    clear_node_state(_tree);
+
+    // Nodes.
+    npy_intp nodes_dims[2] = {static_cast<npy_intp>(nodes.size() / 4), 4};
+    PyArrayObject* nodes_array = (PyArrayObject*)PyArray_SimpleNew(
+                                     2, nodes_dims, PyArray_INT);
+    std::copy(nodes.begin(), nodes.end(), (int*)PyArray_DATA(nodes_array));
+
+    Py::Tuple result(5);
+    result[0] = Py::asObject((PyObject*)points);
+    result[1] = Py::asObject((PyObject*)point_tris);
+    result[2] = Py::asObject((PyObject*)edges);
+    result[3] = Py::asObject((PyObject*)trapezoids_array);
+    result[4] = Py::asObject((PyObject*)nodes_array);
+    return result;
+}
+
 const Triangulation&
 TrapezoidMapTriFinder::get_triangulation() const
 {
@@ -1484,7 +2178,7 @@ TrapezoidMapTriFinder::init_type()
 
     add_varargs_method("find_many",
                        &TrapezoidMapTriFinder::find_many,
-                       "find_many(x,y)");
+                       "find_many(x,y,threads=0)");
     add_noargs_method("get_tree_stats",
                       &TrapezoidMapTriFinder::get_tree_stats,
                       "get_tree_stats()");
@@ -1494,6 +2188,12 @@ TrapezoidMapTriFinder::init_type()
     add_noargs_method("print_tree",
                       &TrapezoidMapTriFinder::print_tree,
                       "print_tree()");
+    add_noargs_method("get_state",
+                      &TrapezoidMapTriFinder::get_state,
+                      "get_state()");
+    add_varargs_method("set_state",
+                       &TrapezoidMapTriFinder::set_state,
+                       "set_state(state)");
 }
 
 Py::Object
@@ -1602,6 +2302,210 @@ TrapezoidMapTriFinder::print_tree()
     return Py::None();
 }
 
+namespace
+{
+    /* Return one of the arrays of a TrapezoidMapTriFinder state as a
+     * contiguous array of the specified type with shape (rows,cols), or
+     * (rows) if cols is 0.  rows of -1 accepts any number of rows.  Returns 0
+     * if the array is not of the right shape. */
+    PyArrayObject* get_state_array(const Py::Object& obj, int type,
+                                   npy_intp rows, npy_intp cols)
+    {
+        PyArrayObject* array = (PyArrayObject*)PyArray_ContiguousFromObject(
+                                   obj.ptr(), type, 1, 2);
+        if (array == 0) {
+            PyErr_Clear();
+            return 0;
+        }
+        if (PyArray_NDIM(array) != (cols == 0 ? 1 : 2) ||
+            (rows != -1 && PyArray_DIM(array,0) != rows) ||
+            (cols != 0 && PyArray_DIM(array,1) != cols)) {
+            Py_DECREF(array);
+            return 0;
+        }
+        return array;
+    }
+
+    // Whether all of values[i*cols + col] for all rows i are in [min,max).
+    bool in_range(const int* values, npy_intp rows, npy_intp cols, int col,
+                  int min, int max)
+    {
+        for (npy_intp i = 0; i < rows; ++i) {
+            int value = values[i*cols + col];
+            if (value < min || value >= max)
+                return false;
+        }
+        return true;
+    }
+}
+
+Py::Object
+TrapezoidMapTriFinder::set_state(const Py::Tuple& args)
+{
+    _VERBOSE("TrapezoidMapTriFinder::set_state");
+    args.verify_length(1);
+
+    Py::SeqBase<Py::Object> state = args[0];
+    if (state.length() != 5)
+        throw Py::ValueError("state must be a sequence of 5 arrays");
+
+    const Triangulation& triang = get_triangulation();
+    int ntri = triang.get_ntri();
+    int npoints = triang.get_npoints() + 4;
+
+    PyArrayObject* arrays[5] = {
+        get_state_array(state[0], PyArray_DOUBLE, npoints, 2),
+        get_state_array(state[1], PyArray_INT, npoints, 0),
+        get_state_array(state[2], PyArray_INT, -1, 6),
+        get_state_array(state[3], PyArray_INT, -1, 8),
+        get_state_array(state[4], PyArray_INT, -1, 4)};
+
+    const double* points = 0;
+    const int *point_tris = 0, *edges = 0, *trapezoids = 0, *nodes = 0;
+    int nedges = 0, ntrapezoids = 0, nnodes = 0;
+    bool ok = true;
+    for (int i = 0; i < 5; ++i)
+        ok = ok && arrays[i] != 0;
+    if (ok) {
+        points = (const double*)PyArray_DATA(arrays[0]);
+        point_tris = (const int*)PyArray_DATA(arrays[1]);
+        edges = (const int*)PyArray_DATA(arrays[2]);
+        trapezoids = (const int*)PyArray_DATA(arrays[3]);
+        nodes = (const int*)PyArray_DATA(arrays[4]);
+        nedges = (int)PyArray_DIM(arrays[2],0);
+        ntrapezoids = (int)PyArray_DIM(arrays[3],0);
+        nnodes = (int)PyArray_DIM(arrays[4],0);
+    }
+
+    // Check that the points are those of the triangulation, that every index
+    // is in range and every triangle unmasked, that the right point of each
+    // Edge and Trapezoid is to the right of the left, and that the Nodes form
+    // a tree with the root last in which each Trapezoid has exactly one Node.
+    for (int i = 0; ok && i < npoints - 4; ++i) {
+        XY xy = triang.get_point_coords(i);
+        ok = points[2*i] == xy.x && points[2*i+1] == xy.y;
+    }
+    ok = ok && nedges >= 2 && nnodes >= 1 &&
+         in_range(point_tris, npoints, 1, 0, -1, ntri) &&
+         in_range(edges, nedges, 6, 0, 0, npoints) &&
+         in_range(edges, nedges, 6, 1, 0, npoints) &&
+         in_range(edges, nedges, 6, 2, -1, ntri) &&
+         in_range(edges, nedges, 6, 3, -1, ntri) &&
+         in_range(edges, nedges, 6, 4, -1, npoints) &&
+         in_range(edges, nedges, 6, 5, -1, npoints) &&
+         in_range(trapezoids, ntrapezoids, 8, 0, 0, npoints) &&
+         in_range(trapezoids, ntrapezoids, 8, 1, 0, npoints) &&
+         in_range(trapezoids, ntrapezoids, 8, 2, 0, nedges) &&
+         in_range(trapezoids, ntrapezoids, 8, 3, 0, nedges);
+    for (int col = 4; ok && col < 8; ++col)
+        ok = in_range(trapezoids, ntrapezoids, 8, col, -1, ntrapezoids);
+    for (int i = 0; ok && i < npoints + 2*nedges; ++i) {
+        int tri = (i < npoints ? point_tris[i]
+                               : edges[6*((i - npoints)/2) + 2 + (i - npoints)%2]);
+        ok = tri == -1 || !triang.is_masked(tri);
+    }
+    for (int i = 0; ok && i < nedges + ntrapezoids; ++i) {
+        const int* item = (i < nedges ? edges + 6*i
+                                      : trapezoids + 8*(i - nedges));
+        XY left(points[2*item[0]], points[2*item[0]+1]);
+        XY right(points[2*item[1]], points[2*item[1]+1]);
+        ok = right.is_right_of(left);
+    }
+
+    std::vector<int> trapezoid_nodes(ntrapezoids, 0), parents(nnodes, 0);
+    for (int i = 0; ok && i < nnodes; ++i) {
+        const int* node = nodes + 4*i;
+        switch (node[0]) {
+            case Node::Type_XNode:
+            case Node::Type_YNode:
+                ok = node[1] >= 0 &&
+                     node[1] < (node[0] == Node::Type_XNode ? npoints : nedges) &&
+                     node[2] >= 0 && node[2] < i &&
+                     node[3] >= 0 && node[3] < i && node[2] != node[3];
+                if (ok) {
+                    ++parents[node[2]];
+                    ++parents[node[3]];
+                }
+                break;
+            case Node::Type_TrapezoidNode:
+                ok = node[1] >= 0 && node[1] < ntrapezoids &&
+                     ++trapezoid_nodes[node[1]] == 1;
+                break;
+            default:
+                ok = false;
+        }
+    }
+    for (int i = 0; ok && i < ntrapezoids; ++i)
+        ok = trapezoid_nodes[i] == 1;
+    for (int i = 0; ok && i < nnodes - 1; ++i)
+        ok = parents[i] > 0;
+
+    if (!ok) {
+        for (int i = 0; i < 5; ++i)
+            Py_XDECREF(arrays[i]);
+        throw Py::ValueError(
+            "state is not that of a TrapezoidMapTriFinder for this triangulation");
+    }
+
+    clear();
+
+    _points = new Point[npoints];
+    for (int i = 0; i < npoints; ++i) {
+        _points[i] = Point(points[2*i], points[2*i+1]);
+        _points[i].tri = point_tris[i];
+    }
+
+    _edges.reserve(nedges);
+    for (int i = 0; i < nedges; ++i) {
+        const int* edge = edges + 6*i;
+        _edges.push_back(Edge(_points + edge[0], _points + edge[1],
+                              edge[2], edge[3],
+                              edge[4] == -1 ? 0 : _points + edge[4],
+                              edge[5] == -1 ? 0 : _points + edge[5]));
+    }
+
+    std::vector<Trapezoid*> trapezoid_ptrs(ntrapezoids);
+    for (int i = 0; i < ntrapezoids; ++i) {
+        const int* trapezoid = trapezoids + 8*i;
+        trapezoid_ptrs[i] = new Trapezoid(_points + trapezoid[0],
+                                          _points + trapezoid[1],
+                                          _edges[trapezoid[2]],
+                                          _edges[trapezoid[3]]);
+    }
+    for (int i = 0; i < ntrapezoids; ++i) {
+        const int* neighbors = trapezoids + 8*i + 4;
+        Trapezoid* trapezoid = trapezoid_ptrs[i];
+        trapezoid->lower_left = neighbors[0] == -1 ? 0 : trapezoid_ptrs[neighbors[0]];
+        trapezoid->lower_right = neighbors[1] == -1 ? 0 : trapezoid_ptrs[neighbors[1]];
+        trapezoid->upper_left = neighbors[2] == -1 ? 0 : trapezoid_ptrs[neighbors[2]];
+        trapezoid->upper_right = neighbors[3] == -1 ? 0 : trapezoid_ptrs[neighbors[3]];
+    }
+
+    std::vector<Node*> node_ptrs(nnodes);
+    for (int i = 0; i < nnodes; ++i) {
+        const int* node = nodes + 4*i;
+        switch (node[0]) {
+            case Node::Type_XNode:
+                node_ptrs[i] = new Node(_points + node[1], node_ptrs[node[2]],
+                                        node_ptrs[node[3]]);
+                break;
+            case Node::Type_YNode:
+                node_ptrs[i] = new Node(&_edges[node[1]], node_ptrs[node[2]],
+                                        node_ptrs[node[3]]);
+                break;
+            default:  // Type_TrapezoidNode:
+                node_ptrs[i] = new Node(trapezoid_ptrs[node[1]]);
+                break;
+        }
+    }
+    _tree = node_ptrs.back();
+    _tree->assert_valid(true);
+
+    for (int i = 0; i < 5; ++i)
+        Py_DECREF(arrays[i]);
+    return Py::None();
+}
+
 TrapezoidMapTriFinder::Edge::Edge(const Point* left_,
                                   const Point* right_,
                                   int triangle_below_,
@@ -1675,7 +2579,8 @@ TrapezoidMapTriFinder::Edge::print_debug() const
 }
 
 TrapezoidMapTriFinder::Node::Node(const Point* point, Node* left, Node* right)
-    : _type(Type_XNode)
+    : _type(Type_XNode),
+      _state_index(-1)
 {
     assert(point != 0 && "Invalid point");
     assert(left != 0 && "Invalid left node");
@@ -1688,7 +2593,8 @@ TrapezoidMapTriFinder::Node::Node(const Point* point, Node* left, Node* right)
 }
 
 TrapezoidMapTriFinder::Node::Node(const Edge* edge, Node* below, Node* above)
-    : _type(Type_YNode)
+    : _type(Type_YNode),
+      _state_index(-1)
 {
     assert(edge != 0 && "Invalid edge");
     assert(below != 0 && "Invalid below node");
@@ -1701,7 +2607,8 @@ TrapezoidMapTriFinder::Node::Node(const Edge* edge, Node* below, Node* above)
 }
 
 TrapezoidMapTriFinder::Node::Node(Trapezoid* trapezoid)
-    : _type(Type_TrapezoidNode)
+    : _type(Type_TrapezoidNode),
+      _state_index(-1)
 {
     assert(trapezoid != 0 && "Null Trapezoid");
     _union.trapezoid = trapezoid;
@@ -53,6 +53,11 @@
  * filled contours this process is repeated for both lower and upper contour
  * levels, and the direction of traversal is reversed for upper contours.
  *
+ * Contours at many levels are best generated together.  The triangles are
+ * then sorted once by the levels that pass through them, so that each level
+ * only traverses its own triangles rather than all of them, and the levels
+ * may be shared between several threads.
+ *
  * Working out in which direction a contour line leaves a triangle uses the
  * a lookup table.  A triangle has three points, each of which has a z-value
  * which is either less than the contour level or not.  Hence there are 8
@@ -248,17 +253,6 @@ public:
     void write_boundaries() const;
 
 private:
-    // An edge of a triangulation, composed of start and end point indices.
-    struct Edge
-    {
-        Edge() : start(-1), end(-1) {}
-        Edge(int start_, int end_) : start(start_), end(end_) {}
-        bool operator<(const Edge& other) const {
-            return start != other.start ? start < other.start : end < other.end;
-        }
-        int start, end;
-    };
-
     /* An edge of a boundary of a triangulation, composed of a boundary index
      * and an edge index within that boundary.  Used to index into the
      * boundaries collection to obtain the corresponding TriEdge. */
@@ -282,6 +276,17 @@ private:
      * get_neighbors(), which will call this function if necessary. */
     void calculate_neighbors();
 
+    /* Sort the half-edges (3*tri + edge) of the unmasked triangles by their
+     * edge, for calculate_edges() and calculate_neighbors().  The half-edges
+     * whose larger point index is p are half_edges[offsets[p]:offsets[p+1]],
+     * ordered by smaller point index and then by half-edge index, and
+     * counts[p] is the number of distinct edges among them.  threads is set
+     * to the number of threads worth using on the buckets. */
+    void sort_half_edges(std::vector<int>& offsets,
+                         std::vector<int>& half_edges,
+                         std::vector<int>& counts,
+                         int& threads) const;
+
     /* Correct each triangle so that the vertices are ordered in an
      * anticlockwise manner. */
     void correct_triangles();
@@ -355,6 +360,22 @@ public:
      *   kinds: ubyte array of shape (n_points) of all point code types. */
     Py::Object create_filled_contour(const Py::Tuple &args);
 
+    /* Create and return non-filled contours at several levels.
+     *   levels: Sequence of contour levels.
+     *   threads: Optional number of threads to use, 0 (the default) for one
+     *            per processor.
+     * Returns python list with the result of create_contour for each level. */
+    Py::Object create_contours(const Py::Tuple &args);
+
+    /* Create and return filled contours between several pairs of levels.
+     *   lower_levels: Sequence of lower contour levels.
+     *   upper_levels: Sequence of upper contour levels, of the same length.
+     *   threads: Optional number of threads to use, 0 (the default) for one
+     *            per processor.
+     * Returns python list with the result of create_filled_contour for each
+     * pair of levels. */
+    Py::Object create_filled_contours(const Py::Tuple &args);
+
     // CXX initialisation function.
     static void init_type();
 
@@ -362,10 +383,44 @@ private:
     typedef Triangulation::Boundary Boundary;
     typedef Triangulation::Boundaries Boundaries;
 
-    /* Clear visited flags.
+    typedef std::vector<bool> InteriorVisited;    // Size 2*ntri
+    typedef std::vector<bool> BoundaryVisited;
+    typedef std::vector<BoundaryVisited> BoundariesVisited;
+    typedef std::vector<bool> BoundariesUsed;
+
+    // Flags of what has been visited while generating a single contour.
+    struct Visited
+    {
+        Visited(int ntri, const Boundaries& boundaries);
+
+        InteriorVisited interior;
+        BoundariesVisited boundaries;  // Only used for filled contours.
+        BoundariesUsed boundaries_used;  // Only used for filled contours.
+    };
+
+    // Range of indices of the triangles that a contour level passes through.
+    struct TriRange
+    {
+        TriRange() : begin(0), end(0) {}
+        TriRange(const int* begin_, const int* end_)
+            : begin(begin_), end(end_) {}
+        const int* begin;
+        const int* end;
+    };
+
+    // Generates the contours of a range of levels, see generate_contours().
+    struct GenerateContours;
+    friend struct GenerateContours;
+
+    /* Clear the visited flags set while generating a single contour.
+     *   visited: Flags to clear.
+     *   tris: Triangles that the contour level(s) pass through, the only ones
+     *         whose flags can have been set.
      *   include_boundaries: Whether to clear boundary flags or not, which are
      *                       only used for filled contours. */
-    void clear_visited_flags(bool include_boundaries);
+    void clear_visited_flags(Visited& visited,
+                             const TriRange& tris,
+                             bool include_boundaries) const;
 
     /* Convert a non-filled Contour from C++ to Python.
      * Returns python list [segs0, segs1, ...] where
@@ -386,16 +441,20 @@ private:
     /* Find and follow non-filled contour lines that start and end on a
      * boundary of the Triangulation.
      *   contour: Contour to add new lines to.
+     *   visited: Visited flags.
      *   level: Contour level. */
     void find_boundary_lines(Contour& contour,
+                             Visited& visited,
                              const double& level);
 
     /* Find and follow filled contour lines at either of the specified contour
      * levels that start and end of a boundary of the Triangulation.
      *   contour: Contour to add new lines to.
+     *   visited: Visited flags.
      *   lower_level: Lower contour level.
      *   upper_level: Upper contour level. */
     void find_boundary_lines_filled(Contour& contour,
+                                    Visited& visited,
                                     const double& lower_level,
                                     const double& upper_level);
 
@@ -403,18 +462,23 @@ private:
      * completely in the interior of the Triangulation and hence do not
      * intersect any boundary.
      *   contour: Contour to add new lines to.
+     *   visited: Visited flags.
      *   level: Contour level.
      *   on_upper: Whether on upper or lower contour level.
-     *   filled: Whether contours are filled or not. */
+     *   filled: Whether contours are filled or not.
+     *   tris: Triangles that the contour level passes through. */
     void find_interior_lines(Contour& contour,
+                             Visited& visited,
                              const double& level,
                              bool on_upper,
-                             bool filled);
+                             bool filled,
+                             const TriRange& tris);
 
     /* Follow contour line around boundary of the Triangulation from the
      * specified TriEdge to its end which can be on either the lower or upper
      * levels.  Only used for filled contours.
      *   contour_line: Contour line to append new points to.
+     *   visited: Visited flags.
      *   tri_edge: On entry, TriEdge to start from.  On exit, TriEdge that is
      *             finished on.
      *   lower_level: Lower contour level.
@@ -422,6 +486,7 @@ private:
      *   on_upper: Whether starts on upper level or not.
      * Return true if finishes on upper level, false if lower. */
     bool follow_boundary(ContourLine& contour_line,
+                         Visited& visited,
                          TriEdge& tri_edge,
                          const double& lower_level,
                          const double& upper_level,
@@ -429,6 +494,7 @@ private:
 
     /* Follow contour line across interior of Triangulation.
      *   contour_line: Contour line to append new points to.
+     *   visited: Visited flags.
      *   tri_edge: On entry, TriEdge to start from.  On exit, TriEdge that is
      *             finished on.
      *   end_on_boundary: Whether this line ends on a boundary, or loops back
@@ -436,6 +502,7 @@ private:
      *   level: Contour level to follow.
      *   on_upper: Whether following upper or lower contour level. */
     void follow_interior(ContourLine& contour_line,
+                         Visited& visited,
                          TriEdge& tri_edge,
                          bool end_on_boundary,
                          const double& level,
@@ -444,6 +511,35 @@ private:
     // Return the Triangulation boundaries.
     const Boundaries& get_boundaries() const;
 
+    /* Generate a single non-filled or filled contour.
+     *   contour: Contour to add the lines to.
+     *   visited: Visited flags, all clear on entry and on exit.
+     *   lower_level: Contour level, or lower contour level if filled.
+     *   upper_level: Upper contour level, only used if filled.
+     *   lower_tris: Triangles that lower_level passes through.
+     *   upper_tris: Triangles that upper_level passes through.
+     *   filled: Whether the contour is filled or not. */
+    void generate_contour(Contour& contour,
+                          Visited& visited,
+                          const double& lower_level,
+                          const double& upper_level,
+                          const TriRange& lower_tris,
+                          const TriRange& upper_tris,
+                          bool filled);
+
+    /* Generate contours at several levels, the triangles being sorted by the
+     * levels that pass through them first.
+     *   lower_levels: Contour levels, or lower contour levels if filled.
+     *   upper_levels: Upper contour levels if filled, otherwise ignored.
+     *   filled: Whether the contours are filled or not.
+     *   threads: Number of threads to use, 0 for one per processor.
+     *   contours: Set to the contours, one per level. */
+    void generate_contours(const std::vector<double>& lower_levels,
+                           const std::vector<double>& upper_levels,
+                           bool filled,
+                           int threads,
+                           std::vector<Contour>& contours);
+
     /* Return the edge by which the a level leaves a particular triangle,
      * which is 0, 1 or 2 if the contour passes through the triangle or -1
      * otherwise.
@@ -458,6 +554,13 @@ private:
     // Return the z-value at the specified point index.
     const double& get_z(int point) const;
 
+    /* Find which of the sorted, non-NaN levels pass through a particular
+     * triangle, which are those from index first up to but excluding last.
+     *   tri: Triangle index.
+     *   levels: Sorted contour levels. */
+    void get_level_range(int tri, const std::vector<double>& levels,
+                         int& first, int& last) const;
+
     /* Return the point at which the a level intersects the line connecting the
      * two specified point indices. */
     XY interp(int point1, int point2, const double& level) const;
@@ -467,16 +570,6 @@ private:
     // Variables shared with python, always set.
     Py::Object _triangulation;
     PyArrayObject* _z;        // double array (npoints).
-
-    // Variables internal to C++ only.
-    typedef std::vector<bool> InteriorVisited;    // Size 2*ntri
-    typedef std::vector<bool> BoundaryVisited;
-    typedef std::vector<BoundaryVisited> BoundariesVisited;
-    typedef std::vector<bool> BoundariesUsed;
-
-    InteriorVisited _interior_visited;
-    BoundariesVisited _boundaries_visited;  // Only used for filled contours.
-    BoundariesUsed _boundaries_used;        // Only used for filled contours.
 };
 
 
@@ -521,7 +614,11 @@ public:
 
     /* Return an array of triangle indices.  Takes any-shaped arrays x and y of
      * point coordinates, and returns an array of the same shape containing the
-     * indices of the triangles at those points. */
+     * indices of the triangles at those points.  An optional third argument
+     * is the number of threads to use, 0 (the default) for one per processor.
+     * The GIL is released while searching, and many points are searched in
+     * an order that keeps nearby points together, which makes better use of
+     * the cache; neither changes the result. */
     Py::Object find_many(const Py::Tuple& args);
 
     /* Return a python list containing the following statistics about the tree:
@@ -537,6 +634,27 @@ public:
      *          comparisons needed to search through the tree) */
     Py::Object get_tree_stats();
 
+    /* Return the state of this initialized object, from which set_state() can
+     * restore it without building the trapezoid map again, as a python tuple
+     * of arrays:
+     *   0: double array of shape (npoints+4,2) of point coordinates, those of
+     *      the triangulation followed by the corners of the enclosing
+     *      rectangle.
+     *   1: int array of shape (npoints+4) of the triangle associated with
+     *      each point.
+     *   2: int array of shape (nedges,6) of the left and right points, the
+     *      triangles below and above, and the points below and above of each
+     *      Edge.
+     *   3: int array of shape (ntrapezoids,8) of the left and right points,
+     *      the below and above Edges, and the lower left, lower right, upper
+     *      left and upper right neighbors of each Trapezoid.
+     *   4: int array of shape (nnodes,4) of the type (0 for an XNode, 1 for
+     *      a YNode, 2 for a TrapezoidNode), then the point, Edge or Trapezoid
+     *      and the two children of each Node, children before their parents
+     *      and the root last.
+     * Missing points, triangles, neighbors and children are -1. */
+    Py::Object get_state();
+
     // CXX initialisation function.
     static void init_type();
 
@@ -547,6 +665,12 @@ public:
     // Print the search tree as text to stdout; useful for debug purposes.
     Py::Object print_tree();
 
+    /* Initialize this object from the state returned by get_state(), which
+     * must be for the same triangulation, instead of calling initialize().
+     * Raises ValueError, leaving this object unchanged, if the state is not
+     * consistent. */
+    Py::Object set_state(const Py::Tuple& args);
+
 private:
     /* A Point consists of x,y coordinates as well as the index of a triangle
      * associated with the point, so that a search at this point's coordinates
@@ -685,12 +809,15 @@ private:
         Node& operator=(const Node& other);
 
     private:
+        friend class TrapezoidMapTriFinder;  // For get_state and set_state.
+
         typedef enum {
             Type_XNode,
             Type_YNode,
             Type_TrapezoidNode
         } Type;
         Type _type;
+        mutable int _state_index;    // Index in get_state(), otherwise -1.
 
         union {
             struct {
@@ -766,6 +893,21 @@ private:
     };
 
 
+    // Searches for a range of points, see find_many().
+    struct FindMany;
+    friend struct FindMany;
+
+    /* Append the state of the specified Node and of the Nodes below it, see
+     * get_state(), unless already appended.  Return the Node's index.
+     *   nodes: Node states, 4 ints each.
+     *   trapezoids: Trapezoids of the TrapezoidNodes, in order. */
+    int get_node_state(const Node* node,
+                       std::vector<int>& nodes,
+                       std::vector<const Trapezoid*>& trapezoids) const;
+
+    // Reset the state indices set by get_node_state() to -1.
+    void clear_node_state(const Node* node) const;
+
     // Add the specified Edge to the search tree, returning true if successful.
     bool add_edge_to_tree(const Edge& edge);
 
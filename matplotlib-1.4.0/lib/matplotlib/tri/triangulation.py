@@ -78,6 +78,20 @@ class Triangulation(object):
         # Default TriFinder not created until needed.
         self._trifinder = None
 
+    def __getstate__(self):
+        # The C++ object is not pickled, but the edges and neighbors that it
+        # calculates are, so that they are not calculated again.
+        state = self.__dict__.copy()
+        state['_edges'] = self.edges
+        state['_neighbors'] = self.neighbors
+        state['_cpp_triangulation'] = None
+        return state
+
+    def __setstate__(self, state):
+        self.__dict__.update(state)
+        if hasattr(self._trifinder, '_restore'):
+            self._trifinder._restore()
+
     def calculate_plane_coefficients(self, z):
         """
         Calculate plane equation coefficients for all unmasked triangles from
@@ -63,20 +63,19 @@ class TriContourSet(ContourSet):
         """
         Create and return allsegs and allkinds by calling underlying C code.
         """
-        allsegs = []
         if self.filled:
             lowers, uppers = self._get_lowers_and_uppers()
+            allsegs = []
             allkinds = []
-            for lower, upper in zip(lowers, uppers):
-                segs, kinds = self.cppContourGenerator.create_filled_contour(
-                    lower, upper)
+            # All levels at once, which traverses the triangulation once
+            # rather than once per level.
+            for segs, kinds in self.cppContourGenerator.create_filled_contours(
+                    lowers, uppers):
                 allsegs.append([segs])
                 allkinds.append([kinds])
         else:
             allkinds = None
-            for level in self.levels:
-                segs = self.cppContourGenerator.create_contour(level)
-                allsegs.append(segs)
+            allsegs = self.cppContourGenerator.create_contours(self.levels)
         return allsegs, allkinds
 
     def _contour_args(self, args, kwargs):
@@ -57,6 +57,31 @@ class TrapezoidMapTriFinder(TriFinder):
         # C++ checks arguments are OK.
         return self._cpp_trifinder.find_many(x, y)
 
+    def __getstate__(self):
+        # The C++ object is pickled as the arrays of its built trapezoid map,
+        # so that it does not need to be built again when unpickled.
+        state = self.__dict__.copy()
+        state['_cpp_trifinder'] = self._cpp_trifinder.get_state()
+        return state
+
+    def __setstate__(self, state):
+        self.__dict__.update(state)
+        self._restore()
+
+    def _restore(self):
+        """
+        Restore the underlying C++ object from its pickled state, once both
+        this object and its triangulation have been unpickled.  If the
+        triangulation refers to this object, whichever of the two is unpickled
+        last calls this.
+        """
+        state = self.__dict__.get('_cpp_trifinder')
+        if (isinstance(state, tuple) and
+                '_cpp_triangulation' in self._triangulation.__dict__):
+            self._cpp_trifinder = _tri.TrapezoidMapTriFinder(
+                self._triangulation.get_cpp_triangulation())
+            self._cpp_trifinder.set_state(state)
+
     def _get_tree_stats(self):
         """
         Return a python list containing the statistics about the node tree:
@@ -232,6 +232,15 @@ def make_extension(name, files, *args, **kwargs):
     return ext
 
 
+def add_thread_flags(ext):
+    """
+    Link the extension `ext` against the native threads library, as
+    required by the helpers in src/mplthreads.h.
+    """
+    if sys.platform != 'win32':
+        ext.libraries.append('pthread')
+
+
 class PkgConfig(object):
     """
     This is a class for communicating with pkg-config.
@@ -1084,6 +1093,7 @@ class Path(SetupPackage):
         Numpy().add_flags(ext)
         LibAgg().add_flags(ext)
         CXX().add_flags(ext)
+        add_thread_flags(ext)
         return ext
 
 
@@ -1125,6 +1135,7 @@ class Delaunay(SetupPackage):
         sources = [os.path.join('lib/matplotlib/delaunay', s) for s in sources]
         ext = make_extension('matplotlib._delaunay', sources)
         Numpy().add_flags(ext)
+        add_thread_flags(ext)
         return ext
 
 
@@ -1151,6 +1162,7 @@ class Tri(SetupPackage):
         ext = make_extension('matplotlib._tri', sources)
         Numpy().add_flags(ext)
         CXX().add_flags(ext)
+        add_thread_flags(ext)
         return ext
 
 
@@ -1280,6 +1292,7 @@ class BackendAgg(OptionalBackendPackage):
         LibAgg().add_flags(ext)
         FreeType().add_flags(ext)
         CXX().add_flags(ext)
+        add_thread_flags(ext)
         return ext
 
 
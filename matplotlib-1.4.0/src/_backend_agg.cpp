@@ -11,6 +11,7 @@
 #include "_image.h"
 #include "_backend_agg.h"
 #include "mplutils.h"
+#include "mplthreads.h"
 
 #include <iostream>
 #include <fstream>
@@ -19,6 +20,7 @@
 #include <stdexcept>
 #include <time.h>
 #include <algorithm>
+#include <list>
 
 #include "agg_conv_curve.h"
 #include "agg_conv_transform.h"
@@ -399,19 +401,14 @@ RendererAgg::PIXELS_PER_INCH(96);
 
 
 RendererAgg::RendererAgg(unsigned int width, unsigned int height, double dpi,
-                         int debug) :
+                         int debug, int threads) :
     width(width),
     height(height),
     dpi(dpi),
     NUMBYTES(width*height*4),
     pixBuffer(NULL),
     renderingBuffer(),
-    alphaBuffer(NULL),
-    alphaMaskRenderingBuffer(),
-    alphaMask(alphaMaskRenderingBuffer),
-    pixfmtAlphaMask(alphaMaskRenderingBuffer),
-    rendererBaseAlphaMask(),
-    rendererAlphaMask(),
+    alphaMask(),
     scanlineAlphaMask(),
     slineP8(),
     slineBin(),
@@ -421,7 +418,9 @@ RendererAgg::RendererAgg(unsigned int width, unsigned int height, double dpi,
     rendererBin(),
     theRasterizer(),
     debug(debug),
-    _fill_color(agg::rgba(1, 1, 1, 0))
+    threads(threads),
+    _fill_color(agg::rgba(1, 1, 1, 0)),
+    damage_tracking(false)
 {
     _VERBOSE("RendererAgg::RendererAgg");
     unsigned stride(width*4);
@@ -433,20 +432,80 @@ RendererAgg::RendererAgg(unsigned int width, unsigned int height, double dpi,
     rendererBase.clear(_fill_color);
     rendererAA.attach(rendererBase);
     rendererBin.attach(rendererBase);
-    hatchRenderingBuffer.attach(hatchBuffer, HATCH_SIZE, HATCH_SIZE,
-                                HATCH_SIZE*4);
 }
 
 
+agg::rect_i
+RendererAgg::get_clipbox(const Py::Object& cliprect)
+{
+    //get the clip rectangle from the gc, in pixels
+
+    double l, b, r, t;
+    if (py_convert_bbox(cliprect.ptr(), l, b, r, t))
+    {
+        return agg::rect_i(std::max(int(floor(l + 0.5)), 0),
+                           std::max(int(floor(height - b + 0.5)), 0),
+                           std::min(int(floor(r + 0.5)), int(width)),
+                           std::min(int(floor(height - t + 0.5)), int(height)));
+    }
+    return agg::rect_i(0, 0, width, height);
+}
+
+
+// The most rectangles kept by damage tracking; past this, new damage
+// is merged into the last one
+#define MAX_DAMAGE_RECTS 16
+
+
+void
+RendererAgg::add_damage(agg::rect_i rect)
+{
+    if (!damage_tracking ||
+        !rect.clip(agg::rect_i(0, 0, int(width) - 1, int(height) - 1)))
+    {
+        return;
+    }
+
+    // The stored rectangles never overlap: rect absorbs every one it
+    // intersects, rescanning as it grows, and then (if there is no room
+    // left) the last one, until it can be stored on its own
+    for (;;)
+    {
+        size_t i = 0;
+        while (i < damage.size())
+        {
+            if (agg::intersect_rectangles(damage[i], rect).is_valid())
+            {
+                rect = agg::unite_rectangles(damage[i], rect);
+                damage.erase(damage.begin() + i);
+                i = 0;
+            }
+            else
+            {
+                ++i;
+            }
+        }
+
+        if (damage.size() < MAX_DAMAGE_RECTS)
+        {
+            break;
+        }
+        rect = agg::unite_rectangles(damage.back(), rect);
+        damage.pop_back();
+    }
+
+    damage.push_back(rect);
+}
+
+
+// Record the cells of theRasterizer as damage, ahead of rendering them
 void
-RendererAgg::create_alpha_buffers()
+RendererAgg::add_rasterizer_damage()
 {
-    if (!alphaBuffer)
+    if (damage_tracking && theRasterizer.rewind_scanlines())
     {
-        alphaBuffer = new agg::int8u[width * height];
-        alphaMaskRenderingBuffer.attach(alphaBuffer, width, height, width);
-        rendererBaseAlphaMask.attach(pixfmtAlphaMask);
-        rendererAlphaMask.attach(rendererBaseAlphaMask);
+        add_damage(agg::rect_i(theRasterizer.min_x(), theRasterizer.min_y(),
+                               theRasterizer.max_x(), theRasterizer.max_y()));
     }
 }
 
@@ -459,18 +518,8 @@ RendererAgg::set_clipbox(const Py::Object& cliprect, R& rasterizer)
 
     _VERBOSE("RendererAgg::set_clipbox");
 
-    double l, b, r, t;
-    if (py_convert_bbox(cliprect.ptr(), l, b, r, t))
-    {
-        rasterizer.clip_box(std::max(int(floor(l + 0.5)), 0),
-                            std::max(int(floor(height - b + 0.5)), 0),
-                            std::min(int(floor(r + 0.5)), int(width)),
-                            std::min(int(floor(height - t + 0.5)), int(height)));
-    }
-    else
-    {
-        rasterizer.clip_box(0, 0, width, height);
-    }
+    agg::rect_i clipbox = get_clipbox(cliprect);
+    rasterizer.clip_box(clipbox.x1, clipbox.y1, clipbox.x2, clipbox.y2);
 
     _VERBOSE("RendererAgg::set_clipbox done");
 }
@@ -572,6 +621,9 @@ RendererAgg::restore_region(const Py::Tuple& args)
                 region->stride);
 
     rendererBase.copy_from(rbuf, 0, region->rect.x1, region->rect.y1);
+    add_damage(agg::rect_i(region->rect.x1, region->rect.y1,
+                           region->rect.x1 + region->width - 1,
+                           region->rect.y1 + region->height - 1));
 
     return Py::Object();
 }
@@ -617,11 +669,19 @@ RendererAgg::restore_region2(const Py::Tuple& args)
                 region->stride);
 
     rendererBase.copy_from(rbuf, &rect, x, y);
+    add_damage(agg::rect_i(x, y, x + xx2 - xx1 - 1, y + yy2 - yy1 - 1));
 
     return Py::Object();
 }
 
 
+// The number of rasterized clip paths kept by each renderer
+#define CLIP_MASK_CACHE_ENTRIES 16
+
+// Older clip masks are dropped once they take more memory than this
+// altogether; the one in use is always kept
+#define CLIP_MASK_CACHE_MAX_BYTES (16 << 20)
+
 bool
 RendererAgg::render_clippath(const Py::Object& clippath,
                              const agg::trans_affine& clippath_trans)
@@ -630,35 +690,234 @@ RendererAgg::render_clippath(const Py::Object& clippath,
     typedef agg::conv_curve<transformed_path_t> curve_t;
 
     bool has_clippath = (clippath.ptr() != Py_None);
+    if (!has_clippath)
+    {
+        return has_clippath;
+    }
 
-    if (has_clippath &&
-        (clippath.ptr() != lastclippath.ptr() ||
-         clippath_trans != lastclippath_transform))
+    std::list<ClipMask>::iterator entry = clipMasks.begin();
+    for (; entry != clipMasks.end(); ++entry)
     {
-        create_alpha_buffers();
-        agg::trans_affine trans(clippath_trans);
-        trans *= agg::trans_affine_scaling(1.0, -1.0);
-        trans *= agg::trans_affine_translation(0.0, (double)height);
+        if (entry->path.ptr() == clippath.ptr() &&
+            entry->trans == clippath_trans)
+        {
+            break;
+        }
+    }
 
-        PathIterator clippath_iter(clippath);
-        rendererBaseAlphaMask.clear(agg::gray8(0, 0));
-        transformed_path_t transformed_clippath(clippath_iter, trans);
-        curve_t curved_clippath(transformed_clippath);
-        try {
-            theRasterizer.add_path(curved_clippath);
-        } catch (std::overflow_error &e) {
-            throw Py::OverflowError(e.what());
+    if (entry != clipMasks.end())
+    {
+        if (entry != clipMasks.begin())
+        {
+            clipMasks.splice(clipMasks.begin(), clipMasks, entry);
+            ClipMask& mask = clipMasks.front();
+            alphaMask.attach(mask.alpha.empty() ? NULL : &mask.alpha[0],
+                             mask.bounds);
+        }
+        return has_clippath;
+    }
+
+    agg::trans_affine trans(clippath_trans);
+    trans *= agg::trans_affine_scaling(1.0, -1.0);
+    trans *= agg::trans_affine_translation(0.0, (double)height);
+
+    PathIterator clippath_iter(clippath);
+    transformed_path_t transformed_clippath(clippath_iter, trans);
+    curve_t curved_clippath(transformed_clippath);
+
+    // The mask is rasterized against the whole canvas, with a rasterizer
+    // of its own, so that it does not depend on (or disturb) the clip
+    // box of whatever it is going to be used for.
+    rasterizer ras;
+    ras.clip_box(0, 0, width, height);
+    try {
+        ras.add_path(curved_clippath);
+    } catch (std::overflow_error &e) {
+        throw Py::OverflowError(e.what());
+    }
+
+    clipMasks.push_front(ClipMask());
+    ClipMask& mask = clipMasks.front();
+    mask.path = clippath;
+    mask.trans = clippath_trans;
+    mask.bounds = agg::rect_i(0, 0, -1, -1);
+    if (ras.rewind_scanlines())
+    {
+        mask.bounds = agg::rect_i(ras.min_x(), ras.min_y(),
+                                  ras.max_x(), ras.max_y());
+        mask.bounds.clip(agg::rect_i(0, 0, width - 1, height - 1));
+    }
+
+    if (mask.bounds.is_valid())
+    {
+        int mask_width = mask.bounds.x2 - mask.bounds.x1 + 1;
+        int mask_height = mask.bounds.y2 - mask.bounds.y1 + 1;
+        try
+        {
+            mask.alpha.resize((size_t)mask_width * mask_height, 0);
+        }
+        catch (...)
+        {
+            clipMasks.pop_front();
+            throw;
+        }
+
+        agg::rendering_buffer rbuf(&mask.alpha[0], mask_width, mask_height,
+                                   mask_width);
+        agg::pixfmt_gray8 pixf(rbuf);
+        renderer_base_alpha_mask_type ren(pixf);
+        agg::gray8 color(255, 255);
+
+        // This is agg::render_scanline_aa_solid with the spans moved
+        // to the origin of the cropped mask.
+        agg::scanline_u8 sl;
+        sl.reset(ras.min_x(), ras.max_x());
+        while (ras.sweep_scanline(sl))
+        {
+            int y = sl.y() - mask.bounds.y1;
+            unsigned num_spans = sl.num_spans();
+            agg::scanline_u8::const_iterator span = sl.begin();
+            for (; num_spans; --num_spans, ++span)
+            {
+                ren.blend_solid_hspan(span->x - mask.bounds.x1, y, span->len,
+                                      color, span->covers);
+            }
         }
-        rendererAlphaMask.color(agg::gray8(255, 255));
-        agg::render_scanlines(theRasterizer, scanlineAlphaMask, rendererAlphaMask);
-        lastclippath = clippath;
-        lastclippath_transform = clippath_trans;
     }
 
+    size_t bytes = 0;
+    for (entry = clipMasks.begin(); entry != clipMasks.end(); ++entry)
+    {
+        bytes += entry->alpha.size();
+    }
+    while (clipMasks.size() > 1 &&
+           (clipMasks.size() > CLIP_MASK_CACHE_ENTRIES ||
+            bytes > CLIP_MASK_CACHE_MAX_BYTES))
+    {
+        bytes -= clipMasks.back().alpha.size();
+        clipMasks.pop_back();
+    }
+
+    alphaMask.attach(mask.alpha.empty() ? NULL : &mask.alpha[0],
+                     mask.bounds);
+
     return has_clippath;
 }
 
-#define MARKER_CACHE_SIZE 512
+/*
+ A marker rasterized once into a list of coverage spans, relative to the
+ marker origin, that can then be stamped at any integer pixel position.
+ Stamping issues exactly the same span blends as replaying the
+ rasterizer's scanlines through agg::render_scanline_aa_solid, minus the
+ cost of rasterizing or deserializing the marker for every vertex.
+*/
+class MarkerStamp
+{
+public:
+    struct span
+    {
+        int x;
+        int y;
+        int len;        // negative for a solid span of -len pixels
+        size_t covers;  // offset of the first cover in covers
+    };
+
+    MarkerStamp() :
+        min_x(0x7FFFFFFF), min_y(0x7FFFFFFF),
+        max_x(-0x7FFFFFFF), max_y(-0x7FFFFFFF)
+    {
+    }
+
+    template<class Rasterizer>
+    void rasterize(Rasterizer& ras)
+    {
+        if (!ras.rewind_scanlines())
+        {
+            return;
+        }
+
+        scanline_p8 sl;
+        sl.reset(ras.min_x(), ras.max_x());
+        while (ras.sweep_scanline(sl))
+        {
+            int y = sl.y();
+            min_y = std::min(min_y, y);
+            max_y = std::max(max_y, y);
+
+            unsigned num_spans = sl.num_spans();
+            scanline_p8::const_iterator i = sl.begin();
+            for (; num_spans; --num_spans, ++i)
+            {
+                span s;
+                s.x = i->x;
+                s.y = y;
+                s.len = i->len;
+                s.covers = covers.size();
+                covers.insert(covers.end(), i->covers,
+                              i->covers + (i->len > 0 ? i->len : 1));
+                spans.push_back(s);
+
+                min_x = std::min(min_x, s.x);
+                max_x = std::max(max_x, s.x + std::abs(s.len) - 1);
+            }
+        }
+    }
+
+    template<class BaseRenderer, class ColorT>
+    void stamp(BaseRenderer& ren, int x, int y, const ColorT& color) const
+    {
+        for (std::vector<span>::const_iterator i = spans.begin();
+             i != spans.end(); ++i)
+        {
+            if (i->len > 0)
+            {
+                ren.blend_solid_hspan(x + i->x, y + i->y, i->len,
+                                      color, &covers[i->covers]);
+            }
+            else
+            {
+                ren.blend_hline(x + i->x, y + i->y, x + i->x - i->len - 1,
+                                color, covers[i->covers]);
+            }
+        }
+    }
+
+    size_t byte_size() const
+    {
+        return spans.size() * sizeof(span) + covers.size();
+    }
+
+    std::vector<span> spans;
+    std::vector<agg::int8u> covers;
+    int min_x, min_y, max_x, max_y;
+};
+
+
+/*
+ The rasterized fill and stroke of a marker, along with everything they
+ were rasterized from.  These are kept in a small most-recently-used
+ list shared by all renderers, so that drawing the same marker again
+ (the next line of a plot, the next figure of a batch) skips the
+ rasterization entirely.
+*/
+struct MarkerCacheEntry
+{
+    std::vector<double> key;
+    MarkerStamp fill;
+    MarkerStamp stroke;
+};
+
+// The number of distinct markers kept rasterized between calls
+#define MARKER_CACHE_ENTRIES 32
+
+// Markers taking more memory than this are rasterized but not kept
+#define MARKER_CACHE_MAX_BYTES (1 << 20)
+
+static std::list<MarkerCacheEntry> marker_cache;
+
+// Lookup statistics, reported by _backend_agg.cache_info()
+static unsigned long marker_cache_hits = 0;
+static unsigned long marker_cache_misses = 0;
 
 
 Py::Object
@@ -670,7 +929,6 @@ RendererAgg::draw_markers(const Py::Tuple& args)
     typedef agg::conv_stroke<curve_t>                          stroke_t;
     typedef agg::pixfmt_amask_adaptor<pixfmt, alpha_mask_type> pixfmt_amask_type;
     typedef agg::renderer_base<pixfmt_amask_type>              amask_ren_type;
-    typedef agg::renderer_scanline_aa_solid<amask_ren_type>    amask_aa_renderer_type;
     args.verify_length(5, 6);
 
     Py::Object        gc_obj          = args[0];
@@ -692,12 +950,6 @@ RendererAgg::draw_markers(const Py::Tuple& args)
     trans *= agg::trans_affine_translation(0.5, (double)height + 0.5);
 
     PathIterator       marker_path(marker_path_obj);
-    transformed_path_t marker_path_transformed(marker_path, marker_trans);
-    snap_t             marker_path_snapped(marker_path_transformed,
-                                           gc.snap_mode,
-                                           marker_path.total_vertices(),
-                                           gc.linewidth);
-    curve_t            marker_path_curve(marker_path_snapped);
 
     PathIterator path(path_obj);
     transformed_path_t path_transformed(path, trans);
@@ -710,54 +962,92 @@ RendererAgg::draw_markers(const Py::Tuple& args)
 
     facepair_t face = _get_rgba_face(face_obj, gc.alpha, gc.forced_alpha);
 
-    //maxim's suggestions for cached scanlines
-    agg::scanline_storage_aa8 scanlines;
-    theRasterizer.reset();
+    // Everything the rasterized marker depends on
+    std::vector<double> key;
+    key.reserve(marker_path.total_vertices() * 3 + 11);
+    key.push_back(face.first);
+    key.push_back(gc.linewidth);
+    key.push_back(gc.cap);
+    key.push_back(gc.join);
+    key.push_back(gc.snap_mode);
+    double m[6];
+    marker_trans.store_to(m);
+    key.insert(key.end(), m, m + 6);
+    double mx, my;
+    unsigned code;
+    marker_path.rewind(0);
+    while ((code = marker_path.vertex(&mx, &my)) != agg::path_cmd_stop)
+    {
+        key.push_back(code);
+        key.push_back(mx);
+        key.push_back(my);
+    }
+
+    std::list<MarkerCacheEntry>::iterator entry = marker_cache.begin();
+    for (; entry != marker_cache.end(); ++entry)
+    {
+        if (entry->key == key)
+        {
+            break;
+        }
+    }
+
     theRasterizer.reset_clipping();
     rendererBase.reset_clipping(true);
 
-    agg::int8u  staticFillCache[MARKER_CACHE_SIZE];
-    agg::int8u  staticStrokeCache[MARKER_CACHE_SIZE];
-    agg::int8u* fillCache = staticFillCache;
-    agg::int8u* strokeCache = staticStrokeCache;
-
-    try
+    if (entry != marker_cache.end())
+    {
+        ++marker_cache_hits;
+        marker_cache.splice(marker_cache.begin(), marker_cache, entry);
+    }
+    else
     {
-        unsigned fillSize = 0;
-        if (face.first)
+        ++marker_cache_misses;
+        marker_cache.push_front(MarkerCacheEntry());
+        MarkerCacheEntry& rasterized = marker_cache.front();
+        rasterized.key.swap(key);
+
+        transformed_path_t marker_path_transformed(marker_path, marker_trans);
+        snap_t             marker_path_snapped(marker_path_transformed,
+                                               gc.snap_mode,
+                                               marker_path.total_vertices(),
+                                               gc.linewidth);
+        curve_t            marker_path_curve(marker_path_snapped);
+
+        try
         {
-            try {
-                theRasterizer.add_path(marker_path_curve);
-            } catch (std::overflow_error &e) {
-                throw Py::OverflowError(e.what());
-            }
-            agg::render_scanlines(theRasterizer, slineP8, scanlines);
-            fillSize = scanlines.byte_size();
-            if (fillSize >= MARKER_CACHE_SIZE)
+            theRasterizer.reset();
+            if (face.first)
             {
-                fillCache = new agg::int8u[fillSize];
+                theRasterizer.add_path(marker_path_curve);
+                rasterized.fill.rasterize(theRasterizer);
             }
-            scanlines.serialize(fillCache);
-        }
 
-        stroke_t stroke(marker_path_curve);
-        stroke.width(gc.linewidth);
-        stroke.line_cap(gc.cap);
-        stroke.line_join(gc.join);
-        theRasterizer.reset();
-        try {
+            stroke_t stroke(marker_path_curve);
+            stroke.width(gc.linewidth);
+            stroke.line_cap(gc.cap);
+            stroke.line_join(gc.join);
+            theRasterizer.reset();
             theRasterizer.add_path(stroke);
-        } catch (std::overflow_error &e) {
+            rasterized.stroke.rasterize(theRasterizer);
+        }
+        catch (std::overflow_error &e)
+        {
+            marker_cache.pop_front();
             throw Py::OverflowError(e.what());
         }
-        agg::render_scanlines(theRasterizer, slineP8, scanlines);
-        unsigned strokeSize = scanlines.byte_size();
-        if (strokeSize >= MARKER_CACHE_SIZE)
+        catch (...)
         {
-            strokeCache = new agg::int8u[strokeSize];
+            marker_cache.pop_front();
+            throw;
         }
-        scanlines.serialize(strokeCache);
+    }
+
+    const MarkerStamp& fill = marker_cache.front().fill;
+    const MarkerStamp& stroke = marker_cache.front().stroke;
 
+    try
+    {
         theRasterizer.reset_clipping();
         rendererBase.reset_clipping(true);
         set_clipbox(gc.cliprect, rendererBase);
@@ -765,104 +1055,99 @@ RendererAgg::draw_markers(const Py::Tuple& args)
 
         double x, y;
 
-        agg::serialized_scanlines_adaptor_aa8 sa;
-        agg::serialized_scanlines_adaptor_aa8::embedded_scanline sl;
-
+        // As when the marker was replayed from stored scanlines, the
+        // culling rectangle is based on the extents of the stroke.
         agg::rect_d clipping_rect(
-            -(scanlines.min_x() + 1.0),
-            (scanlines.max_y() + 1.0),
-            width + scanlines.max_x() + 1.0,
-            height - scanlines.min_y() + 1.0);
+            -(stroke.min_x + 1.0),
+            (stroke.max_y + 1.0),
+            width + stroke.max_x + 1.0,
+            height - stroke.min_y + 1.0);
 
-        if (has_clippath)
+        pixfmt_amask_type pfa(pixFmt, alphaMask);
+        amask_ren_type amask_ren(pfa);
+
+        agg::rgba8 face_color(face.second);
+        agg::rgba8 stroke_color(gc.color);
+
+        // The range of the points stamped, for damage tracking
+        agg::rect_i stamped(0x7FFFFFFF, 0x7FFFFFFF, -0x7FFFFFFF, -0x7FFFFFFF);
+
+        while (path_curve.vertex(&x, &y) != agg::path_cmd_stop)
         {
-            while (path_curve.vertex(&x, &y) != agg::path_cmd_stop)
+            if (MPL_notisfinite64(x) || MPL_notisfinite64(y))
             {
-                if (MPL_notisfinite64(x) || MPL_notisfinite64(y))
-                {
-                    continue;
-                }
+                continue;
+            }
 
-                /* These values are correctly snapped above -- so we don't want
-                   to round here, we really only want to truncate */
-                x = floor(x);
-                y = floor(y);
+            /* These values are correctly snapped above -- so we don't want
+               to round here, we really only want to truncate */
+            x = floor(x);
+            y = floor(y);
 
-                // Cull points outside the boundary of the image.
-                // Values that are too large may overflow and create
-                // segfaults.
-                // http://sourceforge.net/tracker/?func=detail&aid=2865490&group_id=80706&atid=560720
-                if (!clipping_rect.hit_test(x, y))
-                {
-                    continue;
-                }
+            // Cull points outside the boundary of the image.
+            // Values that are too large may overflow and create
+            // segfaults.
+            // http://sourceforge.net/tracker/?func=detail&aid=2865490&group_id=80706&atid=560720
+            if (!clipping_rect.hit_test(x, y))
+            {
+                continue;
+            }
 
-                pixfmt_amask_type pfa(pixFmt, alphaMask);
-                amask_ren_type r(pfa);
-                amask_aa_renderer_type ren(r);
+            stamped = agg::unite_rectangles(
+                stamped, agg::rect_i((int)x, (int)y, (int)x, (int)y));
 
+            if (has_clippath)
+            {
                 if (face.first)
                 {
-                    ren.color(face.second);
-                    sa.init(fillCache, fillSize, x, y);
-                    agg::render_scanlines(sa, sl, ren);
+                    fill.stamp(amask_ren, (int)x, (int)y, face_color);
                 }
-                ren.color(gc.color);
-                sa.init(strokeCache, strokeSize, x, y);
-                agg::render_scanlines(sa, sl, ren);
+                stroke.stamp(amask_ren, (int)x, (int)y, stroke_color);
             }
-        }
-        else
-        {
-            while (path_curve.vertex(&x, &y) != agg::path_cmd_stop)
+            else
             {
-                if (MPL_notisfinite64(x) || MPL_notisfinite64(y))
-                {
-                    continue;
-                }
-
-                /* These values are correctly snapped above -- so we don't want
-                   to round here, we really only want to truncate */
-                x = floor(x);
-                y = floor(y);
-
-                // Cull points outside the boundary of the image.
-                // Values that are too large may overflow and create
-                // segfaults.
-                // http://sourceforge.net/tracker/?func=detail&aid=2865490&group_id=80706&atid=560720
-                if (!clipping_rect.hit_test(x, y))
-                {
-                    continue;
-                }
-
                 if (face.first)
                 {
-                    rendererAA.color(face.second);
-                    sa.init(fillCache, fillSize, x, y);
-                    agg::render_scanlines(sa, sl, rendererAA);
+                    fill.stamp(rendererBase, (int)x, (int)y, face_color);
                 }
+                stroke.stamp(rendererBase, (int)x, (int)y, stroke_color);
+            }
+        }
 
-                rendererAA.color(gc.color);
-                sa.init(strokeCache, strokeSize, x, y);
-                agg::render_scanlines(sa, sl, rendererAA);
+        if (stamped.is_valid())
+        {
+            agg::rect_i bounds(stroke.min_x, stroke.min_y,
+                               stroke.max_x, stroke.max_y);
+            if (face.first)
+            {
+                bounds = agg::unite_rectangles(
+                    bounds, agg::rect_i(fill.min_x, fill.min_y,
+                                        fill.max_x, fill.max_y));
+            }
+            if (bounds.is_valid())
+            {
+                add_damage(agg::rect_i(stamped.x1 + bounds.x1,
+                                       stamped.y1 + bounds.y1,
+                                       stamped.x2 + bounds.x2,
+                                       stamped.y2 + bounds.y2));
             }
         }
     }
     catch (...)
     {
-        if (fillCache != staticFillCache)
-            delete[] fillCache;
-        if (strokeCache != staticStrokeCache)
-            delete[] strokeCache;
         theRasterizer.reset_clipping();
         rendererBase.reset_clipping(true);
         throw;
     }
 
-    if (fillCache != staticFillCache)
-        delete[] fillCache;
-    if (strokeCache != staticStrokeCache)
-        delete[] strokeCache;
+    if (fill.byte_size() + stroke.byte_size() > MARKER_CACHE_MAX_BYTES)
+    {
+        marker_cache.pop_front();
+    }
+    else if (marker_cache.size() > MARKER_CACHE_ENTRIES)
+    {
+        marker_cache.pop_back();
+    }
 
     theRasterizer.reset_clipping();
     rendererBase.reset_clipping(true);
@@ -1024,6 +1309,7 @@ RendererAgg::draw_text_image(const Py::Tuple& args)
     } catch (std::overflow_error &e) {
         throw Py::OverflowError(e.what());
     }
+    add_rasterizer_damage();
     agg::render_scanlines(theRasterizer, slineP8, ri);
 
     return Py::Object();
@@ -1165,6 +1451,7 @@ RendererAgg::draw_image(const Py::Tuple& args)
             } catch (std::overflow_error &e) {
                 throw Py::OverflowError(e.what());
             }
+            add_rasterizer_damage();
             agg::render_scanlines(theRasterizer, scanlineAlphaMask, ri);
         }
         else
@@ -1183,6 +1470,7 @@ RendererAgg::draw_image(const Py::Tuple& args)
             } catch (std::overflow_error &e) {
                 throw Py::OverflowError(e.what());
             }
+            add_rasterizer_damage();
             agg::render_scanlines(theRasterizer, slineP8, ri);
         }
 
@@ -1193,6 +1481,10 @@ RendererAgg::draw_image(const Py::Tuple& args)
         rendererBase.blend_from(
             pixf, 0, (int)x, (int)(height - (y + image->rowsOut)),
             (agg::int8u)(alpha * 255));
+        add_damage(agg::intersect_rectangles(
+            agg::rect_i((int)x, (int)(height - (y + image->rowsOut)),
+                        (int)x + image->colsOut - 1, (int)(height - y) - 1),
+            rendererBase.clip_box()));
     }
 
     rendererBase.reset_clipping(true);
@@ -1202,6 +1494,144 @@ RendererAgg::draw_image(const Py::Tuple& args)
 }
 
 
+/*
+ Sweeps a horizontal band of scanlines out of a rasterizer that has
+ already been fed a path, and blends them through a renderer chain that
+ belongs to the band alone.  Since every scanline is built from the very
+ same cells as in agg::render_scanlines, and each band writes only to its
+ own rows, splitting the sweep this way gives identical output.
+*/
+template<class Renderer, class Scanline>
+class ScanlineBand
+{
+public:
+    typedef typename Renderer::base_ren_type   base_ren_type;
+    typedef typename base_ren_type::pixfmt_type pixfmt_type;
+    typedef typename Renderer::color_type      color_type;
+
+    ScanlineBand(const rasterizer& ras, const pixfmt_type& pixf,
+                 const color_type& color) :
+        m_ras(ras), m_pixf(pixf), m_color(color)
+    {
+    }
+
+    void operator()(int y1, int y2)
+    {
+        pixfmt_type pixf(m_pixf);
+        base_ren_type rb(pixf);
+        Renderer ren(rb);
+        ren.color(m_color);
+
+        Scanline sl;
+        sl.reset(m_ras.min_x(), m_ras.max_x());
+        for (int y = y1; y < y2; ++y)
+        {
+            if (m_ras.sweep_scanline(sl, y))
+            {
+                ren.render(sl);
+            }
+        }
+    }
+
+private:
+    const rasterizer& m_ras;
+    const pixfmt_type& m_pixf;
+    color_type m_color;
+};
+
+
+// The minimum number of scanlines worth handing to a thread of its own
+#define MIN_BAND_HEIGHT 64
+
+
+template<class Renderer, class Scanline>
+void RendererAgg::_render_scanlines(Scanline& sl, Renderer& ren,
+                                    typename Renderer::base_ren_type::pixfmt_type& pixf)
+{
+    add_rasterizer_damage();
+
+    if (threads > 1 && theRasterizer.rewind_scanlines())
+    {
+        int y1 = theRasterizer.min_y();
+        int y2 = theRasterizer.max_y() + 1;
+        int nbands = std::min(threads, (y2 - y1) / MIN_BAND_HEIGHT);
+        if (nbands > 1)
+        {
+            ScanlineBand<Renderer, Scanline> band(theRasterizer, pixf, ren.color());
+            mpl::parallel_for(y1, y2, nbands, band);
+            return;
+        }
+    }
+
+    agg::render_scanlines(theRasterizer, sl, ren);
+}
+
+
+/*
+ A span generator that repeats a square RGBA tile over the canvas.  It
+ produces the same colors as agg::span_pattern_rgba reading through an
+ agg::image_accessor_wrap with wrap_mode_repeat_auto_pow2, but copies
+ whole runs of a tile row at a time instead of fetching and wrapping
+ every pixel on its own.
+*/
+template<unsigned Size>
+class span_pattern_tile
+{
+public:
+    typedef agg::rgba8 color_type;
+
+    explicit span_pattern_tile(const agg::int8u* tile) :
+        m_tile(tile), m_add(Size * (0x3FFFFFFF / Size))
+    {
+    }
+
+    void prepare()
+    {
+    }
+
+    void generate(color_type* span, int x, int y, unsigned len)
+    {
+        const agg::int8u* row =
+            m_tile + ((unsigned(y) + m_add) % Size) * Size * 4;
+        unsigned col = (unsigned(x) + m_add) % Size;
+        while (len)
+        {
+            unsigned n = std::min(len, Size - col);
+            memcpy(span, row + col * 4, n * 4);
+            span += n;
+            len -= n;
+            col = 0;
+        }
+    }
+
+private:
+    const agg::int8u* m_tile;
+    unsigned m_add;
+};
+
+
+/*
+ A rendered hatch tile, along with everything it was rendered from.  As
+ with markers, these are kept in a small most-recently-used list shared
+ by all renderers, so that hatching many paths the same way only draws
+ the tile once.
+*/
+struct HatchCacheEntry
+{
+    std::vector<double> key;
+    std::vector<agg::int8u> tile;
+};
+
+// The number of distinct hatch tiles kept rendered between calls
+#define HATCH_CACHE_ENTRIES 16
+
+static std::list<HatchCacheEntry> hatch_cache;
+
+// Lookup statistics, reported by _backend_agg.cache_info()
+static unsigned long hatch_cache_hits = 0;
+static unsigned long hatch_cache_misses = 0;
+
+
 template<class path_t>
 void RendererAgg::_draw_path(path_t& path, bool has_clippath,
                              const facepair_t& face, const GCAgg& gc)
@@ -1231,12 +1661,12 @@ void RendererAgg::_draw_path(path_t& path, bool has_clippath,
                 amask_ren_type r(pfa);
                 amask_aa_renderer_type ren(r);
                 ren.color(face.second);
-                agg::render_scanlines(theRasterizer, scanlineAlphaMask, ren);
+                _render_scanlines(scanlineAlphaMask, ren, pfa);
             }
             else
             {
                 rendererAA.color(face.second);
-                agg::render_scanlines(theRasterizer, slineP8, rendererAA);
+                _render_scanlines(slineP8, rendererAA, pixFmt);
             }
         }
         else
@@ -1247,12 +1677,12 @@ void RendererAgg::_draw_path(path_t& path, bool has_clippath,
                 amask_ren_type r(pfa);
                 amask_bin_renderer_type ren(r);
                 ren.color(face.second);
-                agg::render_scanlines(theRasterizer, scanlineAlphaMask, ren);
+                _render_scanlines(scanlineAlphaMask, ren, pfa);
             }
             else
             {
                 rendererBin.color(face.second);
-                agg::render_scanlines(theRasterizer, slineP8, rendererBin);
+                _render_scanlines(slineP8, rendererBin, pixFmt);
             }
         }
     }
@@ -1265,41 +1695,88 @@ void RendererAgg::_draw_path(path_t& path, bool has_clippath,
         theRasterizer.reset_clipping();
         rendererBase.reset_clipping(true);
 
-        // Create and transform the path
-        typedef agg::conv_transform<PathIterator> hatch_path_trans_t;
-        typedef agg::conv_curve<hatch_path_trans_t> hatch_path_curve_t;
-        typedef agg::conv_stroke<hatch_path_curve_t> hatch_path_stroke_t;
-
+        // Everything the hatch tile depends on
         PathIterator hatch_path(gc.hatchpath);
-        agg::trans_affine hatch_trans;
-        hatch_trans *= agg::trans_affine_scaling(1.0, -1.0);
-        hatch_trans *= agg::trans_affine_translation(0.0, 1.0);
-        hatch_trans *= agg::trans_affine_scaling(HATCH_SIZE, HATCH_SIZE);
-        hatch_path_trans_t hatch_path_trans(hatch_path, hatch_trans);
-        hatch_path_curve_t hatch_path_curve(hatch_path_trans);
-        hatch_path_stroke_t hatch_path_stroke(hatch_path_curve);
-        hatch_path_stroke.width(1.0);
-        hatch_path_stroke.line_cap(agg::square_cap);
-
-        // Render the path into the hatch buffer
-        pixfmt hatch_img_pixf(hatchRenderingBuffer);
-        renderer_base rb(hatch_img_pixf);
-        renderer_aa rs(rb);
-        rb.clear(_fill_color);
-        rs.color(gc.color);
+        std::vector<double> key;
+        key.reserve(hatch_path.total_vertices() * 3 + 8);
+        key.push_back(gc.color.r);
+        key.push_back(gc.color.g);
+        key.push_back(gc.color.b);
+        key.push_back(gc.color.a);
+        key.push_back(_fill_color.r);
+        key.push_back(_fill_color.g);
+        key.push_back(_fill_color.b);
+        key.push_back(_fill_color.a);
+        double hx, hy;
+        unsigned code;
+        hatch_path.rewind(0);
+        while ((code = hatch_path.vertex(&hx, &hy)) != agg::path_cmd_stop)
+        {
+            key.push_back(code);
+            key.push_back(hx);
+            key.push_back(hy);
+        }
 
-        try {
-            theRasterizer.add_path(hatch_path_curve);
-        } catch (std::overflow_error &e) {
-            throw Py::OverflowError(e.what());
+        std::list<HatchCacheEntry>::iterator entry = hatch_cache.begin();
+        for (; entry != hatch_cache.end(); ++entry)
+        {
+            if (entry->key == key)
+            {
+                break;
+            }
         }
-        agg::render_scanlines(theRasterizer, slineP8, rs);
-        try {
-            theRasterizer.add_path(hatch_path_stroke);
-        } catch (std::overflow_error &e) {
-            throw Py::OverflowError(e.what());
+
+        if (entry != hatch_cache.end())
+        {
+            ++hatch_cache_hits;
+            hatch_cache.splice(hatch_cache.begin(), hatch_cache, entry);
+        }
+        else
+        {
+            ++hatch_cache_misses;
+            hatch_cache.push_front(HatchCacheEntry());
+            HatchCacheEntry& rendered = hatch_cache.front();
+            rendered.key.swap(key);
+            rendered.tile.resize(HATCH_SIZE * HATCH_SIZE * 4);
+            if (hatch_cache.size() > HATCH_CACHE_ENTRIES)
+            {
+                hatch_cache.pop_back();
+            }
+
+            // Create and transform the path
+            typedef agg::conv_transform<PathIterator> hatch_path_trans_t;
+            typedef agg::conv_curve<hatch_path_trans_t> hatch_path_curve_t;
+            typedef agg::conv_stroke<hatch_path_curve_t> hatch_path_stroke_t;
+
+            agg::trans_affine hatch_trans;
+            hatch_trans *= agg::trans_affine_scaling(1.0, -1.0);
+            hatch_trans *= agg::trans_affine_translation(0.0, 1.0);
+            hatch_trans *= agg::trans_affine_scaling(HATCH_SIZE, HATCH_SIZE);
+            hatch_path_trans_t hatch_path_trans(hatch_path, hatch_trans);
+            hatch_path_curve_t hatch_path_curve(hatch_path_trans);
+            hatch_path_stroke_t hatch_path_stroke(hatch_path_curve);
+            hatch_path_stroke.width(1.0);
+            hatch_path_stroke.line_cap(agg::square_cap);
+
+            // Render the path into the hatch tile
+            agg::rendering_buffer hatch_rbuf(&rendered.tile[0], HATCH_SIZE,
+                                             HATCH_SIZE, HATCH_SIZE * 4);
+            pixfmt hatch_img_pixf(hatch_rbuf);
+            renderer_base rb(hatch_img_pixf);
+            renderer_aa rs(rb);
+            rb.clear(_fill_color);
+            rs.color(gc.color);
+
+            try {
+                theRasterizer.add_path(hatch_path_curve);
+                agg::render_scanlines(theRasterizer, slineP8, rs);
+                theRasterizer.add_path(hatch_path_stroke);
+                agg::render_scanlines(theRasterizer, slineP8, rs);
+            } catch (std::overflow_error &e) {
+                hatch_cache.pop_front();
+                throw Py::OverflowError(e.what());
+            }
         }
-        agg::render_scanlines(theRasterizer, slineP8, rs);
 
         // Put clipping back on, if originally set on entry to this
         // function
@@ -1308,19 +1785,16 @@ void RendererAgg::_draw_path(path_t& path, bool has_clippath,
             render_clippath(gc.clippath, gc.clippath_trans);
 
         // Transfer the hatch to the main image buffer
-        typedef agg::image_accessor_wrap < pixfmt,
-        agg::wrap_mode_repeat_auto_pow2,
-        agg::wrap_mode_repeat_auto_pow2 > img_source_type;
-        typedef agg::span_pattern_rgba<img_source_type> span_gen_type;
+        typedef span_pattern_tile<HATCH_SIZE> span_gen_type;
         agg::span_allocator<agg::rgba8> sa;
-        img_source_type img_src(hatch_img_pixf);
-        span_gen_type sg(img_src, 0, 0);
+        span_gen_type sg(&hatch_cache.front().tile[0]);
         try {
             theRasterizer.add_path(path);
         } catch (std::overflow_error &e) {
             throw Py::OverflowError(e.what());
         }
 
+        add_rasterizer_damage();
         if (has_clippath)
         {
            pixfmt_amask_type pfa(pixFmt, alphaMask);
@@ -1387,12 +1861,12 @@ void RendererAgg::_draw_path(path_t& path, bool has_clippath,
                 amask_ren_type r(pfa);
                 amask_aa_renderer_type ren(r);
                 ren.color(gc.color);
-                agg::render_scanlines(theRasterizer, scanlineAlphaMask, ren);
+                _render_scanlines(scanlineAlphaMask, ren, pfa);
             }
             else
             {
                 rendererAA.color(gc.color);
-                agg::render_scanlines(theRasterizer, slineP8, rendererAA);
+                _render_scanlines(slineP8, rendererAA, pixFmt);
             }
         }
         else
@@ -1403,28 +1877,48 @@ void RendererAgg::_draw_path(path_t& path, bool has_clippath,
                 amask_ren_type r(pfa);
                 amask_bin_renderer_type ren(r);
                 ren.color(gc.color);
-                agg::render_scanlines(theRasterizer, scanlineAlphaMask, ren);
+                _render_scanlines(scanlineAlphaMask, ren, pfa);
             }
             else
             {
                 rendererBin.color(gc.color);
-                agg::render_scanlines(theRasterizer, slineBin, rendererBin);
+                _render_scanlines(slineBin, rendererBin, pixFmt);
             }
         }
     }
 }
 
 
+template<class FrontEnd>
+void
+RendererAgg::_draw_path_stages(FrontEnd& front, PathIterator& path,
+                               bool clip, bool simplify,
+                               double snapping_linewidth, bool has_clippath,
+                               const facepair_t& face, const GCAgg& gc)
+{
+    typedef PathClipper<FrontEnd>              clipped_t;
+    typedef PathSnapper<clipped_t>             snapped_t;
+    typedef PathColumnDecimator<snapped_t>     decimated_t;
+    typedef PathSimplifier<decimated_t>        simplify_t;
+    typedef agg::conv_curve<simplify_t>        curve_t;
+    typedef Sketch<curve_t>                    sketch_t;
+
+    clipped_t          clipped(front, clip, width, height);
+    snapped_t          snapped(clipped, gc.snap_mode, path.total_vertices(), snapping_linewidth);
+    decimated_t        decimated(snapped, simplify && path.should_decimate());
+    simplify_t         simplified(decimated, simplify, path.simplify_threshold());
+    curve_t            curve(simplified);
+    sketch_t           sketch(curve, gc.sketch_scale, gc.sketch_length, gc.sketch_randomness);
+
+    _draw_path(sketch, has_clippath, face, gc);
+}
+
 Py::Object
 RendererAgg::draw_path(const Py::Tuple& args)
 {
     typedef agg::conv_transform<PathIterator>  transformed_path_t;
     typedef PathNanRemover<transformed_path_t> nan_removed_t;
-    typedef PathClipper<nan_removed_t>         clipped_t;
-    typedef PathSnapper<clipped_t>             snapped_t;
-    typedef PathSimplifier<snapped_t>          simplify_t;
-    typedef agg::conv_curve<simplify_t>        curve_t;
-    typedef Sketch<curve_t>                    sketch_t;
+    typedef PathBlockTransformer<PathIterator> block_transformed_t;
 
     _VERBOSE("RendererAgg::draw_path");
     args.verify_length(3, 4);
@@ -1452,17 +1946,21 @@ RendererAgg::draw_path(const Py::Tuple& args)
         snapping_linewidth = 0.0;
     }
 
-    transformed_path_t tpath(path, trans);
-    nan_removed_t      nan_removed(tpath, true, path.has_curves());
-    clipped_t          clipped(nan_removed, clip, width, height);
-    snapped_t          snapped(clipped, gc.snap_mode, path.total_vertices(), snapping_linewidth);
-    simplify_t         simplified(snapped, simplify, path.simplify_threshold());
-    curve_t            curve(simplified);
-    sketch_t           sketch(curve, gc.sketch_scale, gc.sketch_length, gc.sketch_randomness);
-
     try
     {
-        _draw_path(sketch, has_clippath, face, gc);
+        if (!path.has_curves())
+        {
+            block_transformed_t front(path, trans, true);
+            _draw_path_stages(front, path, clip, simplify, snapping_linewidth,
+                              has_clippath, face, gc);
+        }
+        else
+        {
+            transformed_path_t tpath(path, trans);
+            nan_removed_t      front(tpath, true, path.has_curves());
+            _draw_path_stages(front, path, clip, simplify, snapping_linewidth,
+                              has_clippath, face, gc);
+        }
     }
     catch (const char* e)
     {
@@ -1487,9 +1985,9 @@ RendererAgg::_draw_path_collection_generic
  const agg::trans_affine&       offset_trans,
  const Py::Object&              facecolors_obj,
  const Py::Object&              edgecolors_obj,
- const Py::SeqBase<Py::Float>&  linewidths,
+ const Py::Object&              linewidths_obj,
  const Py::SeqBase<Py::Object>& linestyles_obj,
- const Py::SeqBase<Py::Int>&    antialiaseds,
+ const Py::Object&              antialiaseds_obj,
  const bool                     data_offsets)
 {
     typedef agg::conv_transform<typename PathGenerator::path_iterator> transformed_path_t;
@@ -1545,15 +2043,35 @@ RendererAgg::_draw_path_collection_generic
         throw Py::ValueError("Transforms must be a Nx3x3 numpy array");
     }
 
+    PyArrayObject* linewidths = (PyArrayObject*)PyArray_ContiguousFromObject
+        (linewidths_obj.ptr(), PyArray_DOUBLE, 1, 1);
+    if (!linewidths)
+    {
+        Py_XDECREF(transforms_arr);
+        throw Py::ValueError("Linewidths must be a 1D sequence");
+    }
+    Py::Object linewidths_arr_obj((PyObject*)linewidths, true);
+
+    PyArrayObject* antialiaseds = (PyArrayObject*)PyArray_ContiguousFromObject
+        (antialiaseds_obj.ptr(), PyArray_DOUBLE, 1, 1);
+    if (!antialiaseds)
+    {
+        Py_XDECREF(transforms_arr);
+        throw Py::ValueError("Antialiaseds must be a 1D sequence");
+    }
+    Py::Object antialiaseds_arr_obj((PyObject*)antialiaseds, true);
+
     size_t Npaths      = path_generator.num_paths();
     size_t Noffsets    = offsets->dimensions[0];
     size_t N           = std::max(Npaths, Noffsets);
     size_t Ntransforms = transforms_arr->dimensions[0];
     size_t Nfacecolors = facecolors->dimensions[0];
     size_t Nedgecolors = edgecolors->dimensions[0];
-    size_t Nlinewidths = linewidths.length();
+    size_t Nlinewidths = PyArray_DIM(linewidths, 0);
     size_t Nlinestyles = std::min(linestyles_obj.length(), N);
-    size_t Naa         = antialiaseds.length();
+    size_t Naa         = PyArray_DIM(antialiaseds, 0);
+    const double* linewidths_data   = (const double*)PyArray_DATA(linewidths);
+    const double* antialiaseds_data = (const double*)PyArray_DATA(antialiaseds);
 
     if ((Nfacecolors == 0 && Nedgecolors == 0) || Npaths == 0)
     {
@@ -1606,6 +2124,10 @@ RendererAgg::_draw_path_collection_generic
     face.first = Nfacecolors != 0;
     agg::trans_affine trans;
 
+    // Items sharing a dash pattern with the previous one keep the
+    // pattern already in gc rather than copying it again
+    size_t last_dash = Nlinestyles;
+
     for (i = 0; i < N; ++i)
     {
         typename PathGenerator::path_iterator path = path_generator(i);
@@ -1656,25 +2178,29 @@ RendererAgg::_draw_path_collection_generic
 
             if (Nlinewidths)
             {
-                gc.linewidth = double(Py::Float(linewidths[i % Nlinewidths])) * dpi / 72.0;
+                gc.linewidth = linewidths_data[i % Nlinewidths] * dpi / 72.0;
             }
             else
             {
                 gc.linewidth = 1.0;
             }
-            if (Nlinestyles)
+            if (Nlinestyles && i % Nlinestyles != last_dash)
             {
-                gc.dashes = dashes[i % Nlinestyles].second;
-                gc.dashOffset = dashes[i % Nlinestyles].first;
+                last_dash = i % Nlinestyles;
+                gc.dashes = dashes[last_dash].second;
+                gc.dashOffset = dashes[last_dash].first;
             }
         }
 
+        if (Naa)
+        {
+            gc.isaa = antialiaseds_data[i % Naa] != 0.0;
+        }
+
         bool do_clip = !face.first && gc.hatchpath.isNone() && !has_curves;
 
         if (check_snap)
         {
-            gc.isaa = Py::Boolean(antialiaseds[i % Naa]);
-
             transformed_path_t tpath(path, trans);
             nan_removed_t      nan_removed(tpath, true, has_curves);
             clipped_t          clipped(nan_removed, do_clip, width, height);
@@ -1692,8 +2218,6 @@ RendererAgg::_draw_path_collection_generic
         }
         else
         {
-            gc.isaa = Py::Boolean(antialiaseds[i % Naa]);
-
             transformed_path_t tpath(path, trans);
             nan_removed_t      nan_removed(tpath, true, has_curves);
             clipped_t          clipped(nan_removed, do_clip, width, height);
@@ -1717,29 +2241,34 @@ RendererAgg::_draw_path_collection_generic
 
 class PathListGenerator
 {
-    const Py::SeqBase<Py::Object>& m_paths;
-    size_t m_npaths;
+    // Each path is converted once up front, since a collection
+    // usually repeats a few paths (or a single one) over many items
+    std::vector<PathIterator> m_paths;
 
 public:
     typedef PathIterator path_iterator;
 
     inline
-    PathListGenerator(const Py::SeqBase<Py::Object>& paths) :
-        m_paths(paths), m_npaths(paths.size())
+    PathListGenerator(const Py::SeqBase<Py::Object>& paths)
     {
-
+        size_t npaths = paths.size();
+        m_paths.reserve(npaths);
+        for (size_t i = 0; i < npaths; ++i)
+        {
+            m_paths.push_back(PathIterator(paths[i]));
+        }
     }
 
     inline size_t
     num_paths() const
     {
-        return m_npaths;
+        return m_paths.size();
     }
 
     inline path_iterator
     operator()(size_t i) const
     {
-        return PathIterator(m_paths[i % m_npaths]);
+        return m_paths[i % m_paths.size()];
     }
 };
 
@@ -1760,9 +2289,9 @@ RendererAgg::draw_path_collection(const Py::Tuple& args)
     agg::trans_affine       offset_trans     = py_to_agg_transformation_matrix(args[5].ptr());
     Py::Object              facecolors_obj   = args[6];
     Py::Object              edgecolors_obj   = args[7];
-    Py::SeqBase<Py::Float>  linewidths       = args[8];
+    Py::Object              linewidths       = args[8];
     Py::SeqBase<Py::Object> linestyles_obj   = args[9];
-    Py::SeqBase<Py::Int>    antialiaseds     = args[10];
+    Py::Object              antialiaseds     = args[10];
     // We don't actually care about urls for Agg, so just ignore it.
     // Py::SeqBase<Py::Object> urls             = args[11];
     std::string             offset_position  = Py::String(args[12]).encode("utf-8");
@@ -1896,6 +2425,294 @@ public:
     }
 };
 
+/*
+ Draws a mesh whose quads, once transformed, are axis-aligned rectangles
+ sharing their column and row boundaries, without going through a path
+ and a rasterizer pass per quad.  The coverage of a rectangle is worked
+ out exactly as rasterizer_scanline_aa does it for the two vertical edges
+ of the quad (the horizontal ones contribute no cells), in the same
+ fixed-point arithmetic and after the same clipping, and the resulting
+ spans are blended quad by quad in the same order as the generic
+ collection code.  The output is therefore identical.
+
+ Returns false, having drawn nothing, if the mesh is not rectilinear or
+ the collection uses a feature this does not handle (edges, hatching,
+ per-quad offsets, non-finite coordinates), in which case the caller
+ falls back to the generic path.
+*/
+bool
+RendererAgg::_draw_quad_mesh_rectilinear(
+    const GCAgg& gc, agg::trans_affine master_transform,
+    size_t mesh_width, size_t mesh_height,
+    const Py::Object& coordinates_obj, const Py::Object& offsets_obj,
+    const agg::trans_affine& offset_trans,
+    const Py::Object& facecolors_obj, bool antialiased,
+    const Py::Object& edgecolors_obj)
+{
+    typedef agg::pixfmt_amask_adaptor<pixfmt, alpha_mask_type> pixfmt_amask_type;
+    typedef agg::renderer_base<pixfmt_amask_type>              amask_ren_type;
+
+    if (!gc.hatchpath.isNone() || mesh_width == 0 || mesh_height == 0)
+    {
+        return false;
+    }
+
+    PyArrayObject* edgecolors = (PyArrayObject*)PyArray_FromObject
+        (edgecolors_obj.ptr(), PyArray_DOUBLE, 1, 2);
+    if (!edgecolors)
+    {
+        PyErr_Clear();
+        return false;
+    }
+    bool has_edges = PyArray_DIM(edgecolors, 0) != 0;
+    Py_DECREF(edgecolors);
+    if (has_edges && gc.linewidth != 0.0)
+    {
+        return false;
+    }
+
+    PyArrayObject* offsets = (PyArrayObject*)PyArray_FromObject
+        (offsets_obj.ptr(), PyArray_DOUBLE, 0, 2);
+    if (!offsets)
+    {
+        PyErr_Clear();
+        return false;
+    }
+    Py::Object offsets_arr_obj((PyObject*)offsets, true);
+    if (PyArray_NDIM(offsets) != 2 || PyArray_DIM(offsets, 0) > 1 ||
+        PyArray_DIM(offsets, 1) != 2)
+    {
+        return false;
+    }
+
+    PyArrayObject* facecolors = (PyArrayObject*)PyArray_FromObject
+        (facecolors_obj.ptr(), PyArray_DOUBLE, 2, 2);
+    if (!facecolors)
+    {
+        PyErr_Clear();
+        return false;
+    }
+    Py::Object facecolors_arr_obj((PyObject*)facecolors, true);
+    size_t Nfacecolors = PyArray_DIM(facecolors, 0);
+    if (Nfacecolors == 0 || PyArray_DIM(facecolors, 1) != 4)
+    {
+        return false;
+    }
+
+    PyArrayObject* coordinates = (PyArrayObject*)PyArray_ContiguousFromObject
+        (coordinates_obj.ptr(), PyArray_DOUBLE, 3, 3);
+    if (!coordinates)
+    {
+        PyErr_Clear();
+        return false;
+    }
+    Py::Object coordinates_arr_obj((PyObject*)coordinates, true);
+    if ((size_t)PyArray_DIM(coordinates, 0) != mesh_height + 1 ||
+        (size_t)PyArray_DIM(coordinates, 1) != mesh_width + 1 ||
+        PyArray_DIM(coordinates, 2) != 2)
+    {
+        return false;
+    }
+
+    // Build the transform the way _draw_path_collection_generic does
+    agg::trans_affine trans = master_transform;
+    if (PyArray_DIM(offsets, 0))
+    {
+        double xo = *(double*)PyArray_GETPTR2(offsets, 0, 0);
+        double yo = *(double*)PyArray_GETPTR2(offsets, 0, 1);
+        offset_trans.transform(&xo, &yo);
+        trans *= agg::trans_affine_translation(xo, yo);
+    }
+    trans *= agg::trans_affine_scaling(1.0, -1.0);
+    trans *= agg::trans_affine_translation(0.0, (double)height);
+
+    // Transform every vertex, checking that the mesh is rectilinear
+    std::vector<double> xs(mesh_width + 1);
+    std::vector<double> ys(mesh_height + 1);
+    const double* coords = (const double*)PyArray_DATA(coordinates);
+    for (size_t n = 0; n <= mesh_height; ++n)
+    {
+        for (size_t m = 0; m <= mesh_width; ++m)
+        {
+            double x = *coords++;
+            double y = *coords++;
+            trans.transform(&x, &y);
+            if (MPL_notisfinite64(x) || MPL_notisfinite64(y))
+            {
+                return false;
+            }
+            if (n == 0)
+            {
+                xs[m] = x;
+            }
+            else if (x != xs[m])
+            {
+                return false;
+            }
+            if (m == 0)
+            {
+                ys[n] = y;
+            }
+            else if (y != ys[n])
+            {
+                return false;
+            }
+        }
+    }
+
+    theRasterizer.reset_clipping();
+    rendererBase.reset_clipping(true);
+    set_clipbox(gc.cliprect, theRasterizer);
+    bool has_clippath = render_clippath(gc.clippath, gc.clippath_trans);
+
+    // Clip to the clip box and convert to subpixel coordinates, as
+    // rasterizer_sl_clip_dbl does with vertical edges
+    agg::rect_i clipbox = get_clipbox(gc.cliprect);
+    clipbox.normalize();
+    std::vector<int> sxs(mesh_width + 1);
+    std::vector<int> sys(mesh_height + 1);
+    for (size_t m = 0; m <= mesh_width; ++m)
+    {
+        double x = CLAMP(xs[m], (double)clipbox.x1, (double)clipbox.x2);
+        sxs[m] = agg::iround(x * agg::poly_subpixel_scale);
+    }
+    for (size_t n = 0; n <= mesh_height; ++n)
+    {
+        double y = CLAMP(ys[n], (double)clipbox.y1, (double)clipbox.y2);
+        sys[n] = agg::iround(y * agg::poly_subpixel_scale);
+    }
+
+    if (damage_tracking)
+    {
+        add_damage(agg::rect_i(
+            *std::min_element(sxs.begin(), sxs.end()) >> agg::poly_subpixel_shift,
+            *std::min_element(sys.begin(), sys.end()) >> agg::poly_subpixel_shift,
+            *std::max_element(sxs.begin(), sxs.end()) >> agg::poly_subpixel_shift,
+            *std::max_element(sys.begin(), sys.end()) >> agg::poly_subpixel_shift));
+    }
+
+    pixfmt_amask_type pfa(pixFmt, alphaMask);
+    amask_ren_type amask_ren(pfa);
+
+    const int shift = agg::poly_subpixel_shift;
+    const int mask = agg::poly_subpixel_mask;
+    agg::int8u cover;
+    std::vector<agg::int8u> covers;
+
+    for (size_t n = 0; n < mesh_height; ++n)
+    {
+        // The left edge of each quad runs from row n to row n + 1, the
+        // right edge back again
+        int y1 = std::min(sys[n], sys[n + 1]);
+        int y2 = std::max(sys[n], sys[n + 1]);
+        int sign = (sys[n + 1] > sys[n]) ? 1 : -1;
+
+        for (int ey = y1 >> shift; y2 > y1 && ey <= (y2 - 1) >> shift; ++ey)
+        {
+            int delta = sign * (std::min(y2, (ey + 1) << shift) -
+                                std::max(y1, ey << shift));
+
+            for (size_t m = 0; m < mesh_width; ++m)
+            {
+                size_t fi = (n * mesh_width + m) % Nfacecolors;
+                agg::rgba8 color(agg::rgba(
+                    *(double*)PyArray_GETPTR2(facecolors, fi, 0),
+                    *(double*)PyArray_GETPTR2(facecolors, fi, 1),
+                    *(double*)PyArray_GETPTR2(facecolors, fi, 2),
+                    *(double*)PyArray_GETPTR2(facecolors, fi, 3)));
+
+                // The two cells of the quad on this scanline, left first
+                int xl = sxs[m];
+                int xr = sxs[m + 1];
+                int cover_l = delta;
+                if (xr < xl)
+                {
+                    std::swap(xl, xr);
+                    cover_l = -delta;
+                }
+                int exl = xl >> shift;
+                int exr = xr >> shift;
+                int area_l = ((xl & mask) << 1) * cover_l;
+                int area_r = -((xr & mask) << 1) * cover_l;
+
+                // Sweep the cells as rasterizer_scanline_aa does
+                int x = exl;
+                unsigned cell_l = 0, span = 0, cell_r = 0;
+                if (exl == exr)
+                {
+                    if (area_l + area_r)
+                    {
+                        cell_l = theRasterizer.calculate_alpha(-(area_l + area_r));
+                    }
+                }
+                else
+                {
+                    if (area_l)
+                    {
+                        cell_l = theRasterizer.calculate_alpha(
+                            (cover_l << (shift + 1)) - area_l);
+                        ++x;
+                    }
+                    span = theRasterizer.calculate_alpha(cover_l << (shift + 1));
+                    if (area_r)
+                    {
+                        cell_r = theRasterizer.calculate_alpha(-area_r);
+                    }
+                }
+
+                if (!antialiased)
+                {
+                    cell_l = cell_l ? agg::cover_full : 0;
+                    span = span ? agg::cover_full : 0;
+                    cell_r = cell_r ? agg::cover_full : 0;
+                }
+
+                if (has_clippath)
+                {
+                    if (cell_l)
+                    {
+                        cover = cell_l;
+                        amask_ren.blend_solid_hspan(exl, ey, 1, color, &cover);
+                    }
+                    if (span && exr > x)
+                    {
+                        // The adaptor's blend_hline drops the cover, so
+                        // pass it per pixel
+                        covers.assign(exr - x, (agg::int8u)span);
+                        amask_ren.blend_solid_hspan(x, ey, exr - x, color,
+                                                    &covers[0]);
+                    }
+                    if (cell_r)
+                    {
+                        cover = cell_r;
+                        amask_ren.blend_solid_hspan(exr, ey, 1, color, &cover);
+                    }
+                }
+                else
+                {
+                    if (cell_l)
+                    {
+                        cover = cell_l;
+                        rendererBase.blend_solid_hspan(exl, ey, 1, color, &cover);
+                    }
+                    if (span && exr > x)
+                    {
+                        rendererBase.blend_hline(x, ey, exr - 1, color, span);
+                    }
+                    if (cell_r)
+                    {
+                        cover = cell_r;
+                        rendererBase.blend_solid_hspan(exr, ey, 1, color, &cover);
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+
 Py::Object
 RendererAgg::draw_quad_mesh(const Py::Tuple& args)
 {
@@ -1935,6 +2752,14 @@ RendererAgg::draw_quad_mesh(const Py::Tuple& args)
         }
     }
 
+    if (_draw_quad_mesh_rectilinear(gc, master_transform,
+                                    mesh_width, mesh_height, coordinates,
+                                    offsets_obj, offset_trans, facecolors_obj,
+                                    antialiased, edgecolors_obj))
+    {
+        return Py::Object();
+    }
+
     try
     {
         _draw_path_collection_generic<QuadMeshGenerator, 0, 0>
@@ -2004,6 +2829,7 @@ RendererAgg::_draw_gouraud_triangle(const double* points,
                                 );
     }
 
+    add_rasterizer_damage();
     if (has_clippath)
     {
         typedef agg::pixfmt_amask_adaptor<pixfmt, alpha_mask_type> pixfmt_amask_type;
@@ -2023,6 +2849,219 @@ RendererAgg::_draw_gouraud_triangle(const double* points,
 }
 
 
+/*
+ Draws a run of Gouraud-shaded triangles in horizontal bands of the
+ canvas, each band with a rasterizer and renderer chain of its own.
+ Every band goes over all of the triangles in order, but only
+ rasterizes the ones whose rows reach into it, and only sweeps its own
+ rows.  Each triangle is rasterized from the same vertices and clip box
+ as when drawing them one at a time, so every pixel gets exactly the
+ same blends in the same order, and the output is identical.
+*/
+template<class PixFmt, class Scanline>
+class GouraudBands
+{
+public:
+    typedef agg::rgba8                                       color_t;
+    typedef agg::span_gouraud_rgba<color_t>                  span_gen_t;
+    typedef agg::span_allocator<color_t>                     span_alloc_t;
+    typedef agg::renderer_base<PixFmt>                       ren_base_t;
+    typedef agg::renderer_scanline_aa<ren_base_t, span_alloc_t, span_gen_t>
+        renderer_t;
+
+    GouraudBands(const PixFmt& pixf,
+                 const std::vector<double>& points,
+                 const std::vector<double>& colors,
+                 const std::vector<int>& rows,
+                 const agg::rect_i& clipbox,
+                 int y1, int y2, int nbands,
+                 std::vector<char>& failed) :
+        m_pixf(pixf), m_points(points), m_colors(colors), m_rows(rows),
+        m_clipbox(clipbox), m_y1(y1), m_y2(y2), m_nbands(nbands),
+        m_failed(failed)
+    {
+    }
+
+    void operator()(int band1, int band2)
+    {
+        for (int band = band1; band < band2; ++band)
+        {
+            int y1 = m_y1 + (int)(((long long)(m_y2 - m_y1) * band) / m_nbands);
+            int y2 = m_y1 + (int)(((long long)(m_y2 - m_y1) * (band + 1)) / m_nbands);
+            try
+            {
+                render_band(y1, y2);
+            }
+            catch (...)
+            {
+                m_failed[band] = 1;
+            }
+        }
+    }
+
+private:
+    void render_band(int y1, int y2)
+    {
+        PixFmt pixf(m_pixf);
+        ren_base_t rb(pixf);
+        span_alloc_t span_alloc;
+        span_gen_t span_gen;
+        renderer_t ren(rb, span_alloc, span_gen);
+
+        rasterizer ras;
+        ras.clip_box(m_clipbox.x1, m_clipbox.y1, m_clipbox.x2, m_clipbox.y2);
+        Scanline sl;
+
+        size_t n = m_rows.size() / 2;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (m_rows[i * 2 + 1] < y1 || m_rows[i * 2] >= y2)
+            {
+                continue;
+            }
+
+            const double* p = &m_points[i * 6];
+            const double* c = &m_colors[i * 12];
+            span_gen.colors(agg::rgba(c[0], c[1], c[2], c[3]),
+                            agg::rgba(c[4], c[5], c[6], c[7]),
+                            agg::rgba(c[8], c[9], c[10], c[11]));
+            span_gen.triangle(p[0], p[1], p[2], p[3], p[4], p[5], 0.5);
+
+            ras.reset();
+            ras.add_path(span_gen);
+            if (!ras.rewind_scanlines())
+            {
+                continue;
+            }
+            ren.prepare();
+            sl.reset(ras.min_x(), ras.max_x());
+            int last = std::min(y2 - 1, ras.max_y());
+            for (int y = std::max(y1, ras.min_y()); y <= last; ++y)
+            {
+                if (ras.sweep_scanline(sl, y))
+                {
+                    ren.render(sl);
+                }
+            }
+        }
+    }
+
+    const PixFmt& m_pixf;
+    const std::vector<double>& m_points;
+    const std::vector<double>& m_colors;
+    const std::vector<int>& m_rows;
+    agg::rect_i m_clipbox;
+    int m_y1;
+    int m_y2;
+    int m_nbands;
+    std::vector<char>& m_failed;
+};
+
+
+// The fewest triangles worth spreading over several threads
+#define MIN_THREADED_TRIANGLES 256
+
+
+bool
+RendererAgg::_draw_gouraud_triangles_threaded(
+    std::vector<double>& points, const std::vector<double>& colors,
+    agg::trans_affine trans, const agg::rect_i& clipbox, bool has_clippath)
+{
+    typedef agg::rgba8                      color_t;
+    typedef agg::span_gouraud_rgba<color_t> span_gen_t;
+
+    size_t n = colors.size() / 12;
+    if (threads <= 1 || n < MIN_THREADED_TRIANGLES)
+    {
+        return false;
+    }
+
+    trans *= agg::trans_affine_scaling(1.0, -1.0);
+    trans *= agg::trans_affine_translation(0.0, (double)height);
+
+    // The rows each (dilated) triangle may cover, with a pixel to spare
+    // on either side for rounding to subpixels
+    std::vector<int> rows(n * 2);
+    agg::rect_d extents(1e300, 1e300, -1e300, -1e300);
+    span_gen_t span_gen;
+    for (size_t i = 0; i < n; ++i)
+    {
+        double* p = &points[i * 6];
+        for (int j = 0; j < 6; j += 2)
+        {
+            trans.transform(&p[j], &p[j + 1]);
+        }
+        span_gen.triangle(p[0], p[1], p[2], p[3], p[4], p[5], 0.5);
+
+        double x, y;
+        double y1 = 1e300, y2 = -1e300;
+        unsigned code;
+        span_gen.rewind(0);
+        while (!agg::is_stop(code = span_gen.vertex(&x, &y)))
+        {
+            if (MPL_notisfinite64(x) || MPL_notisfinite64(y))
+            {
+                y1 = -1e300;
+                y2 = 1e300;
+                break;
+            }
+            y1 = std::min(y1, y);
+            y2 = std::max(y2, y);
+            extents.x1 = std::min(extents.x1, x);
+            extents.x2 = std::max(extents.x2, x);
+        }
+        y1 = std::max(y1, -2.0);
+        y2 = std::min(y2, (double)height + 1.0);
+        rows[i * 2] = (int)floor(y1) - 1;
+        rows[i * 2 + 1] = (int)floor(y2) + 1;
+        extents.y1 = std::min(extents.y1, y1);
+        extents.y2 = std::max(extents.y2, y2);
+    }
+
+    agg::rect_i box(clipbox);
+    box.normalize();
+    int y1 = std::max(box.y1, 0);
+    int y2 = std::min(box.y2 + 1, (int)height);
+    int nbands = std::min(threads, (y2 - y1) / MIN_BAND_HEIGHT);
+    if (nbands <= 1)
+    {
+        return false;
+    }
+
+    std::vector<char> failed(nbands, 0);
+    if (has_clippath)
+    {
+        typedef agg::pixfmt_amask_adaptor<pixfmt, alpha_mask_type> pixfmt_amask_type;
+
+        pixfmt_amask_type pfa(pixFmt, alphaMask);
+        GouraudBands<pixfmt_amask_type, scanline_am> bands(
+            pfa, points, colors, rows, box, y1, y2, nbands, failed);
+        mpl::parallel_for(0, nbands, nbands, bands);
+    }
+    else
+    {
+        GouraudBands<pixfmt, scanline_p8> bands(
+            pixFmt, points, colors, rows, box, y1, y2, nbands, failed);
+        mpl::parallel_for(0, nbands, nbands, bands);
+    }
+
+    if (extents.clip(agg::rect_d(-1.0, -2.0, width, height + 1.0)))
+    {
+        add_damage(agg::rect_i((int)floor(extents.x1) - 1,
+                               (int)floor(extents.y1) - 1,
+                               (int)floor(extents.x2) + 1,
+                               (int)floor(extents.y2) + 1));
+    }
+
+    if (std::find(failed.begin(), failed.end(), 1) != failed.end())
+    {
+        throw Py::OverflowError("Exceeded cell block limit");
+    }
+
+    return true;
+}
+
+
 Py::Object
 RendererAgg::draw_gouraud_triangle(const Py::Tuple& args)
 {
@@ -2113,6 +3152,34 @@ RendererAgg::draw_gouraud_triangles(const Py::Tuple& args)
         throw Py::ValueError("points and colors arrays must be the same length");
     }
 
+    size_t n = PyArray_DIM(points, 0);
+    if (threads > 1 && n >= MIN_THREADED_TRIANGLES)
+    {
+        std::vector<double> all_points(n * 6);
+        std::vector<double> all_colors(n * 12);
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (int j = 0; j < 3; ++j) {
+                for (int k = 0; k < 2; ++k) {
+                    all_points[i*6+j*2+k] = *(double *)PyArray_GETPTR3(points, i, j, k);
+                }
+            }
+
+            for (int j = 0; j < 3; ++j) {
+                for (int k = 0; k < 4; ++k) {
+                    all_colors[i*12+j*4+k] = *(double *)PyArray_GETPTR3(colors, i, j, k);
+                }
+            }
+        }
+
+        if (_draw_gouraud_triangles_threaded(
+                all_points, all_colors, trans, get_clipbox(gc.cliprect),
+                has_clippath))
+        {
+            return Py::Object();
+        }
+    }
+
     for (int i = 0; i < PyArray_DIM(points, 0); ++i)
     {
         for (int j = 0; j < 3; ++j) {
@@ -2209,132 +3276,178 @@ RendererAgg::write_rgba(const Py::Tuple& args)
 }
 
 
-Py::Object
-RendererAgg::tostring_rgb(const Py::Tuple& args)
+// The number of bytes per pixel of an export format, or 0 if unknown
+static size_t
+export_pixel_size(const std::string& format)
 {
-    //"Return the rendered buffer as an RGB string";
+    if (format == "rgba" || format == "argb" || format == "bgra")
+    {
+        return 4;
+    }
+    if (format == "rgb")
+    {
+        return 3;
+    }
+    return 0;
+}
 
-    _VERBOSE("RendererAgg::tostring_rgb");
 
-    args.verify_length(0);
-    int row_len = width * 3;
-    unsigned char* buf_tmp = new unsigned char[row_len * height];
-    if (buf_tmp == NULL)
+// Convert the n order_rgba pixels at src to the given export format
+static void
+export_pixels(const agg::int8u* src, agg::int8u* dst, size_t n,
+              const std::string& format)
+{
+    if (format == "argb")
     {
-        //todo: also handle allocation throw
-        throw Py::MemoryError(
-            "RendererAgg::tostring_rgb could not allocate memory");
+        mpl::rgba32_to_argb32(src, dst, n);
     }
-
-    try
+    else if (format == "bgra")
     {
-        agg::rendering_buffer renderingBufferTmp;
-        renderingBufferTmp.attach(buf_tmp,
-                                  width,
-                                  height,
-                                  row_len);
-
-        agg::color_conv(&renderingBufferTmp, &renderingBuffer,
-                        agg::color_conv_rgba32_to_rgb24());
+        mpl::rgba32_to_bgra32(src, dst, n);
     }
-    catch (...)
+    else if (format == "rgb")
+    {
+        mpl::rgba32_to_rgb24(src, dst, n);
+    }
+    else
     {
-        delete [] buf_tmp;
-        throw Py::RuntimeError("Unknown exception occurred in tostring_rgb");
+        memcpy(dst, src, n * 4);
     }
+}
 
-    //todo: how to do this with native CXX
-    #if PY3K
-    PyObject* o = Py_BuildValue("y#", buf_tmp, row_len * height);
-    #else
-    PyObject* o = Py_BuildValue("s#", buf_tmp, row_len * height);
-    #endif
 
-    delete [] buf_tmp;
-    return Py::asObject(o);
+Py::Object
+RendererAgg::tostring(const std::string& format)
+{
+    size_t npixels = size_t(width) * height;
+    PyObject* o = PyBytes_FromStringAndSize(
+        NULL, npixels * export_pixel_size(format));
+    if (o == NULL)
+    {
+        throw Py::MemoryError(
+            "RendererAgg::tostring_" + format + " could not allocate memory");
+    }
+
+    // Convert straight into the new string, without a temporary copy
+    export_pixels(pixBuffer, (agg::int8u*)PyBytes_AsString(o), npixels,
+                  format);
+
+    return Py::Object(o, true);
 }
 
 
 Py::Object
-RendererAgg::tostring_argb(const Py::Tuple& args)
+RendererAgg::tostring_rgb(const Py::Tuple& args)
 {
     //"Return the rendered buffer as an RGB string";
 
-    _VERBOSE("RendererAgg::tostring_argb");
+    _VERBOSE("RendererAgg::tostring_rgb");
 
     args.verify_length(0);
-    int row_len = width * 4;
-    unsigned char* buf_tmp = new unsigned char[row_len * height];
-    if (buf_tmp == NULL)
-    {
-        //todo: also handle allocation throw
-        throw Py::MemoryError("RendererAgg::tostring_argb could not allocate memory");
-    }
+    return tostring("rgb");
+}
 
-    try
-    {
-        agg::rendering_buffer renderingBufferTmp;
-        renderingBufferTmp.attach(buf_tmp, width, height, row_len);
-        agg::color_conv(&renderingBufferTmp, &renderingBuffer, agg::color_conv_rgba32_to_argb32());
-    }
-    catch (...)
-    {
-        delete [] buf_tmp;
-        throw Py::RuntimeError("Unknown exception occurred in tostring_argb");
-    }
 
-    //todo: how to do this with native CXX
+Py::Object
+RendererAgg::tostring_argb(const Py::Tuple& args)
+{
+    //"Return the rendered buffer as an ARGB string";
 
-    #if PY3K
-    PyObject* o = Py_BuildValue("y#", buf_tmp, row_len * height);
-    #else
-    PyObject* o = Py_BuildValue("s#", buf_tmp, row_len * height);
-    #endif
-    delete [] buf_tmp;
-    return Py::asObject(o);
+    _VERBOSE("RendererAgg::tostring_argb");
+
+    args.verify_length(0);
+    return tostring("argb");
 }
 
 
 Py::Object
 RendererAgg::tostring_bgra(const Py::Tuple& args)
 {
-    //"Return the rendered buffer as an RGB string";
+    //"Return the rendered buffer as a BGRA string";
 
     _VERBOSE("RendererAgg::tostring_bgra");
 
     args.verify_length(0);
-    int row_len = width * 4;
-    unsigned char* buf_tmp = new unsigned char[row_len * height];
-    if (buf_tmp == NULL)
+    return tostring("bgra");
+}
+
+
+Py::Object
+RendererAgg::copy_pixels(const Py::Tuple& args)
+{
+    //"Convert the rendered buffer into the writable buffer out";
+
+    _VERBOSE("RendererAgg::copy_pixels");
+
+    args.verify_length(1, 3);
+
+    std::string format("rgba");
+    if (args.size() >= 2)
     {
-        //todo: also handle allocation throw
-        throw Py::MemoryError("RendererAgg::tostring_bgra could not allocate memory");
+        format = Py::String(args[1]).encode("utf-8");
     }
-
-    try
+    bool damaged_only = args.size() == 3 && args[2].isTrue();
+    size_t pixel_size = export_pixel_size(format);
+    if (!pixel_size)
     {
-        agg::rendering_buffer renderingBufferTmp;
-        renderingBufferTmp.attach(buf_tmp,
-                                  width,
-                                  height,
-                                  row_len);
+        throw Py::ValueError("Unknown pixel format '" + format + "'");
+    }
+    size_t npixels = size_t(width) * height;
 
-        agg::color_conv(&renderingBufferTmp, &renderingBuffer, agg::color_conv_rgba32_to_bgra32());
+    agg::int8u* out;
+    size_t out_len;
+    #if PY3K
+    Py_buffer view;
+    if (PyObject_GetBuffer(args[0].ptr(), &view, PyBUF_WRITABLE) != 0)
+    {
+        throw Py::Exception();
     }
-    catch (...)
+    out = (agg::int8u*)view.buf;
+    out_len = view.len;
+    #else
+    void* buf;
+    Py_ssize_t buffer_len;
+    if (PyObject_AsWriteBuffer(args[0].ptr(), &buf, &buffer_len) != 0)
     {
-        delete [] buf_tmp;
-        throw Py::RuntimeError("Unknown exception occurred in tostring_bgra");
+        throw Py::Exception();
+    }
+    out = (agg::int8u*)buf;
+    out_len = buffer_len;
+    #endif
+
+    if (out_len == npixels * pixel_size)
+    {
+        if (damaged_only)
+        {
+            // Only the damaged rectangles, each to its place in out
+            for (std::vector<agg::rect_i>::const_iterator r = damage.begin();
+                 r != damage.end(); ++r)
+            {
+                for (int y = r->y1; y <= r->y2; ++y)
+                {
+                    size_t offset = size_t(y) * width + r->x1;
+                    export_pixels(pixBuffer + offset * 4,
+                                  out + offset * pixel_size,
+                                  r->x2 - r->x1 + 1, format);
+                }
+            }
+        }
+        else
+        {
+            export_pixels(pixBuffer, out, npixels, format);
+        }
     }
 
-    //todo: how to do this with native CXX
     #if PY3K
-    PyObject* o = Py_BuildValue("y#", buf_tmp, row_len * height);
-    #else
-    PyObject* o = Py_BuildValue("s#", buf_tmp, row_len * height);
+    PyBuffer_Release(&view);
     #endif
-    delete [] buf_tmp;
-    return Py::asObject(o);
+
+    if (out_len != npixels * pixel_size)
+    {
+        throw Py::ValueError("Output buffer has the wrong size");
+    }
+
+    return Py::Object();
 }
 
 
@@ -2449,8 +3562,79 @@ RendererAgg::clear(const Py::Tuple& args)
 
     _VERBOSE("RendererAgg::clear");
 
+    args.verify_length(0, 1);
+
+    if (args.size() == 1 && args[0].isTrue())
+    {
+        // Only clear what was drawn since the last reset_damage; that
+        // area stays damaged
+        rendererBase.reset_clipping(true);
+        for (std::vector<agg::rect_i>::const_iterator r = damage.begin();
+             r != damage.end(); ++r)
+        {
+            rendererBase.copy_bar(r->x1, r->y1, r->x2, r->y2, _fill_color);
+        }
+    }
+    else
+    {
+        rendererBase.clear(_fill_color);
+        add_damage(agg::rect_i(0, 0, width - 1, height - 1));
+    }
+
+    return Py::Object();
+}
+
+
+Py::Object
+RendererAgg::set_damage_tracking(const Py::Tuple& args)
+{
+    //"Turn the recording of the damaged area on or off";
+
+    _VERBOSE("RendererAgg::set_damage_tracking");
+
+    args.verify_length(1);
+    damage_tracking = args[0].isTrue();
+    damage.clear();
+
+    return Py::Object();
+}
+
+
+Py::Object
+RendererAgg::get_damage(const Py::Tuple& args)
+{
+    //"Return the damaged rectangles as (x0, y0, x1, y1) display extents";
+
+    _VERBOSE("RendererAgg::get_damage");
+
     args.verify_length(0);
-    rendererBase.clear(_fill_color);
+
+    Py::List result;
+    for (std::vector<agg::rect_i>::const_iterator r = damage.begin();
+         r != damage.end(); ++r)
+    {
+        // Flip to display coordinates, with the origin at the bottom
+        Py::Tuple extents(4);
+        extents[0] = Py::Int(r->x1);
+        extents[1] = Py::Int(int(height) - r->y2 - 1);
+        extents[2] = Py::Int(r->x2 + 1);
+        extents[3] = Py::Int(int(height) - r->y1);
+        result.append(extents);
+    }
+
+    return result;
+}
+
+
+Py::Object
+RendererAgg::reset_damage(const Py::Tuple& args)
+{
+    //"Forget the damage recorded so far";
+
+    _VERBOSE("RendererAgg::reset_damage");
+
+    args.verify_length(0);
+    damage.clear();
 
     return Py::Object();
 }
@@ -2490,7 +3674,6 @@ RendererAgg::~RendererAgg()
 
     _VERBOSE("RendererAgg::~RendererAgg");
 
-    delete [] alphaBuffer;
     delete [] pixBuffer;
 }
 
@@ -2514,6 +3697,17 @@ Py::Object _backend_agg_module::new_renderer(const Py::Tuple &args,
         debug = 0;
     }
 
+    int threads = 1;
+    if (kws.hasKey("threads"))
+    {
+        threads = Py::Int(kws["threads"]);
+        if (threads < 0)
+        {
+            throw Py::ValueError("threads must be non-negative");
+        }
+        threads = mpl::resolve_num_threads(threads);
+    }
+
     unsigned int width = (int)Py::Int(args[0]);
     unsigned int height = (int)Py::Int(args[1]);
     double dpi = Py::Float(args[2]);
@@ -2531,7 +3725,7 @@ Py::Object _backend_agg_module::new_renderer(const Py::Tuple &args,
     RendererAgg* renderer = NULL;
     try
     {
-        renderer = new RendererAgg(width, height, dpi, debug);
+        renderer = new RendererAgg(width, height, dpi, debug, threads);
     }
     catch (std::bad_alloc)
     {
@@ -2541,6 +3735,18 @@ Py::Object _backend_agg_module::new_renderer(const Py::Tuple &args,
     return Py::asObject(renderer);
 }
 
+Py::Object _backend_agg_module::cache_info(const Py::Tuple &args)
+{
+    args.verify_length(0);
+
+    Py::Dict info;
+    info["marker_hits"] = Py::Long(marker_cache_hits);
+    info["marker_misses"] = Py::Long(marker_cache_misses);
+    info["hatch_hits"] = Py::Long(hatch_cache_hits);
+    info["hatch_misses"] = Py::Long(hatch_cache_misses);
+    return info;
+}
+
 
 void BufferRegion::init_type()
 {
@@ -2597,8 +3803,18 @@ void RendererAgg::init_type()
                        "s = tostring_rgba_minimized()");
     add_varargs_method("buffer_rgba", &RendererAgg::buffer_rgba,
                        "buffer = buffer_rgba()");
+    add_varargs_method("copy_pixels", &RendererAgg::copy_pixels,
+                       "copy_pixels(out, format='rgba', damaged_only=False)\n"
+                       "Convert the rendered buffer into the writable buffer out,\n"
+                       "in 'rgba', 'argb', 'bgra' or 'rgb' order");
     add_varargs_method("clear", &RendererAgg::clear,
-                       "clear()");
+                       "clear(damaged_only=False)");
+    add_varargs_method("set_damage_tracking", &RendererAgg::set_damage_tracking,
+                       "set_damage_tracking(enabled)");
+    add_varargs_method("get_damage", &RendererAgg::get_damage,
+                       "extents = get_damage()");
+    add_varargs_method("reset_damage", &RendererAgg::reset_damage,
+                       "reset_damage()");
     add_varargs_method("copy_from_bbox", &RendererAgg::copy_from_bbox,
                        "copy_from_bbox(bbox)");
     add_varargs_method("restore_region", &RendererAgg::restore_region,
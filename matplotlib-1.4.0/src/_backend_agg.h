@@ -6,6 +6,7 @@
 
 #ifndef __BACKEND_AGG_H
 #define __BACKEND_AGG_H
+#include <list>
 #include <utility>
 #include "CXX/Extensions.hxx"
 
@@ -42,6 +43,8 @@
 
 #include "agg_py_path_iterator.h"
 #include "path_converters.h"
+#include "pixfmt_simd.h"
+#include "alpha_mask_cropped.h"
 
 // These are copied directly from path.py, and must be kept in sync
 #define STOP   0
@@ -53,7 +56,7 @@
 
 const size_t NUM_VERTICES[] = { 1, 1, 1, 2, 3, 1 };
 
-typedef agg::pixfmt_rgba32_plain pixfmt;
+typedef mpl::pixfmt_rgba32_plain pixfmt;
 typedef agg::renderer_base<pixfmt> renderer_base;
 typedef agg::renderer_scanline_aa_solid<renderer_base> renderer_aa;
 typedef agg::renderer_scanline_bin_solid<renderer_base> renderer_bin;
@@ -61,11 +64,10 @@ typedef agg::rasterizer_scanline_aa<agg::rasterizer_sl_clip_dbl> rasterizer;
 
 typedef agg::scanline_p8 scanline_p8;
 typedef agg::scanline_bin scanline_bin;
-typedef agg::amask_no_clip_gray8 alpha_mask_type;
+typedef mpl::cropped_alpha_mask alpha_mask_type;
 typedef agg::scanline_u8_am<alpha_mask_type> scanline_am;
 
 typedef agg::renderer_base<agg::pixfmt_gray8> renderer_base_alpha_mask_type;
-typedef agg::renderer_scanline_aa_solid<renderer_base_alpha_mask_type> renderer_alpha_mask_type;
 
 // a helper class to pass agg::buffer objects around.  agg::buffer is
 // a class in the swig wrapper
@@ -170,7 +172,8 @@ class RendererAgg: public Py::PythonExtension<RendererAgg>
 {
     typedef std::pair<bool, agg::rgba> facepair_t;
 public:
-    RendererAgg(unsigned int width, unsigned int height, double dpi, int debug);
+    RendererAgg(unsigned int width, unsigned int height, double dpi, int debug,
+                int threads);
     static void init_type(void);
 
     unsigned int get_width()
@@ -201,8 +204,13 @@ public:
     Py::Object tostring_bgra(const Py::Tuple & args);
     Py::Object tostring_rgba_minimized(const Py::Tuple & args);
     Py::Object buffer_rgba(const Py::Tuple & args);
+    Py::Object copy_pixels(const Py::Tuple & args);
     Py::Object clear(const Py::Tuple & args);
 
+    Py::Object set_damage_tracking(const Py::Tuple & args);
+    Py::Object get_damage(const Py::Tuple & args);
+    Py::Object reset_damage(const Py::Tuple & args);
+
     Py::Object copy_from_bbox(const Py::Tuple & args);
     Py::Object restore_region(const Py::Tuple & args);
     Py::Object restore_region2(const Py::Tuple & args);
@@ -221,12 +229,7 @@ public:
     agg::int8u *pixBuffer;
     agg::rendering_buffer renderingBuffer;
 
-    agg::int8u *alphaBuffer;
-    agg::rendering_buffer alphaMaskRenderingBuffer;
     alpha_mask_type alphaMask;
-    agg::pixfmt_gray8 pixfmtAlphaMask;
-    renderer_base_alpha_mask_type rendererBaseAlphaMask;
-    renderer_alpha_mask_type rendererAlphaMask;
     scanline_am scanlineAlphaMask;
 
     scanline_p8 slineP8;
@@ -237,32 +240,66 @@ public:
     renderer_bin rendererBin;
     rasterizer theRasterizer;
 
-    Py::Object lastclippath;
-    agg::trans_affine lastclippath_transform;
+    // A rasterized clip path, cropped to the pixels it covers
+    struct ClipMask
+    {
+        Py::Object path;
+        agg::trans_affine trans;
+        agg::rect_i bounds;
+        std::vector<agg::int8u> alpha;
+    };
+
+    // Recently used clip masks, most recent (the one alphaMask is
+    // attached to) first
+    std::list<ClipMask> clipMasks;
 
     static const size_t HATCH_SIZE = 72;
-    agg::int8u hatchBuffer[HATCH_SIZE * HATCH_SIZE * 4];
-    agg::rendering_buffer hatchRenderingBuffer;
 
     const int debug;
 
+    // number of threads used to sweep large paths in horizontal bands;
+    // 1 renders everything on the calling thread
+    const int threads;
+
     agg::rgba _fill_color;
 
+    // when damage tracking is on, the pixel rectangles (in buffer
+    // coordinates, inclusive) touched since the last reset_damage
+    bool damage_tracking;
+    std::vector<agg::rect_i> damage;
+
 
 protected:
     double points_to_pixels(const Py::Object& points);
     agg::rgba rgb_to_color(const Py::SeqBase<Py::Object>& rgb, double alpha);
     facepair_t _get_rgba_face(const Py::Object& rgbFace, double alpha, bool forced_alpha);
 
+    Py::Object tostring(const std::string& format);
+
+    agg::rect_i get_clipbox(const Py::Object& cliprect);
+
+    void add_damage(agg::rect_i rect);
+    void add_rasterizer_damage();
+
     template<class R>
     void set_clipbox(const Py::Object& cliprect, R& rasterizer);
 
     bool render_clippath(const Py::Object& clippath, const agg::trans_affine& clippath_trans);
 
+    template<class Renderer, class Scanline>
+    void _render_scanlines(Scanline& sl, Renderer& ren,
+                           typename Renderer::base_ren_type::pixfmt_type& pixf);
+
     template<class PathIteratorType>
     void _draw_path(PathIteratorType& path, bool has_clippath,
                     const facepair_t& face, const GCAgg& gc);
 
+    template<class FrontEnd>
+    void _draw_path_stages(FrontEnd& front, PathIterator& path,
+                           bool clip, bool simplify,
+                           double snapping_linewidth, bool has_clippath,
+                           const facepair_t& face, const GCAgg& gc);
+
     template<class PathGenerator, int check_snap, int has_curves>
     Py::Object
     _draw_path_collection_generic
@@ -277,19 +314,32 @@ protected:
      const agg::trans_affine&       offset_trans,
      const Py::Object&              facecolors_obj,
      const Py::Object&              edgecolors_obj,
-     const Py::SeqBase<Py::Float>&  linewidths,
+     const Py::Object&              linewidths_obj,
      const Py::SeqBase<Py::Object>& linestyles_obj,
-     const Py::SeqBase<Py::Int>&    antialiaseds,
+     const Py::Object&              antialiaseds_obj,
      const bool                     data_offsets);
 
+    bool
+    _draw_quad_mesh_rectilinear(
+        const GCAgg& gc, agg::trans_affine master_transform,
+        size_t mesh_width, size_t mesh_height,
+        const Py::Object& coordinates_obj, const Py::Object& offsets_obj,
+        const agg::trans_affine& offset_trans,
+        const Py::Object& facecolors_obj, bool antialiased,
+        const Py::Object& edgecolors_obj);
+
     void
     _draw_gouraud_triangle(
         const double* points, const double* colors,
         agg::trans_affine trans, bool has_clippath);
 
-private:
-    void create_alpha_buffers();
+    bool
+    _draw_gouraud_triangles_threaded(
+        std::vector<double>& points, const std::vector<double>& colors,
+        agg::trans_affine trans, const agg::rect_i& clipbox,
+        bool has_clippath);
 
+private:
     // prevent copying
     RendererAgg(const RendererAgg&);
     RendererAgg& operator=(const RendererAgg&);
@@ -306,7 +356,9 @@ public:
         BufferRegion::init_type();
 
         add_keyword_method("RendererAgg", &_backend_agg_module::new_renderer,
-                           "RendererAgg(width, height, dpi)");
+                           "RendererAgg(width, height, dpi, debug=0, threads=1)");
+        add_varargs_method("cache_info", &_backend_agg_module::cache_info,
+                           "cache_info()\n\nReturn the marker and hatch cache hit and miss counts.");
         initialize("The agg rendering backend");
     }
 
@@ -315,6 +367,7 @@ public:
 private:
 
     Py::Object new_renderer(const Py::Tuple &args, const Py::Dict &kws);
+    Py::Object cache_info(const Py::Tuple &args);
 
     // prevent copying
     _backend_agg_module(const _backend_agg_module&);
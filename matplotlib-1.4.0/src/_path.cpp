@@ -4,10 +4,23 @@
 #include "agg_py_transforms.h"
 #include "path_converters.h"
 
+#include <algorithm>
 #include <limits>
+#include <map>
+#include <new>
+#include <vector>
 #include <math.h>
 
 #include "CXX/Extensions.hxx"
+#include "MPL_isnan.h"
+#include "mplthreads.h"
+
+// The SSE2 kernel below relies on every product and sum being rounded
+// on its own, so it is left out where the compiler may fuse them
+#if (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)) && !defined(__FMA__)
+#define MPL_AFFINE_SSE2 1
+#include <emmintrin.h>
+#endif
 
 #include "agg_conv_contour.h"
 #include "agg_conv_curve.h"
@@ -24,6 +37,141 @@ struct XY
     XY(double x_, double y_) : x(x_), y(y_) {}
 };
 
+// Whether v is neither infinite nor NaN; unlike MPL_notisfinite64 this
+// does not read the double through an integer pointer
+static inline bool
+is_finite(double v)
+{
+    return fabs(v) <= std::numeric_limits<double>::max();
+}
+
+/*
+ The edges of a path as seen by point_in_path_impl, bucketed by the rows
+ of a uniform grid over the path's y-range, so that many points can be
+ tested against the same path without walking every edge for each one.
+
+ Only an edge whose end points straddle a point's y can flip the
+ crossing parity of its subpath, and all such edges are in the point's
+ row, kept in path order.  contains() therefore gives exactly the same
+ answer as point_in_path_impl, including on edges and vertices.
+*/
+class PathEdgeIndex
+{
+public:
+    PathEdgeIndex() :
+        exhaustive(false), ymin(0.0), ymax(0.0), scale(0.0)
+    {
+    }
+
+    template<class T>
+    void build(T& path);
+
+    bool contains(double x, double y) const;
+
+private:
+    struct edge
+    {
+        double x0, y0, x1, y1;
+        size_t subpath;
+    };
+
+    void add_edge(double x0, double y0, double x1, double y1, size_t subpath);
+    size_t row(double y) const;
+
+    std::vector<edge> edges;
+    std::vector<size_t> row_start;   // rows index into row_edges
+    std::vector<size_t> row_edges;
+    bool exhaustive;                 // one row holding every edge
+    double ymin, ymax, scale;
+};
+
+/*
+ A path turned into a PathEdgeIndex once, for answering many
+ point-in-path queries against it from Python.
+*/
+class PreparedPath : public Py::PythonExtension<PreparedPath>
+{
+public:
+    PreparedPath() {}
+    virtual ~PreparedPath() {}
+
+    PathEdgeIndex index;
+
+    Py::Object contains_point(const Py::Tuple& args);
+    Py::Object contains_points(const Py::Tuple& args);
+    static void init_type(void);
+
+private:
+    // prevent copying
+    PreparedPath(const PreparedPath&);
+    PreparedPath& operator=(const PreparedPath&);
+};
+
+/*
+ A static, bulk loaded R-tree over a set of boxes, for finding the ones
+ that overlap a query box.  The boxes are packed into leaves with the
+ Sort-Tile-Recursive method, BBOX_TREE_FANOUT to a node, and every
+ level of the tree is stored as a flat array of node bounds.
+
+ Overlap is tested exactly as count_bboxes_overlapping_bbox does it,
+ so boxes that merely touch do not overlap.  Boxes with a NaN
+ coordinate can not be placed in the tree; they are kept aside and
+ tested against every query, as are all the boxes for a query that
+ has a NaN coordinate itself.
+*/
+class BboxTree
+{
+public:
+    struct box
+    {
+        double x0, y0, x1, y1;
+    };
+
+    void build(const std::vector<box>& boxes);
+
+    size_t size() const
+    {
+        return boxes.size();
+    }
+
+    // Append the indices of the boxes overlapping q to result, in
+    // increasing order
+    void overlapping(box q, std::vector<size_t>& result) const;
+
+    size_t count_overlapping(box q) const;
+
+    template<class Visitor>
+    bool query(const box& q, Visitor& visit) const;
+
+private:
+    std::vector<box> boxes;
+    std::vector<std::vector<box> > levels;  // levels[0] holds the leaves
+    std::vector<size_t> items;              // leaf order -> box index
+    std::vector<size_t> irregular;          // boxes kept out of the tree
+};
+
+/*
+ A BboxTree built from Python, for answering many bbox overlap queries
+ at once.
+*/
+class BboxIndex : public Py::PythonExtension<BboxIndex>
+{
+public:
+    BboxIndex() {}
+    virtual ~BboxIndex() {}
+
+    BboxTree tree;
+
+    Py::Object count_overlaps(const Py::Tuple& args);
+    Py::Object overlapping(const Py::Tuple& args);
+    static void init_type(void);
+
+private:
+    // prevent copying
+    BboxIndex(const BboxIndex&);
+    BboxIndex& operator=(const BboxIndex&);
+};
+
 // the extension module
 class _path_module : public Py::ExtensionModule<_path_module>
 {
@@ -31,10 +179,15 @@ public:
     _path_module()
             : Py::ExtensionModule<_path_module>("_path")
     {
+        PreparedPath::init_type();
+        BboxIndex::init_type();
+
         add_varargs_method("point_in_path", &_path_module::point_in_path,
                            "point_in_path(x, y, path, trans)");
         add_varargs_method("points_in_path", &_path_module::points_in_path,
                            "points_in_path(points, path, trans)");
+        add_varargs_method("prepare_path", &_path_module::prepare_path,
+                           "prepare_path(path, trans, r)");
         add_varargs_method("point_on_path", &_path_module::point_on_path,
                            "point_on_path(x, y, r, path, trans)");
         add_varargs_method("get_path_extents", &_path_module::get_path_extents,
@@ -42,7 +195,8 @@ public:
         add_varargs_method("update_path_extents", &_path_module::update_path_extents,
                            "update_path_extents(path, trans, bbox, minpos)");
         add_varargs_method("get_path_collection_extents", &_path_module::get_path_collection_extents,
-                           "get_path_collection_extents(trans, paths, transforms, offsets, offsetTrans)");
+                           "get_path_collection_extents(trans, paths, transforms, offsets, offsetTrans, threads=0)\n"
+                           "threads=0 uses one thread per processor");
         add_varargs_method("point_in_path_collection", &_path_module::point_in_path_collection,
                            "point_in_path_collection(x, y, r, trans, paths, transforms, offsets, offsetTrans, filled)");
         add_varargs_method("path_in_path", &_path_module::path_in_path,
@@ -50,17 +204,24 @@ public:
         add_varargs_method("clip_path_to_rect", &_path_module::clip_path_to_rect,
                            "clip_path_to_rect(path, bbox, inside)");
         add_varargs_method("affine_transform", &_path_module::affine_transform,
-                           "affine_transform(vertices, transform)");
+                           "affine_transform(vertices, transform, out=None, threads=0)");
         add_varargs_method("count_bboxes_overlapping_bbox", &_path_module::count_bboxes_overlapping_bbox,
                            "count_bboxes_overlapping_bbox(bbox, bboxes)");
+        add_varargs_method("bbox_index", &_path_module::bbox_index,
+                           "bbox_index(extents)");
         add_varargs_method("path_intersects_path", &_path_module::path_intersects_path,
                            "path_intersects_path(p1, p2)");
+        add_varargs_method("path_intersects_paths", &_path_module::path_intersects_paths,
+                           "path_intersects_paths(path, paths, filled=False)");
         add_varargs_method("convert_path_to_polygons", &_path_module::convert_path_to_polygons,
                            "convert_path_to_polygons(path, trans, width, height)");
+        add_varargs_method("clip_path_to_path", &_path_module::clip_path_to_path,
+                           "clip_path_to_path(a, atrans, b, btrans, operation)");
         add_varargs_method("cleanup_path", &_path_module::cleanup_path,
                            "cleanup_path(path, trans, remove_nans, clip, snap, simplify, curves, sketch_params)");
         add_varargs_method("convert_to_svg", &_path_module::convert_to_svg,
-                           "convert_to_svg(path, trans, clip, simplify, precision)");
+                           "convert_to_svg(path, trans, clip, simplify, precision, file=None)\n"
+                           "If file is given, the data is written to it and None is returned");
         initialize("Helper functions for paths");
     }
 
@@ -69,6 +230,7 @@ public:
 private:
     Py::Object point_in_path(const Py::Tuple& args);
     Py::Object points_in_path(const Py::Tuple& args);
+    Py::Object prepare_path(const Py::Tuple& args);
     Py::Object point_on_path(const Py::Tuple& args);
     Py::Object get_path_extents(const Py::Tuple& args);
     Py::Object update_path_extents(const Py::Tuple& args);
@@ -78,8 +240,11 @@ private:
     Py::Object clip_path_to_rect(const Py::Tuple& args);
     Py::Object affine_transform(const Py::Tuple& args);
     Py::Object count_bboxes_overlapping_bbox(const Py::Tuple& args);
+    Py::Object bbox_index(const Py::Tuple& args);
     Py::Object path_intersects_path(const Py::Tuple& args);
+    Py::Object path_intersects_paths(const Py::Tuple& args);
     Py::Object convert_path_to_polygons(const Py::Tuple& args);
+    Py::Object clip_path_to_path(const Py::Tuple& args);
     Py::Object cleanup_path(const Py::Tuple& args);
     Py::Object convert_to_svg(const Py::Tuple& args);
 };
@@ -262,6 +427,248 @@ point_in_path_impl(const void* const points_, const size_t s0,
     free(subpath_flag);
 }
 
+// The most rows a PathEdgeIndex is divided into
+#define EDGE_INDEX_MAX_ROWS (1 << 16)
+
+// Rows are made coarser when edges span so many of them that the index
+// would hold more than this many entries per edge on average
+#define EDGE_INDEX_MAX_ENTRIES_PER_EDGE 8
+
+template<class T>
+void
+PathEdgeIndex::build(T& path)
+{
+    // Walk the path exactly as point_in_path_impl does, recording the
+    // edges it tests in order
+    double x = 0.0, y = 0.0;
+    double sx, sy;
+    double vtx0, vty0, vtx1, vty1;
+    size_t subpath = 0;
+
+    path.rewind(0);
+
+    unsigned code = 0;
+    do
+    {
+        if (code != agg::path_cmd_move_to)
+        {
+            code = path.vertex(&x, &y);
+            if (code == agg::path_cmd_stop ||
+                (code & agg::path_cmd_end_poly) == agg::path_cmd_end_poly) {
+                continue;
+            }
+        }
+
+        sx = vtx0 = vtx1 = x;
+        sy = vty0 = vty1 = y;
+
+        do
+        {
+            code = path.vertex(&x, &y);
+
+            if (code == agg::path_cmd_stop ||
+                (code & agg::path_cmd_end_poly) == agg::path_cmd_end_poly)
+            {
+                x = sx;
+                y = sy;
+            }
+            else if (code == agg::path_cmd_move_to)
+            {
+                break;
+            }
+
+            add_edge(vtx0, vty0, vtx1, vty1, subpath);
+
+            vtx0 = vtx1;
+            vty0 = vty1;
+
+            vtx1 = x;
+            vty1 = y;
+        }
+        while (code != agg::path_cmd_stop &&
+               (code & agg::path_cmd_end_poly) != agg::path_cmd_end_poly);
+
+        add_edge(vtx0, vty0, vtx1, vty1, subpath);
+        ++subpath;
+    }
+    while (code != agg::path_cmd_stop);
+
+    // Lay out the rows
+    size_t nedges = edges.size();
+    size_t nrows = 1;
+    double span = 0.0;
+    if (!exhaustive && nedges)
+    {
+        ymin = ymax = edges[0].y0;
+        for (size_t i = 0; i < nedges; ++i)
+        {
+            ymin = std::min(ymin, std::min(edges[i].y0, edges[i].y1));
+            ymax = std::max(ymax, std::max(edges[i].y0, edges[i].y1));
+        }
+        if (ymax > ymin)
+        {
+            for (size_t i = 0; i < nedges; ++i)
+            {
+                span += fabs(edges[i].y1 - edges[i].y0) / (ymax - ymin);
+            }
+            nrows = std::min(nedges, (size_t)EDGE_INDEX_MAX_ROWS);
+            if (span * nrows > EDGE_INDEX_MAX_ENTRIES_PER_EDGE * nedges)
+            {
+                nrows = std::max(
+                    (size_t)(EDGE_INDEX_MAX_ENTRIES_PER_EDGE * nedges / span),
+                    (size_t)1);
+            }
+            scale = nrows / (ymax - ymin);
+        }
+    }
+
+    // Bucket the edges by row, counting them first
+    row_start.assign(nrows + 1, 0);
+    for (size_t i = 0; i < nedges; ++i)
+    {
+        size_t r1 = row(std::min(edges[i].y0, edges[i].y1));
+        size_t r2 = row(std::max(edges[i].y0, edges[i].y1));
+        for (size_t r = r1; r <= r2; ++r)
+        {
+            ++row_start[r + 1];
+        }
+    }
+    for (size_t r = 0; r < nrows; ++r)
+    {
+        row_start[r + 1] += row_start[r];
+    }
+    row_edges.resize(row_start[nrows]);
+    std::vector<size_t> fill(row_start.begin(), row_start.end() - 1);
+    for (size_t i = 0; i < nedges; ++i)
+    {
+        size_t r1 = row(std::min(edges[i].y0, edges[i].y1));
+        size_t r2 = row(std::max(edges[i].y0, edges[i].y1));
+        for (size_t r = r1; r <= r2; ++r)
+        {
+            row_edges[fill[r]++] = i;
+        }
+    }
+}
+
+void
+PathEdgeIndex::add_edge(double x0, double y0, double x1, double y1,
+                        size_t subpath)
+{
+    if (!(is_finite(x0) && is_finite(y0) && is_finite(x1) && is_finite(y1)))
+    {
+        // Comparisons against these can not be binned; keep every edge
+        // in a single row and test them all
+        exhaustive = true;
+    }
+    else if (y0 == y1)
+    {
+        // A horizontal edge never straddles a point's y
+        return;
+    }
+
+    edge e;
+    e.x0 = x0;
+    e.y0 = y0;
+    e.x1 = x1;
+    e.y1 = y1;
+    e.subpath = subpath;
+    edges.push_back(e);
+}
+
+size_t
+PathEdgeIndex::row(double y) const
+{
+    if (exhaustive || scale == 0.0)
+    {
+        return 0;
+    }
+    double r = (y - ymin) * scale;
+    if (r <= 0.0)
+    {
+        return 0;
+    }
+    size_t last = row_start.size() - 2;
+    return std::min((size_t)r, last);
+}
+
+bool
+PathEdgeIndex::contains(double tx, double ty) const
+{
+    if (edges.empty() || (!exhaustive && !(ty > ymin && ty <= ymax)))
+    {
+        return false;
+    }
+
+    size_t r = row(ty);
+    size_t subpath = 0;
+    int flag = 0;
+    for (size_t i = row_start[r]; i < row_start[r + 1]; ++i)
+    {
+        const edge& e = edges[row_edges[i]];
+        if (e.subpath != subpath)
+        {
+            if (flag)
+            {
+                return true;
+            }
+            subpath = e.subpath;
+        }
+
+        int yflag0 = (e.y0 >= ty);
+        int yflag1 = (e.y1 >= ty);
+        if (yflag0 != yflag1) {
+            if (((e.y1 - ty) * (e.x0 - e.x1) >=
+                 (e.x1 - tx) * (e.y0 - e.y1)) == yflag1) {
+                flag ^= 1;
+            }
+        }
+    }
+
+    return flag != 0;
+}
+
+// Tests the n points of an Nx2 array against an edge index.  test() takes
+// the points [start, end); operator() takes the blocks [start, end) of
+// block points each, so that any number of points can be counted in the
+// int range of mpl::parallel_for.
+class PointsInIndex
+{
+public:
+    PointsInIndex(const PathEdgeIndex& index, const char* points,
+                  size_t s0, size_t s1, npy_bool* result,
+                  npy_intp n, npy_intp block) :
+        index(index), points(points), s0(s0), s1(s1), result(result),
+        n(n), block(block)
+    {
+    }
+
+    void operator()(int start, int end)
+    {
+        test(start * block, std::min(end * block, n));
+    }
+
+    void test(npy_intp start, npy_intp end)
+    {
+        for (npy_intp i = start; i < end; ++i)
+        {
+            double x = *(double *)(points + s0 * i);
+            double y = *(double *)(points + s0 * i + s1);
+            result[i] = index.contains(x, y);
+        }
+    }
+
+private:
+    const PathEdgeIndex& index;
+    const char* points;
+    size_t s0, s1;
+    npy_bool* result;
+    npy_intp n;
+    npy_intp block;
+};
+
+// The fewest points worth building a PathEdgeIndex for
+#define EDGE_INDEX_MIN_POINTS 16
+
 inline void
 points_in_path(const void* const points, const size_t s0,
                const size_t s1, const size_t n,
@@ -289,9 +696,41 @@ points_in_path(const void* const points, const size_t s0,
     curve_t curved_path(no_nans_path);
     contour_t contoured_path(curved_path);
     contoured_path.width(r);
+
+    if (n >= EDGE_INDEX_MIN_POINTS)
+    {
+        PathEdgeIndex index;
+        index.build(contoured_path);
+        PointsInIndex task(index, (const char*)points, s0, s1, result, n, 1);
+        task.test(0, n);
+        return;
+    }
+
     point_in_path_impl(points, s0, s1, n, contoured_path, result);
 }
 
+inline void
+prepare_path(PathEdgeIndex& index, const double r, PathIterator& path,
+             const agg::trans_affine& trans)
+{
+    typedef agg::conv_transform<PathIterator> transformed_path_t;
+    typedef PathNanRemover<transformed_path_t> no_nans_t;
+    typedef agg::conv_curve<no_nans_t> curve_t;
+    typedef agg::conv_contour<curve_t> contour_t;
+
+    if (path.total_vertices() < 3)
+    {
+        return;
+    }
+
+    transformed_path_t trans_path(path, trans);
+    no_nans_t no_nans_path(trans_path, true, path.has_curves());
+    curve_t curved_path(no_nans_path);
+    contour_t contoured_path(curved_path);
+    contoured_path.width(r);
+    index.build(contoured_path);
+}
+
 inline bool
 point_in_path(const double x, const double y, const double r,
               PathIterator& path, const agg::trans_affine& trans)
@@ -389,54 +828,142 @@ _path_module::points_in_path(const Py::Tuple& args)
 }
 
 Py::Object
-_path_module::point_on_path(const Py::Tuple& args)
+_path_module::prepare_path(const Py::Tuple& args)
 {
-    double x = Py::Float(args[0]);
-    double y = Py::Float(args[1]);
+    args.verify_length(3);
+
+    PathIterator path(args[0]);
+    agg::trans_affine trans = py_to_agg_transformation_matrix(args[1].ptr(), false);
     double r = Py::Float(args[2]);
-    PathIterator path(args[3]);
-    agg::trans_affine trans = py_to_agg_transformation_matrix(args[4].ptr());
 
-    if (::point_on_path(x, y, r, path, trans))
-    {
-        return Py::Int(1);
-    }
-    return Py::Int(0);
+    PreparedPath* prepared = new PreparedPath();
+    Py::Object result = Py::asObject(prepared);
+    ::prepare_path(prepared->index, r, path, trans);
+    return result;
 }
 
 void
-update_limits(double x, double y,
-              double* x0, double* y0, double* x1, double* y1,
-              double* xm, double* ym)
+PreparedPath::init_type()
 {
-    if (x < *x0) *x0 = x;
-    if (y < *y0) *y0 = y;
-    if (x > *x1) *x1 = x;
-    if (y > *y1) *y1 = y;
-    /* xm and ym are the minimum positive values in the data, used
-       by log scaling */
-    if (x > 0.0 && x < *xm) *xm = x;
-    if (y > 0.0 && y < *ym) *ym = y;
+    behaviors().name("PreparedPath");
+    behaviors().doc("A path indexed for fast repeated point containment tests");
+
+    add_varargs_method("contains_point", &PreparedPath::contains_point,
+                       "contains_point(x, y)");
+    add_varargs_method("contains_points", &PreparedPath::contains_points,
+                       "contains_points(points, threads=1)\n"
+                       "threads=0 uses one thread per processor");
 }
 
-void
-get_path_extents(PathIterator& path, const agg::trans_affine& trans,
-                 double* x0, double* y0, double* x1, double* y1,
-                 double* xm, double* ym)
+Py::Object
+PreparedPath::contains_point(const Py::Tuple& args)
 {
-    typedef agg::conv_transform<PathIterator> transformed_path_t;
-    typedef PathNanRemover<transformed_path_t> nan_removed_t;
-    typedef agg::conv_curve<nan_removed_t> curve_t;
-    double x, y;
-    unsigned code;
+    args.verify_length(2);
 
-    transformed_path_t tpath(path, trans);
-    nan_removed_t nan_removed(tpath, true, path.has_curves());
+    double x = Py::Float(args[0]);
+    double y = Py::Float(args[1]);
 
-    nan_removed.rewind(0);
+    if (index.contains(x, y)) {
+        return Py::Int(1);
+    }
+    return Py::Int(0);
+}
 
-    while ((code = nan_removed.vertex(&x, &y)) != agg::path_cmd_stop)
-    {
+// The fewest points worth handing to a thread of their own
+#define MIN_POINTS_PER_THREAD 4096
+
+Py::Object
+PreparedPath::contains_points(const Py::Tuple& args)
+{
+    args.verify_length(1, 2);
+
+    int threads = 1;
+    if (args.size() == 2) {
+        threads = Py::Int(args[1]);
+        if (threads < 0) {
+            throw Py::ValueError("threads must be non-negative");
+        }
+        threads = mpl::resolve_num_threads(threads);
+    }
+
+    npy_intp n;
+    PyArrayObject* points_array;
+    points_array = (PyArrayObject*)PyArray_FromObject(args[0].ptr(), PyArray_DOUBLE, 2, 2);
+    if (points_array == NULL || PyArray_DIM(points_array, 1) != 2) {
+        Py_XDECREF(points_array);
+        throw Py::TypeError(
+            "Argument 0 to contains_points must be an Nx2 numpy array");
+    }
+
+    n = PyArray_DIM(points_array, 0);
+    PyObject* result = PyArray_ZEROS(1, &n, PyArray_BOOL, 0);
+    if (result == NULL) {
+        Py_DECREF(points_array);
+        throw Py::MemoryError("Could not allocate memory for result");
+    }
+
+    npy_intp block = n / std::numeric_limits<int>::max() + 1;
+    PointsInIndex task(index, (const char*)PyArray_DATA(points_array),
+                       PyArray_STRIDE(points_array, 0),
+                       PyArray_STRIDE(points_array, 1),
+                       (npy_bool *)PyArray_DATA(result), n, block);
+    threads = (int)std::min((npy_intp)threads, n / MIN_POINTS_PER_THREAD);
+    mpl::parallel_for(0, (int)((n + block - 1) / block), threads, task);
+    Py_DECREF(points_array);
+
+    return Py::Object(result, true);
+}
+
+Py::Object
+_path_module::point_on_path(const Py::Tuple& args)
+{
+    double x = Py::Float(args[0]);
+    double y = Py::Float(args[1]);
+    double r = Py::Float(args[2]);
+    PathIterator path(args[3]);
+    agg::trans_affine trans = py_to_agg_transformation_matrix(args[4].ptr());
+
+    if (::point_on_path(x, y, r, path, trans))
+    {
+        return Py::Int(1);
+    }
+    return Py::Int(0);
+}
+
+void
+update_limits(double x, double y,
+              double* x0, double* y0, double* x1, double* y1,
+              double* xm, double* ym)
+{
+    if (x < *x0) *x0 = x;
+    if (y < *y0) *y0 = y;
+    if (x > *x1) *x1 = x;
+    if (y > *y1) *y1 = y;
+    /* xm and ym are the minimum positive values in the data, used
+       by log scaling */
+    if (x > 0.0 && x < *xm) *xm = x;
+    if (y > 0.0 && y < *ym) *ym = y;
+}
+
+template<class T>
+void
+get_path_extents(T& path, const agg::trans_affine& trans,
+                 double* x0, double* y0, double* x1, double* y1,
+                 double* xm, double* ym)
+{
+    typedef agg::conv_transform<T> transformed_path_t;
+    typedef PathNanRemover<transformed_path_t> nan_removed_t;
+    typedef agg::conv_curve<nan_removed_t> curve_t;
+    double x, y;
+    unsigned code;
+
+    transformed_path_t tpath(path, trans);
+    nan_removed_t nan_removed(tpath, true, path.has_curves());
+
+    nan_removed.rewind(0);
+
+    while ((code = nan_removed.vertex(&x, &y)) != agg::path_cmd_stop)
+    {
         if ((code & agg::path_cmd_end_poly) == agg::path_cmd_end_poly)
         {
             continue;
@@ -618,20 +1145,239 @@ _path_module::update_path_extents(const Py::Tuple& args)
     return result;
 }
 
+/*
+ The vertices and codes of a path, exactly as PathIterator gives them,
+ copied out of the Python objects so that they can be iterated without
+ the GIL, by any number of PathCopyIterators at once.
+*/
+class PathCopy
+{
+public:
+    explicit PathCopy(PathIterator& path) :
+        curves(path.has_curves())
+    {
+        double x, y;
+        unsigned code;
+
+        vertices.reserve(path.total_vertices() * 2);
+        codes.reserve(path.total_vertices());
+        path.rewind(0);
+        while ((code = path.vertex(&x, &y)) != agg::path_cmd_stop)
+        {
+            vertices.push_back(x);
+            vertices.push_back(y);
+            codes.push_back(code);
+        }
+    }
+
+    std::vector<double> vertices;
+    std::vector<unsigned> codes;
+    bool curves;
+};
+
+class PathCopyIterator
+{
+public:
+    explicit PathCopyIterator(const PathCopy& path_) :
+        path(path_), i(0)
+    {
+    }
+
+    inline unsigned vertex(double* x, double* y)
+    {
+        if (i >= path.codes.size())
+        {
+            return agg::path_cmd_stop;
+        }
+        *x = path.vertices[2 * i];
+        *y = path.vertices[2 * i + 1];
+        return path.codes[i++];
+    }
+
+    inline void rewind(unsigned path_id)
+    {
+        i = path_id;
+    }
+
+    inline bool has_curves() const
+    {
+        return path.curves;
+    }
+
+private:
+    const PathCopy& path;
+    size_t i;
+};
+
+struct Limits
+{
+    double x0, y0, x1, y1, xm, ym;
+
+    Limits() :
+        x0(std::numeric_limits<double>::infinity()),
+        y0(std::numeric_limits<double>::infinity()),
+        x1(-std::numeric_limits<double>::infinity()),
+        y1(-std::numeric_limits<double>::infinity()),
+        xm(std::numeric_limits<double>::infinity()),
+        ym(std::numeric_limits<double>::infinity())
+    {
+    }
+
+    void update(const Limits& other)
+    {
+        x0 = std::min(x0, other.x0);
+        y0 = std::min(y0, other.y0);
+        x1 = std::max(x1, other.x1);
+        y1 = std::max(y1, other.y1);
+        xm = std::min(xm, other.xm);
+        ym = std::min(ym, other.ym);
+    }
+};
+
+/*
+ The limits of the items of a path collection, split into as many
+ blocks as there are limits to fill.  If a bbox is given, there is a
+ single path and transform whose extents it holds, and only the
+ offsets are walked; offsets with a NaN coordinate are skipped, as
+ PathNanRemover skips the vertices of the other items they would move.
+ Item i otherwise is path i % Npaths with transform i % Ntransforms
+ (or the master transform), moved by offset i % Noffsets if there are
+ any offsets, just as in the serial loop it replaces.
+*/
+class PathCollectionExtents
+{
+public:
+    PathCollectionExtents(const std::vector<PathCopy*>& paths_,
+                          const std::vector<agg::trans_affine>& transforms_,
+                          const agg::trans_affine& master_transform_,
+                          const char* offsets_, npy_intp stride0_, npy_intp stride1_,
+                          size_t Noffsets_, const agg::trans_affine& offset_trans_,
+                          const Limits* bbox_, size_t N_,
+                          std::vector<Limits>& limits_) :
+        paths(paths_), transforms(transforms_),
+        master_transform(master_transform_), offsets(offsets_),
+        stride0(stride0_), stride1(stride1_), Noffsets(Noffsets_),
+        offset_trans(offset_trans_), bbox(bbox_), N(N_), limits(limits_)
+    {
+    }
+
+    void operator()(int start, int end)
+    {
+        for (int block = start; block < end; ++block)
+        {
+            size_t begin = (size_t)(((double)N * block) / limits.size());
+            size_t stop = (size_t)(((double)N * (block + 1)) / limits.size());
+            if (bbox)
+            {
+                walk_offsets(begin, stop, limits[block]);
+            }
+            else
+            {
+                walk_items(begin, stop, limits[block]);
+            }
+        }
+    }
+
+private:
+    inline void offset(size_t i, double* xo, double* yo) const
+    {
+        const char* pair = offsets + stride0 * (npy_intp)(i % Noffsets);
+        *xo = *(const double*)pair;
+        *yo = *(const double*)(pair + stride1);
+        offset_trans.transform(xo, yo);
+    }
+
+    // Here N is Noffsets, so that the offsets can simply be stepped
+    // through
+    void walk_offsets(size_t begin, size_t end, Limits& l) const
+    {
+        const char* pair = offsets + stride0 * (npy_intp)begin;
+        double xo, yo;
+        for (size_t i = begin; i < end; ++i, pair += stride0)
+        {
+            xo = *(const double*)pair;
+            yo = *(const double*)(pair + stride1);
+            offset_trans.transform(&xo, &yo);
+            if (xo != xo || yo != yo)
+            {
+                continue;
+            }
+            update_limits(xo + bbox->x0, yo + bbox->y0,
+                          &l.x0, &l.y0, &l.x1, &l.y1, &l.xm, &l.ym);
+            update_limits(xo + bbox->x1, yo + bbox->y1,
+                          &l.x0, &l.y0, &l.x1, &l.y1, &l.xm, &l.ym);
+        }
+    }
+
+    void walk_items(size_t begin, size_t end, Limits& l) const
+    {
+        agg::trans_affine trans;
+        double xo, yo;
+        for (size_t i = begin; i < end; ++i)
+        {
+            if (transforms.size())
+            {
+                trans = transforms[i % transforms.size()];
+            }
+            else
+            {
+                trans = master_transform;
+            }
+
+            if (Noffsets)
+            {
+                offset(i, &xo, &yo);
+                trans *= agg::trans_affine_translation(xo, yo);
+            }
+
+            PathCopyIterator path(*paths[i % paths.size()]);
+            ::get_path_extents(path, trans, &l.x0, &l.y0, &l.x1, &l.y1, &l.xm, &l.ym);
+        }
+    }
+
+    const std::vector<PathCopy*>& paths;
+    const std::vector<agg::trans_affine>& transforms;
+    agg::trans_affine master_transform;
+    const char* offsets;
+    npy_intp stride0;
+    npy_intp stride1;
+    size_t Noffsets;
+    agg::trans_affine offset_trans;
+    const Limits* bbox;
+    size_t N;
+    std::vector<Limits>& limits;
+};
+
+// The fewest offsets, or path vertices, worth handing to a thread of
+// their own
+#define MIN_EXTENTS_WORK_PER_THREAD (1 << 16)
+
 Py::Object
 _path_module::get_path_collection_extents(const Py::Tuple& args)
 {
-    args.verify_length(5);
+    args.verify_length(5, 6);
 
     //segments, trans, clipbox, colors, linewidths, antialiaseds
     agg::trans_affine       master_transform = py_to_agg_transformation_matrix(args[0].ptr());
-    Py::SeqBase<Py::Object> paths            = args[1];
+    Py::SeqBase<Py::Object> paths_obj        = args[1];
     Py::SeqBase<Py::Object> transforms_obj   = args[2];
     Py::Object              offsets_obj      = args[3];
     agg::trans_affine       offset_trans     = py_to_agg_transformation_matrix(args[4].ptr(), false);
 
+    int threads = 0;
+    if (args.size() == 6)
+    {
+        threads = Py::Int(args[5]);
+        if (threads < 0)
+        {
+            throw Py::ValueError("threads must be non-negative");
+        }
+    }
+    threads = mpl::resolve_num_threads(threads);
+
     PyArrayObject* offsets = NULL;
-    double x0, y0, x1, y1, xm, ym;
+    std::vector<PathCopy*> paths;
+    Limits result_limits;
 
     try
     {
@@ -644,100 +1390,154 @@ _path_module::get_path_collection_extents(const Py::Tuple& args)
             throw Py::ValueError("Offsets array must be Nx2");
         }
 
-        size_t Npaths      = paths.length();
+        size_t Npaths      = paths_obj.length();
         size_t Noffsets    = offsets->dimensions[0];
         size_t N           = std::max(Npaths, Noffsets);
         size_t Ntransforms = std::min(transforms_obj.length(), N);
         size_t i;
 
-        // Convert all of the transforms up front
+        if (Npaths == 0)
+        {
+            throw Py::ValueError("No paths provided");
+        }
+
+        // Convert all of the transforms up front, straight from the
+        // array when they come as one
         typedef std::vector<agg::trans_affine> transforms_t;
         transforms_t transforms;
         transforms.reserve(Ntransforms);
-        for (i = 0; i < Ntransforms; ++i)
+        PyArrayObject* transforms_arr = NULL;
+        if (PyArray_Check(transforms_obj.ptr()))
+        {
+            transforms_arr = (PyArrayObject*)PyArray_FromObject(
+                transforms_obj.ptr(), PyArray_DOUBLE, 3, 3);
+            if (!transforms_arr ||
+                PyArray_DIM(transforms_arr, 1) != 3 ||
+                PyArray_DIM(transforms_arr, 2) != 3)
+            {
+                PyErr_Clear();
+                Py_XDECREF(transforms_arr);
+                transforms_arr = NULL;
+            }
+        }
+        if (transforms_arr)
+        {
+            for (i = 0; i < Ntransforms; ++i)
+            {
+                agg::trans_affine trans(
+                    *(double*)PyArray_GETPTR3(transforms_arr, i, 0, 0),
+                    *(double*)PyArray_GETPTR3(transforms_arr, i, 1, 0),
+                    *(double*)PyArray_GETPTR3(transforms_arr, i, 0, 1),
+                    *(double*)PyArray_GETPTR3(transforms_arr, i, 1, 1),
+                    *(double*)PyArray_GETPTR3(transforms_arr, i, 0, 2),
+                    *(double*)PyArray_GETPTR3(transforms_arr, i, 1, 2));
+                trans *= master_transform;
+                transforms.push_back(trans);
+            }
+            Py_DECREF(transforms_arr);
+        }
+        else
         {
-            agg::trans_affine trans = py_to_agg_transformation_matrix
-                (transforms_obj[i].ptr(), false);
-            trans *= master_transform;
-            transforms.push_back(trans);
+            for (i = 0; i < Ntransforms; ++i)
+            {
+                agg::trans_affine trans = py_to_agg_transformation_matrix
+                    (transforms_obj[i].ptr(), false);
+                trans *= master_transform;
+                transforms.push_back(trans);
+            }
         }
 
-        // The offset each of those and collect the mins/maxs
-        x0 = std::numeric_limits<double>::infinity();
-        y0 = std::numeric_limits<double>::infinity();
-        x1 = -std::numeric_limits<double>::infinity();
-        y1 = -std::numeric_limits<double>::infinity();
-        xm = std::numeric_limits<double>::infinity();
-        ym = std::numeric_limits<double>::infinity();
-        agg::trans_affine trans;
+        // Each distinct path is copied once, so that the items can be
+        // walked without the GIL
+        paths.reserve(Npaths);
+        size_t work = 0;
+        for (i = 0; i < Npaths; ++i)
+        {
+            PathIterator path(paths_obj[i]);
+            paths.push_back(new PathCopy(path));
+            work += path.total_vertices();
+        }
 
-        if (transforms.size() <= 1 && paths.size() == 1)
+        Limits bbox;
+        bool bbox_only = transforms.size() <= 1 && Npaths == 1;
+        if (bbox_only)
         {
-            PathIterator path(paths[0]);
-            if (Ntransforms)
+            PathCopyIterator path(*paths[0]);
+            ::get_path_extents(path, Ntransforms ? transforms[0] : master_transform,
+                               &bbox.x0, &bbox.y0, &bbox.x1, &bbox.y1,
+                               &bbox.xm, &bbox.ym);
+            if (Noffsets == 0)
             {
-                trans = transforms[0];
+                // Without offsets, that is all there is to it
+                result_limits = bbox;
+                N = 0;
             }
             else
             {
-                trans = master_transform;
+                N = Noffsets;
+                work = N;
             }
+        }
+        else
+        {
+            work = (work / Npaths + 1) * N;
+        }
 
-            double bx0 = std::numeric_limits<double>::infinity();
-            double by0 = std::numeric_limits<double>::infinity();
-            double bx1 = -std::numeric_limits<double>::infinity();
-            double by1 = -std::numeric_limits<double>::infinity();
-            double bxm = std::numeric_limits<double>::infinity();
-            double bym = std::numeric_limits<double>::infinity();
-
-            ::get_path_extents(path, trans, &bx0, &by0, &bx1, &by1, &bxm, &bym);
-
-            for (i = 0; i < Noffsets; ++i)
+        threads = (int)std::min((size_t)threads, work / MIN_EXTENTS_WORK_PER_THREAD);
+        threads = std::max(threads, 1);
+
+        std::vector<Limits> limits(threads);
+        PathCollectionExtents task(
+            paths, transforms, master_transform,
+            Noffsets ? PyArray_BYTES(offsets) : NULL,
+            Noffsets ? PyArray_STRIDE(offsets, 0) : 0,
+            Noffsets ? PyArray_STRIDE(offsets, 1) : 0,
+            Noffsets, offset_trans, bbox_only ? &bbox : NULL, N, limits);
+        if (N)
+        {
+            // The blocks only read the path copies and the numpy buffers
+            bool ok = true;
+            Py_BEGIN_ALLOW_THREADS
+            try
             {
-                double xo = *(double*)PyArray_GETPTR2(offsets, i % Noffsets, 0);
-                double yo = *(double*)PyArray_GETPTR2(offsets, i % Noffsets, 1);
-                offset_trans.transform(&xo, &yo);
-                update_limits(xo + bx0, yo + by0, &x0, &y0, &x1, &y1, &xm, &ym);
-                update_limits(xo + bx1, yo + by1, &x0, &y0, &x1, &y1, &xm, &ym);
+                mpl::parallel_for(0, threads, threads, task);
             }
-        } else {
-            for (i = 0; i < N; ++i)
+            catch (std::bad_alloc&)
             {
-                PathIterator path(paths[i % Npaths]);
-                if (Ntransforms)
-                {
-                    trans = transforms[i % Ntransforms];
-                }
-                else
-                {
-                    trans = master_transform;
-                }
-
-                if (Noffsets)
-                {
-                    double xo = *(double*)PyArray_GETPTR2(offsets, i % Noffsets, 0);
-                    double yo = *(double*)PyArray_GETPTR2(offsets, i % Noffsets, 1);
-                    offset_trans.transform(&xo, &yo);
-                    trans *= agg::trans_affine_translation(xo, yo);
-                }
-
-                ::get_path_extents(path, trans, &x0, &y0, &x1, &y1, &xm, &ym);
+                ok = false;
+            }
+            Py_END_ALLOW_THREADS
+            if (!ok)
+            {
+                throw Py::MemoryError("Could not allocate memory for threads");
             }
         }
+        for (i = 0; i < limits.size(); ++i)
+        {
+            result_limits.update(limits[i]);
+        }
     }
     catch (...)
     {
         Py_XDECREF(offsets);
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            delete paths[i];
+        }
         throw;
     }
 
     Py_XDECREF(offsets);
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        delete paths[i];
+    }
 
     Py::Tuple result(4);
-    result[0] = Py::Float(x0);
-    result[1] = Py::Float(y0);
-    result[2] = Py::Float(x1);
-    result[3] = Py::Float(y1);
+    result[0] = Py::Float(result_limits.x0);
+    result[1] = Py::Float(result_limits.y0);
+    result[2] = Py::Float(result_limits.x1);
+    result[3] = Py::Float(result_limits.y1);
     return result;
 }
 
@@ -1148,13 +1948,120 @@ _path_module::clip_path_to_rect(const Py::Tuple &args)
     return Py::Object(py_results, true);
 }
 
+/*
+ Applies the affine transform (a, b, c, d, e, f) to the n points of an
+ Nx2 array, as x' = a*x + c*y + e, y' = b*x + d*y + f with every
+ product and sum rounded on its own, whatever the strides and however
+ many threads it is split between.  The output is contiguous, and may
+ be the input itself.  operator() transforms the blocks [start, end)
+ of block points each, so that any number of points can be counted in
+ the int range of mpl::parallel_for.
+*/
+class AffineTransformPoints
+{
+public:
+    AffineTransformPoints(const char* in, size_t stride0, size_t stride1,
+                          double* out, const double* m,
+                          npy_intp n, npy_intp block) :
+        in(in), stride0(stride0), stride1(stride1), out(out),
+        a(m[0]), b(m[1]), c(m[2]), d(m[3]), e(m[4]), f(m[5]),
+        n(n), block(block)
+    {
+    }
+
+    void operator()(int start, int end)
+    {
+        transform(start * block, std::min(end * block, n));
+    }
+
+private:
+    void transform(npy_intp start, npy_intp end)
+    {
+        double* vertex_out = out + 2 * (size_t)start;
+
+#ifdef MPL_AFFINE_SSE2
+        if (stride0 == 2 * sizeof(double) && stride1 == sizeof(double))
+        {
+            const double* vertex_in = (const double*)in + 2 * (size_t)start;
+            const __m128d ab = _mm_set_pd(b, a);
+            const __m128d cd = _mm_set_pd(d, c);
+            const __m128d ef = _mm_set_pd(f, e);
+            for (npy_intp i = start; i < end; ++i)
+            {
+                __m128d v = _mm_loadu_pd(vertex_in);
+                __m128d x = _mm_unpacklo_pd(v, v);
+                __m128d y = _mm_unpackhi_pd(v, v);
+                __m128d t = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ab, x),
+                                                  _mm_mul_pd(cd, y)),
+                                       ef);
+                _mm_storeu_pd(vertex_out, t);
+                vertex_in += 2;
+                vertex_out += 2;
+            }
+            return;
+        }
+#endif
+
+        const char* vertex_in = in + stride0 * start;
+        double x;
+        double y;
+        volatile double t0;
+        volatile double t1;
+        volatile double t;
+
+        for (npy_intp i = start; i < end; ++i)
+        {
+            x = *(double*)(vertex_in);
+            y = *(double*)(vertex_in + stride1);
+
+            t0 = a * x;
+            t1 = c * y;
+            t = t0 + t1 + e;
+            *(vertex_out++) = t;
+
+            t0 = b * x;
+            t1 = d * y;
+            t = t0 + t1 + f;
+            *(vertex_out++) = t;
+
+            vertex_in += stride0;
+        }
+    }
+
+    const char* in;
+    size_t stride0;
+    size_t stride1;
+    double* out;
+    double a, b, c, d, e, f;
+    npy_intp n;
+    npy_intp block;
+};
+
+// The fewest points worth handing to a thread of their own
+#define MIN_TRANSFORM_POINTS_PER_THREAD (1 << 18)
+
 Py::Object
 _path_module::affine_transform(const Py::Tuple& args)
 {
-    args.verify_length(2);
+    args.verify_length(2, 4);
 
     Py::Object vertices_obj = args[0];
     Py::Object transform_obj = args[1];
+    Py::Object out_obj;
+    if (args.size() >= 3)
+    {
+        out_obj = args[2];
+    }
+    int threads = 0;
+    if (args.size() == 4)
+    {
+        threads = Py::Int(args[3]);
+        if (threads < 0)
+        {
+            throw Py::ValueError("threads must be non-negative");
+        }
+    }
+    threads = mpl::resolve_num_threads(threads);
 
     PyArrayObject* vertices = NULL;
     PyArrayObject* transform = NULL;
@@ -1182,63 +2089,68 @@ _path_module::affine_transform(const Py::Tuple& args)
             throw Py::ValueError("Invalid transform.");
         }
 
-        double a, b, c, d, e, f;
+        double m[6];
         {
             size_t stride0 = PyArray_STRIDE(transform, 0);
             size_t stride1 = PyArray_STRIDE(transform, 1);
             char* row0 = PyArray_BYTES(transform);
             char* row1 = row0 + stride0;
 
-            a = *(double*)(row0);
+            m[0] = *(double*)(row0);
             row0 += stride1;
-            c = *(double*)(row0);
+            m[2] = *(double*)(row0);
             row0 += stride1;
-            e = *(double*)(row0);
+            m[4] = *(double*)(row0);
 
-            b = *(double*)(row1);
+            m[1] = *(double*)(row1);
             row1 += stride1;
-            d = *(double*)(row1);
+            m[3] = *(double*)(row1);
             row1 += stride1;
-            f = *(double*)(row1);
+            m[5] = *(double*)(row1);
         }
 
-        result = (PyArrayObject*)PyArray_SimpleNew
-                 (PyArray_NDIM(vertices), PyArray_DIMS(vertices), PyArray_DOUBLE);
-        if (result == NULL)
+        if (out_obj.isNone())
         {
-            throw Py::MemoryError("Could not allocate memory for path");
+            result = (PyArrayObject*)PyArray_SimpleNew
+                     (PyArray_NDIM(vertices), PyArray_DIMS(vertices), PyArray_DOUBLE);
+            if (result == NULL)
+            {
+                throw Py::MemoryError("Could not allocate memory for path");
+            }
         }
-        if (PyArray_NDIM(vertices) == 2)
+        else
         {
-            size_t n = PyArray_DIM(vertices, 0);
-            char* vertex_in = PyArray_BYTES(vertices);
-            double* vertex_out = (double*)PyArray_DATA(result);
-            size_t stride0 = PyArray_STRIDE(vertices, 0);
-            size_t stride1 = PyArray_STRIDE(vertices, 1);
-            double x;
-            double y;
-            volatile double t0;
-	    volatile double t1;
-	    volatile double t;
-
-            for (size_t i = 0; i < n; ++i)
+            // The results are written straight into out, which may be
+            // the vertices array itself
+            if (!PyArray_Check(out_obj.ptr()))
             {
-                x = *(double*)(vertex_in);
-                y = *(double*)(vertex_in + stride1);
-
-		t0 = a * x;
-		t1 = c * y;
-                t = t0 + t1 + e;
-                *(vertex_out++) = t;
-
-		t0 = b * x;
-		t1 = d * y;
-                t = t0 + t1 + f;
-                *(vertex_out++) = t;
-
-                vertex_in += stride0;
+                throw Py::TypeError("out must be a numpy array");
+            }
+            result = (PyArrayObject*)out_obj.ptr();
+            Py_INCREF(result);
+            if (PyArray_TYPE(result) != NPY_DOUBLE ||
+                !PyArray_ISCARRAY(result) ||
+                !PyArray_SAMESHAPE(result, vertices))
+            {
+                throw Py::ValueError(
+                    "out must be a writable, contiguous float64 array "
+                    "of the same shape as vertices");
             }
         }
+
+        if (PyArray_NDIM(vertices) == 2)
+        {
+            npy_intp n = PyArray_DIM(vertices, 0);
+            npy_intp block = n / std::numeric_limits<int>::max() + 1;
+            AffineTransformPoints task(
+                PyArray_BYTES(vertices),
+                PyArray_STRIDE(vertices, 0), PyArray_STRIDE(vertices, 1),
+                (double*)PyArray_DATA(result), m, n, block);
+            threads = (int)std::min((npy_intp)threads,
+                                    n / MIN_TRANSFORM_POINTS_PER_THREAD);
+            mpl::parallel_for(0, (int)((n + block - 1) / block), threads,
+                              task);
+        }
         else if (PyArray_DIM(vertices, 0) != 0)
         {
             char* vertex_in = PyArray_BYTES(vertices);
@@ -1248,8 +2160,8 @@ _path_module::affine_transform(const Py::Tuple& args)
             double y;
             x = *(double*)(vertex_in);
             y = *(double*)(vertex_in + stride0);
-            *vertex_out++ = a * x + c * y + e;
-            *vertex_out++ = b * x + d * y + f;
+            *vertex_out++ = m[0] * x + m[2] * y + m[4];
+            *vertex_out++ = m[1] * x + m[3] * y + m[5];
         }
     }
     catch (...)
@@ -1266,18 +2178,387 @@ _path_module::affine_transform(const Py::Tuple& args)
     return Py::Object((PyObject*)result, true);
 }
 
+// The number of children of each node of a BboxTree
+#define BBOX_TREE_FANOUT 16
+
+inline void
+normalize_box(BboxTree::box& b)
+{
+    if (b.x1 < b.x0)
+    {
+        std::swap(b.x0, b.x1);
+    }
+    if (b.y1 < b.y0)
+    {
+        std::swap(b.y0, b.y1);
+    }
+}
+
+inline bool
+box_is_regular(const BboxTree::box& b)
+{
+    return (b.x0 == b.x0 && b.y0 == b.y0 &&
+            b.x1 == b.x1 && b.y1 == b.y1);
+}
+
+// Whether b overlaps a, both normalized (the test used by
+// count_bboxes_overlapping_bbox)
+inline bool
+boxes_overlap(const BboxTree::box& a, const BboxTree::box& b)
+{
+    return !((b.x1 <= a.x0) ||
+             (b.y1 <= a.y0) ||
+             (b.x0 >= a.x1) ||
+             (b.y0 >= a.y1));
+}
+
+struct BoxCenterLess
+{
+    BoxCenterLess(const std::vector<BboxTree::box>& boxes_, bool by_x_) :
+        boxes(boxes_), by_x(by_x_)
+    {
+    }
+
+    bool operator()(size_t a, size_t b) const
+    {
+        const BboxTree::box& ba = boxes[a];
+        const BboxTree::box& bb = boxes[b];
+        if (by_x)
+        {
+            return ba.x0 + ba.x1 < bb.x0 + bb.x1;
+        }
+        return ba.y0 + ba.y1 < bb.y0 + bb.y1;
+    }
+
+    const std::vector<BboxTree::box>& boxes;
+    bool by_x;
+};
+
+void
+BboxTree::build(const std::vector<box>& boxes_)
+{
+    boxes = boxes_;
+    levels.clear();
+    items.clear();
+    irregular.clear();
+
+    for (size_t i = 0; i < boxes.size(); ++i)
+    {
+        normalize_box(boxes[i]);
+        if (box_is_regular(boxes[i]))
+        {
+            items.push_back(i);
+        }
+        else
+        {
+            irregular.push_back(i);
+        }
+    }
+
+    if (items.empty())
+    {
+        return;
+    }
+
+    // Sort-Tile-Recursive: cut the boxes into vertical slices by x,
+    // then order each slice by y, so that runs of BBOX_TREE_FANOUT
+    // boxes are compact leaves
+    size_t n = items.size();
+    size_t leaves = (n + BBOX_TREE_FANOUT - 1) / BBOX_TREE_FANOUT;
+    size_t slices = (size_t)ceil(sqrt((double)leaves));
+    size_t slice_size = ((leaves + slices - 1) / slices) * BBOX_TREE_FANOUT;
+
+    std::stable_sort(items.begin(), items.end(), BoxCenterLess(boxes, true));
+    for (size_t start = 0; start < n; start += slice_size)
+    {
+        size_t end = std::min(start + slice_size, n);
+        std::stable_sort(items.begin() + start, items.begin() + end,
+                         BoxCenterLess(boxes, false));
+    }
+
+    levels.push_back(std::vector<box>(n));
+    for (size_t i = 0; i < n; ++i)
+    {
+        levels[0][i] = boxes[items[i]];
+    }
+
+    while (levels.back().size() > 1)
+    {
+        const std::vector<box>& below = levels.back();
+        std::vector<box> level((below.size() + BBOX_TREE_FANOUT - 1) / BBOX_TREE_FANOUT);
+        for (size_t i = 0; i < level.size(); ++i)
+        {
+            size_t start = i * BBOX_TREE_FANOUT;
+            size_t end = std::min(start + BBOX_TREE_FANOUT, below.size());
+            box bounds = below[start];
+            for (size_t j = start + 1; j < end; ++j)
+            {
+                bounds.x0 = std::min(bounds.x0, below[j].x0);
+                bounds.y0 = std::min(bounds.y0, below[j].y0);
+                bounds.x1 = std::max(bounds.x1, below[j].x1);
+                bounds.y1 = std::max(bounds.y1, below[j].y1);
+            }
+            level[i] = bounds;
+        }
+        levels.push_back(level);
+    }
+}
+
+/*
+ Call visit(i) for every box i that overlaps q (which must be
+ normalized), in no particular order, until it returns false.  Returns
+ false if the query was stopped that way.  A node that doesn't overlap
+ q can't have a box that does, since the test only involves the
+ extreme coordinates, so its subtree is skipped.
+*/
+template<class Visitor>
+bool
+BboxTree::query(const box& q, Visitor& visit) const
+{
+    if (!box_is_regular(q))
+    {
+        for (size_t i = 0; i < boxes.size(); ++i)
+        {
+            if (boxes_overlap(q, boxes[i]) && !visit(i))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    for (size_t i = 0; i < irregular.size(); ++i)
+    {
+        if (boxes_overlap(q, boxes[irregular[i]]) && !visit(irregular[i]))
+        {
+            return false;
+        }
+    }
+
+    if (levels.empty())
+    {
+        return true;
+    }
+
+    std::vector<std::pair<size_t, size_t> > stack;  // (level, node)
+    stack.push_back(std::make_pair(levels.size() - 1, (size_t)0));
+    while (!stack.empty())
+    {
+        size_t level = stack.back().first;
+        size_t node = stack.back().second;
+        stack.pop_back();
+
+        if (!boxes_overlap(q, levels[level][node]))
+        {
+            continue;
+        }
+
+        if (level == 0)
+        {
+            if (!visit(items[node]))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        size_t start = node * BBOX_TREE_FANOUT;
+        size_t end = std::min(start + BBOX_TREE_FANOUT, levels[level - 1].size());
+        for (size_t child = start; child < end; ++child)
+        {
+            stack.push_back(std::make_pair(level - 1, child));
+        }
+    }
+
+    return true;
+}
+
+struct CollectBoxes
+{
+    CollectBoxes(std::vector<size_t>& result_) : result(result_) {}
+
+    bool operator()(size_t i)
+    {
+        result.push_back(i);
+        return true;
+    }
+
+    std::vector<size_t>& result;
+};
+
+struct CountBoxes
+{
+    CountBoxes() : count(0) {}
+
+    bool operator()(size_t)
+    {
+        ++count;
+        return true;
+    }
+
+    size_t count;
+};
+
+void
+BboxTree::overlapping(box q, std::vector<size_t>& result) const
+{
+    normalize_box(q);
+    size_t start = result.size();
+    CollectBoxes collect(result);
+    query(q, collect);
+    std::sort(result.begin() + start, result.end());
+}
+
+size_t
+BboxTree::count_overlapping(box q) const
+{
+    normalize_box(q);
+    CountBoxes count;
+    query(q, count);
+    return count.count;
+}
+
+/*
+ Convert an Nx4 array (or anything that can be turned into one) of
+ (x0, y0, x1, y1) rows into boxes.  An empty sequence gives no boxes.
+*/
+static void
+py_to_boxes(const Py::Object& obj, std::vector<BboxTree::box>& boxes,
+            const char* name)
+{
+    PyArrayObject* extents = (PyArrayObject*)PyArray_FromObject(
+        obj.ptr(), PyArray_DOUBLE, 1, 2);
+    if (extents == NULL)
+    {
+        throw Py::Exception();
+    }
+
+    npy_intp n = 0;
+    if (PyArray_NDIM(extents) == 2 && PyArray_DIM(extents, 1) == 4)
+    {
+        n = PyArray_DIM(extents, 0);
+    }
+    else if (PyArray_SIZE(extents) != 0)
+    {
+        Py_DECREF(extents);
+        throw Py::ValueError(
+            std::string(name) + " must be an Nx4 array of (x0, y0, x1, y1)");
+    }
+
+    boxes.resize(n);
+    for (npy_intp i = 0; i < n; ++i)
+    {
+        boxes[i].x0 = *(double*)PyArray_GETPTR2(extents, i, 0);
+        boxes[i].y0 = *(double*)PyArray_GETPTR2(extents, i, 1);
+        boxes[i].x1 = *(double*)PyArray_GETPTR2(extents, i, 2);
+        boxes[i].y1 = *(double*)PyArray_GETPTR2(extents, i, 3);
+    }
+    Py_DECREF(extents);
+}
+
+Py::Object
+_path_module::bbox_index(const Py::Tuple& args)
+{
+    args.verify_length(1);
+
+    std::vector<BboxTree::box> boxes;
+    py_to_boxes(args[0], boxes, "extents");
+
+    BboxIndex* index = new BboxIndex();
+    Py::Object result = Py::asObject(index);
+    index->tree.build(boxes);
+    return result;
+}
+
+void
+BboxIndex::init_type()
+{
+    behaviors().name("BboxIndex");
+    behaviors().doc("A set of bboxes indexed for fast overlap queries");
+
+    add_varargs_method("count_overlaps", &BboxIndex::count_overlaps,
+                       "count_overlaps(extents)");
+    add_varargs_method("overlapping", &BboxIndex::overlapping,
+                       "overlapping(extents)");
+}
+
+Py::Object
+BboxIndex::count_overlaps(const Py::Tuple& args)
+{
+    args.verify_length(1);
+
+    std::vector<BboxTree::box> queries;
+    py_to_boxes(args[0], queries, "extents");
+
+    npy_intp n = queries.size();
+    PyObject* result = PyArray_SimpleNew(1, &n, NPY_INTP);
+    if (result == NULL)
+    {
+        throw Py::MemoryError("Could not allocate memory for result");
+    }
+
+    npy_intp* counts = (npy_intp*)PyArray_DATA((PyArrayObject*)result);
+    for (npy_intp i = 0; i < n; ++i)
+    {
+        counts[i] = (npy_intp)tree.count_overlapping(queries[i]);
+    }
+
+    return Py::Object(result, true);
+}
+
+Py::Object
+BboxIndex::overlapping(const Py::Tuple& args)
+{
+    args.verify_length(1);
+
+    std::vector<BboxTree::box> queries;
+    py_to_boxes(args[0], queries, "extents");
+
+    Py::List result(queries.size());
+    std::vector<size_t> found;
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        found.clear();
+        tree.overlapping(queries[i], found);
+
+        npy_intp n = found.size();
+        PyObject* indices = PyArray_SimpleNew(1, &n, NPY_INTP);
+        if (indices == NULL)
+        {
+            throw Py::MemoryError("Could not allocate memory for result");
+        }
+        npy_intp* data = (npy_intp*)PyArray_DATA((PyArrayObject*)indices);
+        for (npy_intp j = 0; j < n; ++j)
+        {
+            data[j] = (npy_intp)found[j];
+        }
+        result[i] = Py::Object(indices, true);
+    }
+
+    return result;
+}
+
 Py::Object
 _path_module::count_bboxes_overlapping_bbox(const Py::Tuple& args)
 {
     args.verify_length(2);
 
     Py::Object              bbox   = args[0];
-    Py::SeqBase<Py::Object> bboxes = args[1];
 
     double ax0, ay0, ax1, ay1;
     double bx0, by0, bx1, by1;
     long count = 0;
 
+    if (BboxIndex::check(args[1]) &&
+        py_convert_bbox(bbox.ptr(), ax0, ay0, ax1, ay1))
+    {
+        BboxTree::box q = {ax0, ay0, ax1, ay1};
+        BboxIndex* index = static_cast<BboxIndex*>(args[1].ptr());
+        return Py::Int((long)index->tree.count_overlapping(q));
+    }
+
+    Py::SeqBase<Py::Object> bboxes = args[1];
+
     if (py_convert_bbox(bbox.ptr(), ax0, ay0, ax1, ay1))
     {
         if (ax1 < ax0)
@@ -1347,70 +2628,933 @@ segments_intersect(const double& x1, const double& y1,
             u2 >= 0.0 && u2 <= 1.0);
 }
 
-bool
-path_intersects_path(PathIterator& p1, PathIterator& p2)
+/*
+ The vertices of a path as path_intersects_path sees them: curves are
+ converted to line segments and non-finite vertices are skipped.  Every
+ pair of consecutive vertices is taken as a segment, whatever the path
+ codes say.
+*/
+static void
+path_intersection_vertices(PathIterator& path, std::vector<XY>& points)
 {
     typedef PathNanRemover<PathIterator> no_nans_t;
     typedef agg::conv_curve<no_nans_t> curve_t;
 
-    if (p1.total_vertices() < 2 || p2.total_vertices() < 2)
+    points.clear();
+    if (path.total_vertices() < 2)
+    {
+        return;
+    }
+
+    no_nans_t no_nans(path, true, path.has_curves());
+    curve_t curve(no_nans);
+
+    double x, y;
+    curve.rewind(0);
+    while (curve.vertex(&x, &y) != agg::path_cmd_stop)
+    {
+        points.push_back(XY(x, y));
+    }
+}
+
+// Segments are only indexed for the smaller of the two paths when it
+// has at least this many of them; below that testing every pair of
+// segments is cheaper
+#define MIN_INDEXED_SEGMENTS 32
+
+/*
+ The segments of a path in a BboxTree, for finding the ones that may
+ intersect a given segment.  Each segment's box is padded a little
+ relative to its coordinates, so that segments whose boxes only touch,
+ or miss each other by less than segments_intersect's rounding error,
+ are still found and then given to segments_intersect to decide.
+*/
+class SegmentIndex
+{
+public:
+    explicit SegmentIndex(const std::vector<XY>& points_) :
+        points(points_)
+    {
+        std::vector<BboxTree::box> boxes(points.size() > 1 ? points.size() - 1 : 0);
+        for (size_t i = 0; i < boxes.size(); ++i)
+        {
+            boxes[i] = segment_box(points[i], points[i + 1]);
+        }
+        tree.build(boxes);
+    }
+
+    static BboxTree::box
+    segment_box(const XY& a, const XY& b)
+    {
+        BboxTree::box box = {std::min(a.x, b.x), std::min(a.y, b.y),
+                             std::max(a.x, b.x), std::max(a.y, b.y)};
+        double scale = std::max(std::max(fabs(box.x0), fabs(box.x1)),
+                                std::max(fabs(box.y0), fabs(box.y1)));
+        double pad = scale * 1e-9;
+        box.x0 -= pad;
+        box.y0 -= pad;
+        box.x1 += pad;
+        box.y1 += pad;
+        return box;
+    }
+
+    const std::vector<XY>& points;
+    BboxTree tree;
+};
+
+/*
+ Tests a segment of the other path against the indexed segments it may
+ cross, stopping at the first intersection.  The arguments are passed
+ to segments_intersect in the same order as the unindexed loop does.
+*/
+struct SegmentIntersects
+{
+    SegmentIntersects(const SegmentIndex& index_, bool index_first_) :
+        index(index_), index_first(index_first_),
+        c(0.0, 0.0), d(0.0, 0.0), found(false)
+    {
+    }
+
+    bool operator()(size_t i)
+    {
+        const XY& a = index.points[i];
+        const XY& b = index.points[i + 1];
+        if (index_first)
+        {
+            found = segments_intersect(a.x, a.y, b.x, b.y, c.x, c.y, d.x, d.y);
+        }
+        else
+        {
+            found = segments_intersect(c.x, c.y, d.x, d.y, a.x, a.y, b.x, b.y);
+        }
+        return !found;
+    }
+
+    const SegmentIndex& index;
+    bool index_first;
+    XY c, d;
+    bool found;
+};
+
+/*
+ Whether any segment of the indexed path intersects any segment made
+ of consecutive points.  index_first tells whether the indexed path is
+ the first argument of path_intersects_path.
+*/
+static bool
+segments_intersect_index(const SegmentIndex& index, bool index_first,
+                         const std::vector<XY>& points)
+{
+    SegmentIntersects visit(index, index_first);
+    for (size_t i = 1; i < points.size(); ++i)
+    {
+        visit.c = points[i - 1];
+        visit.d = points[i];
+        if (!index.tree.query(SegmentIndex::segment_box(visit.c, visit.d), visit))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+segments_intersect_all_pairs(const std::vector<XY>& points1,
+                             const std::vector<XY>& points2)
+{
+    for (size_t i = 1; i < points1.size(); ++i)
+    {
+        const XY& a = points1[i - 1];
+        const XY& b = points1[i];
+        for (size_t j = 1; j < points2.size(); ++j)
+        {
+            const XY& c = points2[j - 1];
+            const XY& d = points2[j];
+            if (segments_intersect(a.x, a.y, b.x, b.y, c.x, c.y, d.x, d.y))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+ Whether any segment of p1 intersects any segment of p2.  For large
+ paths the segments of the smaller one are indexed by their bounding
+ boxes, so each segment of the other is only tested against the few it
+ may cross, rather than against all of them.
+*/
+bool
+path_intersects_path(PathIterator& p1, PathIterator& p2)
+{
+    std::vector<XY> points1, points2;
+    path_intersection_vertices(p1, points1);
+    path_intersection_vertices(p2, points2);
+
+    if (points1.size() < 2 || points2.size() < 2)
+    {
+        return false;
+    }
+
+    if (std::min(points1.size(), points2.size()) <= MIN_INDEXED_SEGMENTS)
+    {
+        return segments_intersect_all_pairs(points1, points2);
+    }
+
+    if (points1.size() <= points2.size())
+    {
+        SegmentIndex index(points1);
+        return segments_intersect_index(index, true, points2);
+    }
+    SegmentIndex index(points2);
+    return segments_intersect_index(index, false, points1);
+}
+
+Py::Object
+_path_module::path_intersects_path(const Py::Tuple& args)
+{
+    args.verify_length(2, 3);
+
+    PathIterator p1(args[0]);
+    PathIterator p2(args[1]);
+    bool filled = false;
+
+    if (args.size() == 3)
+    {
+        filled = args[2].isTrue();
+    }
+
+    if (!filled)
+    {
+        return Py::Int(::path_intersects_path(p1, p2));
+    }
+    else
+    {
+        return Py::Int(::path_intersects_path(p1, p2)
+                       || ::path_in_path(p1, agg::trans_affine(), p2, agg::trans_affine())
+                       || ::path_in_path(p2, agg::trans_affine(), p1, agg::trans_affine()));
+    }
+}
+
+Py::Object
+_path_module::path_intersects_paths(const Py::Tuple& args)
+{
+    args.verify_length(2, 3);
+
+    PathIterator path(args[0]);
+    Py::SeqBase<Py::Object> paths = args[1];
+    bool filled = false;
+
+    if (args.size() == 3)
+    {
+        filled = args[2].isTrue();
+    }
+
+    // The segments of the first path are indexed once for all the
+    // others, whatever their size
+    std::vector<XY> points, other_points;
+    path_intersection_vertices(path, points);
+    SegmentIndex index(points);
+
+    npy_intp n = paths.length();
+    PyObject* result = PyArray_ZEROS(1, &n, PyArray_BOOL, 0);
+    if (result == NULL)
+    {
+        throw Py::MemoryError("Could not allocate memory for result");
+    }
+    Py::Object result_obj(result, true);
+    npy_bool* intersects = (npy_bool*)PyArray_DATA((PyArrayObject*)result);
+
+    for (npy_intp i = 0; i < n; ++i)
+    {
+        PathIterator other(paths[i]);
+        path_intersection_vertices(other, other_points);
+        bool hit = (points.size() >= 2 && other_points.size() >= 2 &&
+                    segments_intersect_index(index, true, other_points));
+        if (!hit && filled)
+        {
+            hit = (::path_in_path(path, agg::trans_affine(), other, agg::trans_affine()) ||
+                   ::path_in_path(other, agg::trans_affine(), path, agg::trans_affine()));
+        }
+        intersects[i] = hit;
+    }
+
+    return result_obj;
+}
+
+/*
+ Boolean operations between the regions filled by two paths.  Every
+ subpath is closed implicitly, curves are converted to line segments,
+ and the regions are taken with the even-odd rule.
+
+ The edges of both paths are first snap rounded.  Their ends, and the
+ points where any two of them cross, are rounded to an integer grid
+ laid over the bounding box of both paths, and each edge is bent
+ through every such rounded point whose grid cell (the unit square
+ around it) it passes through.  Any two of the resulting segments then
+ either coincide or only meet at their ends, however many edges met at
+ or ran along a point before.  Coinciding segments are merged, and for
+ each remaining one the ray-crossing parity of both paths is found
+ just to its left and just to its right.  A segment is on the boundary
+ of the result if the operation gives a different answer on the two
+ sides; it is oriented so that the result lies to its left.  Finally,
+ the boundary segments are linked up into closed rings, so that outer
+ boundaries run counterclockwise and holes clockwise.
+
+ The grid is fine enough to leave the result within a few parts in
+ 10**8 of the size of the paths, and coarse enough that every test on
+ grid points, and on the points halfway between them, is exact in
+ double precision.
+*/
+enum e_boolean_op
+{
+    BOOLEAN_INTERSECTION,
+    BOOLEAN_UNION,
+    BOOLEAN_DIFFERENCE
+};
+
+// Snapped coordinates are integers of at most this many bits, so that
+// orientation() and position_along() of grid points and half-integer
+// points stay below 2**53, and exact
+#define BOOLEAN_GRID_BITS 24
+
+inline bool
+operator==(const XY& a, const XY& b)
+{
+    return a.x == b.x && a.y == b.y;
+}
+
+inline bool
+operator<(const XY& a, const XY& b)
+{
+    return a.x < b.x || (a.x == b.x && a.y < b.y);
+}
+
+// Twice the signed area of the triangle (p, q, r): positive if r is to
+// the left of the line from p to q
+inline double
+orientation(const XY& p, const XY& q, const XY& r)
+{
+    return (q.x - p.x) * (r.y - p.y) - (q.y - p.y) * (r.x - p.x);
+}
+
+class PolygonBoolean
+{
+public:
+    PolygonBoolean() : center(0.0, 0.0), scale(0)
+    {
+    }
+
+    template<class T>
+    void add_path(T& path, int which);
+
+    void compute(e_boolean_op op, std::vector<double>& vertices,
+                 std::vector<npy_uint8>& codes);
+
+private:
+    struct edge
+    {
+        XY p0, p1;
+        int which;
+        std::vector<XY> splits;
+
+        edge(const XY& p0_, const XY& p1_, int which_) :
+            p0(p0_), p1(p1_), which(which_)
+        {
+        }
+    };
+
+    struct segment
+    {
+        XY p0, p1;         // p0 < p1
+        int count[2];      // how many edges of each path run along it
+    };
+
+    struct crossing_visitor;
+    struct route_visitor;
+    struct parity_visitor;
+    friend struct crossing_visitor;
+    friend struct route_visitor;
+    friend struct parity_visitor;
+
+    std::vector<edge> edges;
+    std::vector<segment> segments;
+
+    // The grid: a point p is snapped to (p - center) * 2**scale
+    XY center;
+    int scale;
+
+    void add_ring(std::vector<XY>& ring, int which);
+    void snap_edges();
+    void cross(size_t i, size_t j, std::vector<XY>& hot) const;
+    void route_edges();
+    void build_segments();
+    void inside_left(size_t s, const BboxTree& tree, bool inside[2]) const;
+    static void link(const std::vector<std::pair<XY, XY> >& boundary,
+                     std::vector<double>& vertices,
+                     std::vector<npy_uint8>& codes);
+};
+
+template<class T>
+void
+PolygonBoolean::add_path(T& path, int which)
+{
+    std::vector<XY> ring;
+    double x, y;
+    unsigned code;
+
+    path.rewind(0);
+    while ((code = path.vertex(&x, &y)) != agg::path_cmd_stop)
+    {
+        if (code == agg::path_cmd_move_to)
+        {
+            add_ring(ring, which);
+            ring.push_back(XY(x, y));
+        }
+        else if ((code & agg::path_cmd_end_poly) == agg::path_cmd_end_poly)
+        {
+            add_ring(ring, which);
+        }
+        else
+        {
+            ring.push_back(XY(x, y));
+        }
+    }
+    add_ring(ring, which);
+}
+
+void
+PolygonBoolean::add_ring(std::vector<XY>& ring, int which)
+{
+    for (size_t i = 0; i < ring.size(); ++i)
+    {
+        const XY& p0 = ring[i];
+        const XY& p1 = ring[(i + 1) % ring.size()];
+        if (!(p0 == p1))
+        {
+            edges.push_back(edge(p0, p1, which));
+        }
+    }
+    ring.clear();
+}
+
+// How far r is along the line from p to q, in units of the squared
+// length of pq
+inline double
+position_along(const XY& p, const XY& q, const XY& r)
+{
+    return (r.x - p.x) * (q.x - p.x) + (r.y - p.y) * (q.y - p.y);
+}
+
+// (x - c) * 2**shift, without overflowing on the way
+inline double
+shifted_difference(double x, double c, int shift)
+{
+    return shift < 0 ? ldexp(x, shift) - ldexp(c, shift) : ldexp(x - c, shift);
+}
+
+// Whether the segment from p to q meets the closed unit square around
+// the grid point c
+inline bool
+passes_through(const XY& p, const XY& q, const XY& c)
+{
+    if (std::max(p.x, q.x) < c.x - 0.5 || std::min(p.x, q.x) > c.x + 0.5 ||
+        std::max(p.y, q.y) < c.y - 0.5 || std::min(p.y, q.y) > c.y + 0.5)
+    {
+        return false;
+    }
+
+    // Then it does, unless the line leaves all the corners on one side
+    int sides = 0;
+    for (int k = 0; k < 4; ++k)
+    {
+        XY corner(c.x + ((k & 1) ? 0.5 : -0.5), c.y + ((k & 2) ? 0.5 : -0.5));
+        double o = orientation(p, q, corner);
+        sides |= (o > 0.0) ? 1 : (o < 0.0) ? 2 : 3;
+    }
+    return sides == 3;
+}
+
+void
+PolygonBoolean::snap_edges()
+{
+    if (edges.empty())
+    {
+        return;
+    }
+
+    // The grid spans the bounding box with 2**BOOLEAN_GRID_BITS cells
+    // either side of its center
+    double x0 = std::numeric_limits<double>::infinity();
+    double y0 = x0, x1 = -x0, y1 = -x0;
+    for (size_t i = 0; i < edges.size(); ++i)
+    {
+        const edge& e = edges[i];
+        x0 = std::min(x0, std::min(e.p0.x, e.p1.x));
+        y0 = std::min(y0, std::min(e.p0.y, e.p1.y));
+        x1 = std::max(x1, std::max(e.p0.x, e.p1.x));
+        y1 = std::max(y1, std::max(e.p0.y, e.p1.y));
+    }
+
+    center = XY(0.5 * x0 + 0.5 * x1, 0.5 * y0 + 0.5 * y1);
+    int exponent;
+    frexp(std::max(0.5 * x1 - 0.5 * x0, 0.5 * y1 - 0.5 * y0), &exponent);
+    scale = BOOLEAN_GRID_BITS - exponent;
+
+    size_t n = 0;
+    for (size_t i = 0; i < edges.size(); ++i)
+    {
+        edge& e = edges[i];
+        e.p0 = XY(floor(shifted_difference(e.p0.x, center.x, scale) + 0.5),
+                  floor(shifted_difference(e.p0.y, center.y, scale) + 0.5));
+        e.p1 = XY(floor(shifted_difference(e.p1.x, center.x, scale) + 0.5),
+                  floor(shifted_difference(e.p1.y, center.y, scale) + 0.5));
+        if (!(e.p0 == e.p1))
+        {
+            edges[n++] = e;
+        }
+    }
+    edges.erase(edges.begin() + n, edges.end());
+}
+
+// Adds the snapped point where edges i and j cross, if they do, to hot
+void
+PolygonBoolean::cross(size_t i, size_t j, std::vector<XY>& hot) const
+{
+    // The edges are taken in a canonical order, each from its lower
+    // end, so that the same two lines give the same point whichever
+    // edges, of either path and in either direction, they come from
+    const edge& e = edges[i];
+    const edge& f = edges[j];
+    XY a = std::min(e.p0, e.p1);
+    XY b = std::max(e.p0, e.p1);
+    XY c = std::min(f.p0, f.p1);
+    XY d = std::max(f.p0, f.p1);
+    if (c < a || (c == a && d < b))
+    {
+        std::swap(a, c);
+        std::swap(b, d);
+    }
+
+    double d1 = orientation(c, d, a);
+    double d2 = orientation(c, d, b);
+    double d3 = orientation(a, b, c);
+    double d4 = orientation(a, b, d);
+
+    // Edges that only touch, or overlap along a line, meet at the end
+    // of one of them, which is snapped already
+    if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) &&
+        ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0)))
+    {
+        double t = d1 / (d1 - d2);
+        hot.push_back(XY(floor(a.x + t * (b.x - a.x) + 0.5),
+                         floor(a.y + t * (b.y - a.y) + 0.5)));
+    }
+}
+
+struct PolygonBoolean::crossing_visitor
+{
+    crossing_visitor(const PolygonBoolean& boolean_, size_t i_,
+                     std::vector<XY>& hot_) :
+        boolean(boolean_), i(i_), hot(hot_)
+    {
+    }
+
+    bool operator()(size_t j)
+    {
+        if (j > i)
+        {
+            boolean.cross(i, j, hot);
+        }
+        return true;
+    }
+
+    const PolygonBoolean& boolean;
+    size_t i;
+    std::vector<XY>& hot;
+};
+
+// Collects, in the splits of an edge, the hot points whose cells it
+// passes through, other than its own ends
+struct PolygonBoolean::route_visitor
+{
+    route_visitor(const std::vector<XY>& hot_, edge& e_) :
+        hot(hot_), e(e_)
+    {
+    }
+
+    bool operator()(size_t k)
+    {
+        const XY& c = hot[k];
+        if (!(c == e.p0) && !(c == e.p1) && passes_through(e.p0, e.p1, c))
+        {
+            e.splits.push_back(c);
+        }
+        return true;
+    }
+
+    const std::vector<XY>& hot;
+    edge& e;
+};
+
+void
+PolygonBoolean::route_edges()
+{
+    std::vector<BboxTree::box> boxes(edges.size());
+    for (size_t i = 0; i < edges.size(); ++i)
+    {
+        boxes[i] = SegmentIndex::segment_box(edges[i].p0, edges[i].p1);
+    }
+    BboxTree tree;
+    tree.build(boxes);
+
+    // The hot points: the ends of the edges and where they cross
+    std::vector<XY> hot;
+    for (size_t i = 0; i < edges.size(); ++i)
+    {
+        hot.push_back(edges[i].p0);
+        hot.push_back(edges[i].p1);
+        crossing_visitor visit(*this, i, hot);
+        tree.query(boxes[i], visit);
+    }
+    std::sort(hot.begin(), hot.end());
+    hot.erase(std::unique(hot.begin(), hot.end()), hot.end());
+
+    // Every edge is bent through the centers of the cells it passes
+    // through; the cells being closed, no other hot point can then lie
+    // on any of the pieces
+    std::vector<BboxTree::box> cells(hot.size());
+    for (size_t k = 0; k < hot.size(); ++k)
+    {
+        BboxTree::box cell = {hot[k].x - 0.5, hot[k].y - 0.5,
+                              hot[k].x + 0.5, hot[k].y + 0.5};
+        cells[k] = cell;
+    }
+    BboxTree cell_tree;
+    cell_tree.build(cells);
+    for (size_t i = 0; i < edges.size(); ++i)
+    {
+        route_visitor visit(hot, edges[i]);
+        cell_tree.query(boxes[i], visit);
+    }
+}
+
+struct AlongEdgeLess
+{
+    AlongEdgeLess(const XY& p_, const XY& q_) : p(p_), q(q_) {}
+
+    bool operator()(const XY& a, const XY& b) const
+    {
+        return position_along(p, q, a) < position_along(p, q, b);
+    }
+
+    XY p, q;
+};
+
+void
+PolygonBoolean::build_segments()
+{
+    typedef std::map<std::pair<XY, XY>, size_t> segment_map_t;
+    segment_map_t found;
+    std::vector<XY> points;
+
+    for (size_t i = 0; i < edges.size(); ++i)
+    {
+        edge& e = edges[i];
+        std::sort(e.splits.begin(), e.splits.end(), AlongEdgeLess(e.p0, e.p1));
+        points.clear();
+        points.push_back(e.p0);
+        points.insert(points.end(), e.splits.begin(), e.splits.end());
+        points.push_back(e.p1);
+
+        for (size_t j = 1; j < points.size(); ++j)
+        {
+            if (points[j - 1] == points[j])
+            {
+                continue;
+            }
+
+            std::pair<XY, XY> key(std::min(points[j - 1], points[j]),
+                                  std::max(points[j - 1], points[j]));
+            segment_map_t::iterator it = found.find(key);
+            if (it == found.end())
+            {
+                segment s = {key.first, key.second, {0, 0}};
+                it = found.insert(std::make_pair(key, segments.size())).first;
+                segments.push_back(s);
+            }
+            segments[it->second].count[e.which]++;
+        }
+    }
+}
+
+/*
+ Accumulates the crossing parity of both paths for the point
+ m + eps * n + eps**2 * (0, 1), where m is the middle of a segment, n
+ its left normal and eps infinitely small.  Going by the limit keeps
+ ties, where another segment ends level with m or passes close to it,
+ consistent with which side of the segment the point is on.  The
+ segment itself is skipped.
+*/
+struct PolygonBoolean::parity_visitor
+{
+    parity_visitor(const std::vector<segment>& segments_, size_t s_) :
+        segments(segments_), s(s_),
+        m(0.5 * (segments_[s_].p0.x + segments_[s_].p1.x),
+          0.5 * (segments_[s_].p0.y + segments_[s_].p1.y)),
+        nx(segments_[s_].p0.y - segments_[s_].p1.y),
+        ny(segments_[s_].p1.x - segments_[s_].p0.x)
+    {
+        parity[0] = parity[1] = false;
+    }
+
+    // Whether y is above the perturbed point
+    bool above(double y) const
+    {
+        if (y != m.y)
+        {
+            return y > m.y;
+        }
+        return ny < 0.0;
+    }
+
+    bool operator()(size_t i)
+    {
+        if (i == s)
+        {
+            return true;
+        }
+
+        const segment& seg = segments[i];
+        bool odd[2] = {(seg.count[0] & 1) != 0, (seg.count[1] & 1) != 0};
+        if (!(odd[0] || odd[1]) || above(seg.p0.y) == above(seg.p1.y))
+        {
+            return true;
+        }
+
+        // Where the segment crosses the level of the point, compared
+        // to the point's x, term by term in powers of eps; it crosses
+        // to the right if the point is left of it, taken upwards
+        const XY& lo = above(seg.p0.y) ? seg.p1 : seg.p0;
+        const XY& hi = above(seg.p0.y) ? seg.p0 : seg.p1;
+        double side = orientation(lo, hi, m);
+        double slope = (seg.p1.x - seg.p0.x) / (seg.p1.y - seg.p0.y);
+        bool right;
+        if (side != 0.0)
+        {
+            right = side > 0.0;
+        }
+        else if (ny * slope != nx)
+        {
+            right = ny * slope > nx;
+        }
+        else
+        {
+            right = slope > 0.0;
+        }
+
+        if (right)
+        {
+            parity[0] ^= odd[0];
+            parity[1] ^= odd[1];
+        }
+        return true;
+    }
+
+    const std::vector<segment>& segments;
+    size_t s;
+    XY m;
+    double nx, ny;
+    bool parity[2];
+};
+
+void
+PolygonBoolean::inside_left(size_t s, const BboxTree& tree, bool inside[2]) const
+{
+    parity_visitor visit(segments, s);
+    const segment& seg = segments[s];
+
+    // Only segments reaching the ray to the right of the point, and
+    // spanning its level, can cross it
+    BboxTree::box ray = SegmentIndex::segment_box(visit.m, visit.m);
+    ray.x1 = std::numeric_limits<double>::infinity();
+    ray.x0 = std::min(ray.x0, std::min(seg.p0.x, seg.p1.x));
+    tree.query(ray, visit);
+
+    // The segment itself lies just right of the point if it goes up
+    // (the ray from the point crosses it), but not if it goes down or
+    // across; p0 < p1, so it goes from p0 to p1 here
+    bool crosses = seg.p1.y > seg.p0.y;
+    for (int k = 0; k < 2; ++k)
+    {
+        inside[k] = visit.parity[k] ^ (crosses && (seg.count[k] & 1));
+    }
+}
+
+inline bool
+boolean_op(e_boolean_op op, bool a, bool b)
+{
+    switch (op)
+    {
+    case BOOLEAN_INTERSECTION:
+        return a && b;
+    case BOOLEAN_UNION:
+        return a || b;
+    default:
+        return a && !b;
+    }
+}
+
+void
+PolygonBoolean::compute(e_boolean_op op, std::vector<double>& vertices,
+                        std::vector<npy_uint8>& codes)
+{
+    snap_edges();
+    route_edges();
+    build_segments();
+    std::vector<edge>().swap(edges);
+
+    std::vector<BboxTree::box> boxes(segments.size());
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        boxes[i] = SegmentIndex::segment_box(segments[i].p0, segments[i].p1);
+    }
+    BboxTree tree;
+    tree.build(boxes);
+
+    std::vector<std::pair<XY, XY> > boundary;
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        const segment& seg = segments[i];
+        bool left[2], right[2];
+        inside_left(i, tree, left);
+        right[0] = left[0] ^ ((seg.count[0] & 1) != 0);
+        right[1] = left[1] ^ ((seg.count[1] & 1) != 0);
+
+        bool in_left = boolean_op(op, left[0], left[1]);
+        bool in_right = boolean_op(op, right[0], right[1]);
+        if (in_left && !in_right)
+        {
+            boundary.push_back(std::make_pair(seg.p0, seg.p1));
+        }
+        else if (in_right && !in_left)
+        {
+            boundary.push_back(std::make_pair(seg.p1, seg.p0));
+        }
+    }
+
+    link(boundary, vertices, codes);
+
+    // Back from the grid
+    for (size_t i = 0; i < vertices.size(); i += 2)
+    {
+        vertices[i] = center.x + ldexp(vertices[i], -scale);
+        vertices[i + 1] = center.y + ldexp(vertices[i + 1], -scale);
+    }
+}
+
+/*
+ Links directed boundary segments into closed rings.  Every point has
+ as many segments leaving it as arriving, and where there is a choice
+ the ring turns as far left as it can, which keeps rings that only
+ touch at a point apart.  Points in the middle of a straight run are
+ dropped.
+*/
+void
+PolygonBoolean::link(const std::vector<std::pair<XY, XY> >& boundary,
+                     std::vector<double>& vertices,
+                     std::vector<npy_uint8>& codes)
+{
+    typedef std::multimap<XY, size_t> outgoing_t;
+    outgoing_t outgoing;
+    for (size_t i = 0; i < boundary.size(); ++i)
     {
-        return false;
+        outgoing.insert(std::make_pair(boundary[i].first, i));
     }
 
-    no_nans_t n1(p1, true, p1.has_curves());
-    no_nans_t n2(p2, true, p2.has_curves());
+    std::vector<bool> used(boundary.size(), false);
+    std::vector<XY> ring;
+    for (size_t first = 0; first < boundary.size(); ++first)
+    {
+        if (used[first])
+        {
+            continue;
+        }
 
-    curve_t c1(n1);
-    curve_t c2(n2);
+        ring.clear();
+        size_t current = first;
+        while (true)
+        {
+            used[current] = true;
+            const XY& from = boundary[current].first;
+            const XY& to = boundary[current].second;
+            ring.push_back(from);
+
+            // The unused segment leaving "to" with the largest turn to
+            // the left
+            std::pair<outgoing_t::iterator, outgoing_t::iterator> range =
+                outgoing.equal_range(to);
+            size_t next = boundary.size();
+            double best = 0.0;
+            double heading = atan2(to.y - from.y, to.x - from.x);
+            for (outgoing_t::iterator it = range.first; it != range.second; ++it)
+            {
+                if (used[it->second])
+                {
+                    continue;
+                }
+                const XY& p = boundary[it->second].second;
+                double turn = atan2(p.y - to.y, p.x - to.x) - heading;
+                while (turn <= -M_PI)
+                {
+                    turn += 2.0 * M_PI;
+                }
+                while (turn > M_PI)
+                {
+                    turn -= 2.0 * M_PI;
+                }
+                if (next == boundary.size() || turn > best)
+                {
+                    next = it->second;
+                    best = turn;
+                }
+            }
 
-    double x11, y11, x12, y12;
-    double x21, y21, x22, y22;
+            if (next == boundary.size())
+            {
+                break;
+            }
+            current = next;
+        }
 
-    c1.vertex(&x11, &y11);
-    while (c1.vertex(&x12, &y12) != agg::path_cmd_stop)
-    {
-        c2.rewind(0);
-        c2.vertex(&x21, &y21);
-        while (c2.vertex(&x22, &y22) != agg::path_cmd_stop)
+        // Drop the points in the middle of straight runs
+        std::vector<XY> corners;
+        size_t n = ring.size();
+        for (size_t i = 0; i < n; ++i)
         {
-            if (segments_intersect(x11, y11, x12, y12, x21, y21, x22, y22))
+            const XY& prev = ring[(i + n - 1) % n];
+            const XY& next = ring[(i + 1) % n];
+            if (orientation(prev, ring[i], next) != 0.0 ||
+                position_along(prev, ring[i], next) <= 0.0)
             {
-                return true;
+                corners.push_back(ring[i]);
             }
-            x21 = x22;
-            y21 = y22;
         }
-        x11 = x12;
-        y11 = y12;
-    }
-
-    return false;
-}
-
-Py::Object
-_path_module::path_intersects_path(const Py::Tuple& args)
-{
-    args.verify_length(2, 3);
-
-    PathIterator p1(args[0]);
-    PathIterator p2(args[1]);
-    bool filled = false;
-
-    if (args.size() == 3)
-    {
-        filled = args[2].isTrue();
-    }
+        if (corners.size() < 3)
+        {
+            continue;
+        }
 
-    if (!filled)
-    {
-        return Py::Int(::path_intersects_path(p1, p2));
-    }
-    else
-    {
-        return Py::Int(::path_intersects_path(p1, p2)
-                       || ::path_in_path(p1, agg::trans_affine(), p2, agg::trans_affine())
-                       || ::path_in_path(p2, agg::trans_affine(), p1, agg::trans_affine()));
+        for (size_t i = 0; i < corners.size(); ++i)
+        {
+            vertices.push_back(corners[i].x);
+            vertices.push_back(corners[i].y);
+            codes.push_back(i == 0 ? agg::path_cmd_move_to : agg::path_cmd_line_to);
+        }
+        vertices.push_back(corners[0].x);
+        vertices.push_back(corners[0].y);
+        codes.push_back(agg::path_cmd_end_poly | agg::path_flags_close);
     }
 }
 
@@ -1516,6 +3660,50 @@ __cleanup_path(VertexSource& source,
     while (code != agg::path_cmd_stop);
 }
 
+/*
+ Everything after the affine transformation and NaN removal, which
+ make up the front end.  Curve conversion and sketching are left out
+ when there is nothing for them to do.
+*/
+template<class FrontEnd>
+void
+_cleanup_path_stages(FrontEnd& front, PathIterator& path,
+                     bool do_clip, const agg::rect_base<double>& rect,
+                     e_snap_mode snap_mode, double stroke_width,
+                     bool do_simplify, bool return_curves,
+                     double sketch_scale, double sketch_length,
+                     double sketch_randomness,
+                     std::vector<double>& vertices,
+                     std::vector<npy_uint8>& codes)
+{
+    typedef PathClipper<FrontEnd>              clipped_t;
+    typedef PathSnapper<clipped_t>             snapped_t;
+    typedef PathColumnDecimator<snapped_t>     decimated_t;
+    typedef PathSimplifier<decimated_t>        simplify_t;
+    typedef agg::conv_curve<simplify_t>        curve_t;
+    typedef Sketch<curve_t>                    sketch_t;
+
+    clipped_t          clipped(front, do_clip, rect);
+    snapped_t          snapped(clipped, snap_mode, path.total_vertices(), stroke_width);
+    decimated_t        decimated(snapped, do_simplify && path.should_decimate());
+    simplify_t         simplified(decimated, do_simplify, path.simplify_threshold());
+
+    // One more for the stop at the end
+    vertices.reserve((path.total_vertices() + 1) * 2);
+    codes.reserve(path.total_vertices() + 1);
+
+    if ((return_curves || !path.has_curves()) && sketch_scale == 0.0)
+    {
+        __cleanup_path(simplified, vertices, codes);
+    }
+    else
+    {
+        curve_t curve(simplified);
+        sketch_t sketch(curve, sketch_scale, sketch_length, sketch_randomness);
+        __cleanup_path(sketch, vertices, codes);
+    }
+}
+
 void
 _cleanup_path(PathIterator& path, const agg::trans_affine& trans,
               bool remove_nans, bool do_clip,
@@ -1529,31 +3717,71 @@ _cleanup_path(PathIterator& path, const agg::trans_affine& trans,
 {
     typedef agg::conv_transform<PathIterator>  transformed_path_t;
     typedef PathNanRemover<transformed_path_t> nan_removal_t;
-    typedef PathClipper<nan_removal_t>         clipped_t;
-    typedef PathSnapper<clipped_t>             snapped_t;
-    typedef PathSimplifier<snapped_t>          simplify_t;
-    typedef agg::conv_curve<simplify_t>        curve_t;
-    typedef Sketch<curve_t>                    sketch_t;
+    typedef PathBlockTransformer<PathIterator> block_transformed_t;
 
-    transformed_path_t tpath(path, trans);
-    nan_removal_t      nan_removed(tpath, remove_nans, path.has_curves());
-    clipped_t          clipped(nan_removed, do_clip, rect);
-    snapped_t          snapped(clipped, snap_mode, path.total_vertices(), stroke_width);
-    simplify_t         simplified(snapped, do_simplify, path.simplify_threshold());
+    if (!path.has_curves())
+    {
+        block_transformed_t front(path, trans, remove_nans);
+        _cleanup_path_stages(front, path, do_clip, rect, snap_mode,
+                             stroke_width, do_simplify, return_curves,
+                             sketch_scale, sketch_length, sketch_randomness,
+                             vertices, codes);
+    }
+    else
+    {
+        transformed_path_t tpath(path, trans);
+        nan_removal_t      front(tpath, remove_nans, path.has_curves());
+        _cleanup_path_stages(front, path, do_clip, rect, snap_mode,
+                             stroke_width, do_simplify, return_curves,
+                             sketch_scale, sketch_length, sketch_randomness,
+                             vertices, codes);
+    }
+}
 
-    vertices.reserve(path.total_vertices() * 2);
-    codes.reserve(path.total_vertices());
+// The (vertices, codes) arrays of a path, as a tuple
+static Py::Object
+_path_arrays(const std::vector<double>& vertices,
+             const std::vector<npy_uint8>& codes)
+{
+    npy_intp length = codes.size();
+    npy_intp dims[] = { length, 2, 0 };
 
-    if (return_curves && sketch_scale == 0.0)
+    PyArrayObject* vertices_obj = NULL;
+    PyArrayObject* codes_obj = NULL;
+    Py::Tuple result(2);
+    try
     {
-        __cleanup_path(simplified, vertices, codes);
+        vertices_obj = (PyArrayObject*)PyArray_SimpleNew
+                       (2, dims, PyArray_DOUBLE);
+        if (vertices_obj == NULL)
+        {
+            throw Py::MemoryError("Could not allocate result array");
+        }
+
+        codes_obj = (PyArrayObject*)PyArray_SimpleNew
+                    (1, dims, PyArray_UINT8);
+        if (codes_obj == NULL)
+        {
+            throw Py::MemoryError("Could not allocate result array");
+        }
+
+        if (length)
+        {
+            memcpy(PyArray_DATA(vertices_obj), &vertices[0], sizeof(double) * 2 * length);
+            memcpy(PyArray_DATA(codes_obj), &codes[0], sizeof(npy_uint8) * length);
+        }
+
+        result[0] = Py::Object((PyObject*)vertices_obj, true);
+        result[1] = Py::Object((PyObject*)codes_obj, true);
     }
-    else
+    catch (...)
     {
-        curve_t curve(simplified);
-        sketch_t sketch(curve, sketch_scale, sketch_length, sketch_randomness);
-        __cleanup_path(sketch, vertices, codes);
+        Py_XDECREF(vertices_obj);
+        Py_XDECREF(codes_obj);
+        throw;
     }
+
+    return result;
 }
 
 Py::Object
@@ -1632,48 +3860,266 @@ _path_module::cleanup_path(const Py::Tuple& args)
                   stroke_width, simplify, return_curves, sketch_scale,
                   sketch_length, sketch_randomness, vertices, codes);
 
-    npy_intp length = codes.size();
-    npy_intp dims[] = { length, 2, 0 };
+    return _path_arrays(vertices, codes);
+}
 
-    PyArrayObject* vertices_obj = NULL;
-    PyArrayObject* codes_obj = NULL;
-    Py::Tuple result(2);
-    try
+Py::Object
+_path_module::clip_path_to_path(const Py::Tuple& args)
+{
+    typedef agg::conv_transform<PathIterator>  transformed_path_t;
+    typedef PathNanRemover<transformed_path_t> nan_removal_t;
+    typedef agg::conv_curve<nan_removal_t>     curve_t;
+
+    args.verify_length(5);
+
+    PathIterator a(args[0]);
+    agg::trans_affine atrans = py_to_agg_transformation_matrix(args[1].ptr(), false);
+    PathIterator b(args[2]);
+    agg::trans_affine btrans = py_to_agg_transformation_matrix(args[3].ptr(), false);
+    long op = Py::Int(args[4]);
+
+    if (op < BOOLEAN_INTERSECTION || op > BOOLEAN_DIFFERENCE)
     {
-        vertices_obj = (PyArrayObject*)PyArray_SimpleNew
-                       (2, dims, PyArray_DOUBLE);
-        if (vertices_obj == NULL)
+        throw Py::ValueError("Invalid boolean operation");
+    }
+
+    PolygonBoolean boolean;
+
+    transformed_path_t atpath(a, atrans);
+    nan_removal_t      anan_removed(atpath, true, a.has_curves());
+    curve_t            acurve(anan_removed);
+    boolean.add_path(acurve, 0);
+
+    transformed_path_t btpath(b, btrans);
+    nan_removal_t      bnan_removed(btpath, true, b.has_curves());
+    curve_t            bcurve(bnan_removed);
+    boolean.add_path(bcurve, 1);
+
+    std::vector<double> vertices;
+    std::vector<npy_uint8> codes;
+    boolean.compute((e_boolean_op)op, vertices, codes);
+
+    return _path_arrays(vertices, codes);
+}
+
+static inline double
+svg_scale(double a, int shift, const double* powers)
+{
+    return shift >= 0 ? a * powers[shift] : a / powers[-shift];
+}
+
+/*
+ Formats value the way PyOS_double_to_string(value, 'g', precision, 0,
+ NULL) does, writing the characters to p and returning the end.  The
+ common case of a number printed without an exponent is done with
+ integer arithmetic, when the scaled value is far enough from a
+ rounding tie for the result to be certain; anything else goes to
+ Python's own formatter.
+*/
+static char*
+format_svg_number(double value, int precision, char* p)
+{
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    // The range test also fails for infinities and NaNs
+    double a = fabs(value);
+    if (precision >= 1 && precision <= 15 &&
+        a >= 1e-4 && a < powers[precision])
+    {
+        // The decimal exponent e, and a scaled so that its integer
+        // part has precision digits, correcting log10's rounding
+        int e = (int)floor(log10(a));
+        double scaled = svg_scale(a, precision - 1 - e, powers);
+        if (scaled < powers[precision - 1])
         {
-            throw Py::MemoryError("Could not allocate result array");
+            scaled = svg_scale(a, precision - 1 - --e, powers);
+        }
+        else if (scaled >= powers[precision])
+        {
+            scaled = svg_scale(a, precision - 1 - ++e, powers);
         }
 
-        codes_obj = (PyArrayObject*)PyArray_SimpleNew
-                    (1, dims, PyArray_UINT8);
-        if (codes_obj == NULL)
+        // The digits, rounded to the nearest, which is only certain if
+        // scaled is further from a tie than its own rounding error
+        double n = floor(scaled + 0.5);
+        double frac = scaled - floor(scaled);
+        if (n == powers[precision])
         {
-            throw Py::MemoryError("Could not allocate result array");
+            n = powers[precision - 1];
+            ++e;
         }
+        if (fabs(frac - 0.5) > scaled * 1e-14 && e < precision &&
+            n >= powers[precision - 1] && n < powers[precision])
+        {
+            char digits[16];
+            unsigned long long d = (unsigned long long)n;
+            for (int k = precision - 1; k >= 0; --k)
+            {
+                digits[k] = (char)('0' + d % 10);
+                d /= 10;
+            }
+            int ndigits = precision;
+            while (ndigits > 1 && ndigits > e + 1 && digits[ndigits - 1] == '0')
+            {
+                --ndigits;
+            }
 
-        memcpy(PyArray_DATA(vertices_obj), &vertices[0], sizeof(double) * 2 * length);
-        memcpy(PyArray_DATA(codes_obj), &codes[0], sizeof(npy_uint8) * length);
+            if (value < 0)
+            {
+                *p++ = '-';
+            }
+            if (e >= 0)
+            {
+                for (int k = 0; k <= e; ++k)
+                {
+                    *p++ = digits[k];
+                }
+                if (ndigits > e + 1)
+                {
+                    *p++ = '.';
+                    for (int k = e + 1; k < ndigits; ++k)
+                    {
+                        *p++ = digits[k];
+                    }
+                }
+            }
+            else
+            {
+                *p++ = '0';
+                *p++ = '.';
+                for (int k = -1; k > e; --k)
+                {
+                    *p++ = '0';
+                }
+                for (int k = 0; k < ndigits; ++k)
+                {
+                    *p++ = digits[k];
+                }
+            }
+            return p;
+        }
+    }
 
-        result[0] = Py::Object((PyObject*)vertices_obj, true);
-        result[1] = Py::Object((PyObject*)codes_obj, true);
+    #if PY_VERSION_HEX >= 0x02070000
+    char* str = PyOS_double_to_string(value, 'g', precision, 0, NULL);
+    if (str == NULL)
+    {
+        throw Py::Exception();
     }
-    catch (...)
+    size_t length = strlen(str);
+    memcpy(p, str, length);
+    PyMem_Free(str);
+    return p + length;
+    #else
+    char format[64];
+    snprintf(format, 64, "%s.%dg", "%", precision);
+    char str[64];
+    PyOS_ascii_formatd(str, 64, format, value);
+    size_t length = strlen(str);
+    memcpy(p, str, length);
+    return p + length;
+    #endif
+}
+
+// The amount of SVG path data gathered before it is handed to the
+// file's write()
+#define SVG_CHUNK_SIZE (1 << 16)
+
+/*
+ Collects SVG path data in a growable buffer.  If it was given a
+ file-like object the data is written to it in chunks as it comes,
+ so that only one chunk is ever held in memory; otherwise all of it
+ is returned as a string at the end.
+*/
+class SvgPathWriter
+{
+public:
+    SvgPathWriter(int precision_, const Py::Object& file_) :
+        precision(precision_), file(file_), used(0)
     {
-        Py_XDECREF(vertices_obj);
-        Py_XDECREF(codes_obj);
-        throw;
+        buffer.resize(SVG_CHUNK_SIZE);
     }
 
-    return result;
-}
+    inline void
+    put(char c)
+    {
+        reserve(1);
+        buffer[used++] = c;
+    }
+
+    inline void
+    number(double value)
+    {
+        // The longest a %g number can be, for any precision
+        reserve(std::max(precision, 17) + 32);
+        used = format_svg_number(value, precision, &buffer[0] + used) - &buffer[0];
+        if (!file.isNone() && used >= SVG_CHUNK_SIZE)
+        {
+            flush();
+        }
+    }
+
+    void
+    flush()
+    {
+        if (used == 0)
+        {
+            return;
+        }
+        Py::Tuple args(1);
+        args[0] = to_string();
+        used = 0;
+        Py::Callable(file.getAttr("write")).apply(args);
+    }
+
+    Py::Object
+    finish()
+    {
+        if (file.isNone())
+        {
+            return to_string();
+        }
+        flush();
+        return Py::Object();
+    }
+
+private:
+    int precision;
+    Py::Object file;
+    std::vector<char> buffer;
+    size_t used;
+
+    inline void
+    reserve(size_t n)
+    {
+        if (used + n > buffer.size())
+        {
+            buffer.resize(std::max(buffer.size() * 2, used + n));
+        }
+    }
+
+    Py::Object
+    to_string()
+    {
+        #if PY3K
+        PyObject* result = PyUnicode_FromStringAndSize(&buffer[0], used);
+        #else
+        PyObject* result = PyString_FromStringAndSize(&buffer[0], used);
+        #endif
+        if (result == NULL)
+        {
+            throw Py::Exception();
+        }
+        return Py::Object(result, true);
+    }
+};
 
 Py::Object
 _path_module::convert_to_svg(const Py::Tuple& args)
 {
-    args.verify_length(5);
+    args.verify_length(5, 6);
 
     PathIterator path(args[0]);
     agg::trans_affine trans = py_to_agg_transformation_matrix(args[1].ptr(), false);
@@ -1710,10 +4156,11 @@ _path_module::convert_to_svg(const Py::Tuple& args)
 
     int precision = Py::Int(args[4]);
 
-    #if PY_VERSION_HEX < 0x02070000
-    char format[64];
-    snprintf(format, 64, "%s.%dg", "%", precision);
-    #endif
+    Py::Object file;
+    if (args.size() == 6)
+    {
+        file = args[5];
+    }
 
     typedef agg::conv_transform<PathIterator>  transformed_path_t;
     typedef PathNanRemover<transformed_path_t> nan_removal_t;
@@ -1725,9 +4172,7 @@ _path_module::convert_to_svg(const Py::Tuple& args)
     clipped_t          clipped(nan_removed, do_clip, clip_rect);
     simplify_t         simplified(clipped, simplify, path.simplify_threshold());
 
-    size_t buffersize = path.total_vertices() * (precision + 5) * 4;
-    char* buffer = (char *)malloc(buffersize);
-    char* p = buffer;
+    SvgPathWriter writer(precision, file);
 
     const char codes[] = {'M', 'L', 'Q', 'C'};
     const int  waits[] = {  1,   1,   2,   3};
@@ -1739,52 +4184,31 @@ _path_module::convert_to_svg(const Py::Tuple& args)
     {
         if (wait == 0)
         {
-            *p++ = '\n';
+            writer.put('\n');
 
             if (code == 0x4f)
             {
-                *p++ = 'z';
-                *p++ = '\n';
+                writer.put('z');
+                writer.put('\n');
                 continue;
             }
 
-            *p++ = codes[code-1];
+            writer.put(codes[code-1]);
             wait = waits[code-1];
         }
         else
         {
-            *p++ = ' ';
+            writer.put(' ');
         }
 
-        #if PY_VERSION_HEX >= 0x02070000
-        char* str;
-        str = PyOS_double_to_string(x, 'g', precision, 0, NULL);
-        p += snprintf(p, buffersize - (p - buffer), "%s", str);
-        PyMem_Free(str);
-        *p++ = ' ';
-        str = PyOS_double_to_string(y, 'g', precision, 0, NULL);
-        p += snprintf(p, buffersize - (p - buffer), "%s", str);
-        PyMem_Free(str);
-        #else
-        char str[64];
-        PyOS_ascii_formatd(str, 64, format, x);
-        p += snprintf(p, buffersize - (p - buffer), "%s", str);
-        *p++ = ' ';
-        PyOS_ascii_formatd(str, 64, format, y);
-        p += snprintf(p, buffersize - (p - buffer), "%s", str);
-        #endif
+        writer.number(x);
+        writer.put(' ');
+        writer.number(y);
 
         --wait;
     }
 
-    #if PY3K
-    PyObject* result = PyUnicode_FromStringAndSize(buffer, p - buffer);
-    #else
-    PyObject* result = PyString_FromStringAndSize(buffer, p - buffer);
-    #endif
-    free(buffer);
-
-    return Py::Object(result, true);
+    return writer.finish();
 }
 
 PyMODINIT_FUNC
@@ -7,6 +7,8 @@
 #include "numpy/arrayobject.h"
 #include "agg_path_storage.h"
 
+#include <algorithm>
+
 /*
  This file contains a vertex source to adapt Python Numpy arrays to
  Agg paths.  It works as an iterator, and converts on-the-fly without
@@ -37,12 +39,13 @@ class PathIterator
     */
     bool m_should_simplify;
     double m_simplify_threshold;
+    bool m_should_decimate;
 
 public:
     /* path_obj is an instance of the class Path as defined in path.py */
     inline PathIterator(const Py::Object& path_obj) :
             m_vertices(), m_codes(), m_iterator(0), m_should_simplify(false),
-            m_simplify_threshold(1.0 / 9.0)
+            m_simplify_threshold(1.0 / 9.0), m_should_decimate(false)
     {
         Py::Object vertices_obj           = path_obj.getAttr("vertices");
         Py::Object codes_obj              = path_obj.getAttr("codes");
@@ -80,6 +83,11 @@ public:
         m_should_simplify    = should_simplify_obj.isTrue();
         m_total_vertices     = PyArray_DIM(m_vertices.ptr(), 0);
         m_simplify_threshold = Py::Float(simplify_threshold_obj);
+
+        if (path_obj.hasAttr("should_decimate"))
+        {
+            m_should_decimate = path_obj.getAttr("should_decimate").isTrue();
+        }
     }
 
     ~PathIterator()
@@ -107,6 +115,48 @@ public:
         }
     }
 
+    /* Reads up to n of the following vertices at once, into xy (as
+       x, y pairs) and codes, exactly as that many calls to vertex()
+       would.  Returns how many vertices were read, 0 at the end. */
+    inline size_t vertex_block(double* xy, unsigned* codes, size_t n)
+    {
+        if (m_iterator >= m_total_vertices) return 0;
+        n = std::min(n, m_total_vertices - m_iterator);
+
+        const char* pair = (const char*)PyArray_GETPTR2(m_vertices.ptr(), m_iterator, 0);
+        const npy_intp stride0 = PyArray_STRIDE(m_vertices.ptr(), 0);
+        const npy_intp stride1 = PyArray_STRIDE(m_vertices.ptr(), 1);
+        for (size_t i = 0; i < n; ++i, pair += stride0)
+        {
+            xy[2 * i] = *(const double*)pair;
+            xy[2 * i + 1] = *(const double*)(pair + stride1);
+        }
+
+        if (!m_codes.isNone())
+        {
+            const char* code = (const char*)PyArray_GETPTR1(m_codes.ptr(), m_iterator);
+            const npy_intp stride = PyArray_STRIDE(m_codes.ptr(), 0);
+            for (size_t i = 0; i < n; ++i, code += stride)
+            {
+                codes[i] = (unsigned)(*(char *)code);
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                codes[i] = agg::path_cmd_line_to;
+            }
+            if (m_iterator == 0)
+            {
+                codes[0] = agg::path_cmd_move_to;
+            }
+        }
+
+        m_iterator += n;
+        return n;
+    }
+
     inline void rewind(unsigned path_id)
     {
         m_iterator = path_id;
@@ -127,6 +177,11 @@ public:
         return m_simplify_threshold;
     }
 
+    inline bool should_decimate()
+    {
+        return m_should_decimate;
+    }
+
     inline bool has_curves()
     {
         return !m_codes.isNone();
@@ -0,0 +1,183 @@
+/* -*- mode: c++; c-basic-offset: 4 -*- */
+
+/* alpha_mask_cropped.h
+
+   mpl::cropped_alpha_mask is an 8-bit alpha mask that only stores the
+   rectangle of the canvas a clip path actually covers; everything
+   outside of it reads as fully transparent.  It can be used wherever
+   Agg's amask_no_clip_gray8 is (pixfmt_amask_adaptor, scanline_u8_am),
+   and gives exactly the same results as that would on a full canvas
+   sized mask that is zero outside the rectangle.
+
+   The mask does not own its pixels: attach() points it at a buffer of
+   (bounds.x2 - bounds.x1 + 1) * (bounds.y2 - bounds.y1 + 1) bytes,
+   stored row by row, where bounds is given inclusively in canvas
+   coordinates.
+*/
+
+#ifndef __ALPHA_MASK_CROPPED_H
+#define __ALPHA_MASK_CROPPED_H
+
+#include <string.h>
+#include <stddef.h>
+#include <algorithm>
+#include "agg_basics.h"
+
+namespace mpl
+{
+
+class cropped_alpha_mask
+{
+public:
+    typedef agg::int8u cover_type;
+    enum cover_scale_e
+    {
+        cover_shift = 8,
+        cover_none  = 0,
+        cover_full  = 255
+    };
+
+    cropped_alpha_mask() :
+        m_data(0), m_bounds(0, 0, -1, -1), m_stride(0)
+    {
+    }
+
+    void attach(const agg::int8u* data, const agg::rect_i& bounds)
+    {
+        m_data = data;
+        m_bounds = bounds;
+        m_stride = bounds.x2 - bounds.x1 + 1;
+    }
+
+    const agg::rect_i& bounds() const
+    {
+        return m_bounds;
+    }
+
+    cover_type pixel(int x, int y) const
+    {
+        if (!inside(x, y))
+        {
+            return cover_none;
+        }
+        return *value_ptr(x, y);
+    }
+
+    cover_type combine_pixel(int x, int y, cover_type val) const
+    {
+        if (!inside(x, y))
+        {
+            return cover_none;
+        }
+        return (cover_type)((cover_full + val * (*value_ptr(x, y))) >>
+                            cover_shift);
+    }
+
+    void fill_hspan(int x, int y, cover_type* dst, int num_pix) const
+    {
+        int begin, end;
+        clip_span(x, m_bounds.x1, m_bounds.x2, num_pix, begin, end);
+        if (y < m_bounds.y1 || y > m_bounds.y2)
+        {
+            begin = end = num_pix;
+        }
+        memset(dst, cover_none, begin);
+        if (end > begin)
+        {
+            memcpy(dst + begin, value_ptr(x + begin, y), end - begin);
+        }
+        memset(dst + end, cover_none, num_pix - end);
+    }
+
+    void combine_hspan(int x, int y, cover_type* dst, int num_pix) const
+    {
+        int begin, end;
+        clip_span(x, m_bounds.x1, m_bounds.x2, num_pix, begin, end);
+        if (y < m_bounds.y1 || y > m_bounds.y2)
+        {
+            begin = end = num_pix;
+        }
+        memset(dst, cover_none, begin);
+        if (end > begin)
+        {
+            const agg::int8u* mask = value_ptr(x + begin, y);
+            for (int i = begin; i < end; ++i, ++mask)
+            {
+                dst[i] = (cover_type)((cover_full + dst[i] * (*mask)) >>
+                                      cover_shift);
+            }
+        }
+        memset(dst + end, cover_none, num_pix - end);
+    }
+
+    void fill_vspan(int x, int y, cover_type* dst, int num_pix) const
+    {
+        int begin, end;
+        clip_span(y, m_bounds.y1, m_bounds.y2, num_pix, begin, end);
+        if (x < m_bounds.x1 || x > m_bounds.x2)
+        {
+            begin = end = num_pix;
+        }
+        memset(dst, cover_none, begin);
+        for (int i = begin; i < end; ++i)
+        {
+            dst[i] = *value_ptr(x, y + i);
+        }
+        memset(dst + end, cover_none, num_pix - end);
+    }
+
+    void combine_vspan(int x, int y, cover_type* dst, int num_pix) const
+    {
+        int begin, end;
+        clip_span(y, m_bounds.y1, m_bounds.y2, num_pix, begin, end);
+        if (x < m_bounds.x1 || x > m_bounds.x2)
+        {
+            begin = end = num_pix;
+        }
+        memset(dst, cover_none, begin);
+        for (int i = begin; i < end; ++i)
+        {
+            dst[i] = (cover_type)((cover_full + dst[i] * (*value_ptr(x, y + i))) >>
+                                  cover_shift);
+        }
+        memset(dst + end, cover_none, num_pix - end);
+    }
+
+private:
+    bool inside(int x, int y) const
+    {
+        return (x >= m_bounds.x1 && x <= m_bounds.x2 &&
+                y >= m_bounds.y1 && y <= m_bounds.y2);
+    }
+
+    // Only valid for (x, y) inside the bounds
+    const agg::int8u* value_ptr(int x, int y) const
+    {
+        return m_data + (ptrdiff_t)(y - m_bounds.y1) * m_stride + (x - m_bounds.x1);
+    }
+
+    // The part [begin, end) of the span of num_pix values starting at
+    // start that lies within [lo, hi].
+    static void clip_span(int start, int lo, int hi, int num_pix,
+                          int& begin, int& end)
+    {
+        begin = std::max(lo - start, 0);
+        end = std::min(hi - start + 1, num_pix);
+        if (begin > num_pix)
+        {
+            begin = num_pix;
+        }
+        if (end < begin)
+        {
+            end = begin;
+        }
+    }
+
+    const agg::int8u* m_data;
+    agg::rect_i m_bounds;
+    int m_stride;
+};
+
+}
+
+#endif
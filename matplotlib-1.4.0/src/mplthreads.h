@@ -0,0 +1,161 @@
+/* -*- mode: c++; c-basic-offset: 4 -*- */
+
+/* mplthreads.h
+
+   A minimal fork/join helper for spreading independent pieces of work
+   across native threads (pthreads, or the Win32 API on Windows).
+
+   mpl::parallel_for(begin, end, nthreads, task) splits the half-open
+   range [begin, end) into at most nthreads contiguous chunks and calls
+   task(chunk_begin, chunk_end) once per chunk, the first chunk on the
+   calling thread and the others on freshly started threads.  It returns
+   once every chunk has been processed.  If a thread can not be started
+   its chunk is simply run on the calling thread, so the result never
+   depends on how many threads were actually available.
+
+   The task is shared between all the threads, so operator() must only
+   write to state that belongs to its own chunk, and it must neither
+   throw nor touch the Python API.
+*/
+
+#ifndef __MPLTHREADS_H
+#define __MPLTHREADS_H
+
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+namespace mpl
+{
+
+/* Return the number of processors available, or 1 if unknown. */
+inline int
+num_cpus()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int n = (int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    int n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    int n = 1;
+#endif
+    return (n > 0) ? n : 1;
+}
+
+/* Map a user supplied thread count onto an actual one: 0 means "one
+   per processor", anything else is taken as is (but at least 1). */
+inline int
+resolve_num_threads(int nthreads)
+{
+    if (nthreads == 0)
+    {
+        return num_cpus();
+    }
+    return (nthreads > 0) ? nthreads : 1;
+}
+
+template<class Task>
+struct parallel_for_chunk
+{
+    Task* task;
+    int begin;
+    int end;
+};
+
+template<class Task>
+#ifdef _WIN32
+unsigned __stdcall
+#else
+void*
+#endif
+parallel_for_thread(void* arg)
+{
+    parallel_for_chunk<Task>* chunk = (parallel_for_chunk<Task>*)arg;
+    (*chunk->task)(chunk->begin, chunk->end);
+    return 0;
+}
+
+template<class Task>
+void
+parallel_for(int begin, int end, int nthreads, Task& task)
+{
+    int n = end - begin;
+    if (nthreads > n)
+    {
+        nthreads = n;
+    }
+
+    if (nthreads <= 1)
+    {
+        if (n > 0)
+        {
+            task(begin, end);
+        }
+        return;
+    }
+
+    std::vector<parallel_for_chunk<Task> > chunks(nthreads);
+    for (int i = 0; i < nthreads; ++i)
+    {
+        chunks[i].task = &task;
+        chunks[i].begin = begin + (int)(((long long)n * i) / nthreads);
+        chunks[i].end = begin + (int)(((long long)n * (i + 1)) / nthreads);
+    }
+
+#ifdef _WIN32
+    std::vector<HANDLE> threads(nthreads, (HANDLE)0);
+    for (int i = 1; i < nthreads; ++i)
+    {
+        threads[i] = (HANDLE)_beginthreadex(
+            NULL, 0, &parallel_for_thread<Task>, &chunks[i], 0, NULL);
+        if (threads[i] == 0)
+        {
+            task(chunks[i].begin, chunks[i].end);
+        }
+    }
+    task(chunks[0].begin, chunks[0].end);
+    for (int i = 1; i < nthreads; ++i)
+    {
+        if (threads[i] != 0)
+        {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+    }
+#else
+    std::vector<pthread_t> threads(nthreads);
+    std::vector<bool> started(nthreads, false);
+    for (int i = 1; i < nthreads; ++i)
+    {
+        if (pthread_create(&threads[i], NULL, &parallel_for_thread<Task>,
+                           &chunks[i]) == 0)
+        {
+            started[i] = true;
+        }
+        else
+        {
+            task(chunks[i].begin, chunks[i].end);
+        }
+    }
+    task(chunks[0].begin, chunks[0].end);
+    for (int i = 1; i < nthreads; ++i)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+#endif
+}
+
+}
+
+#endif
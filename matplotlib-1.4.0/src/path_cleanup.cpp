@@ -15,7 +15,8 @@ class PathCleanupIterator
     typedef PathNanRemover<transformed_path_t> nan_removal_t;
     typedef PathClipper<nan_removal_t>         clipped_t;
     typedef PathSnapper<clipped_t>             snapped_t;
-    typedef PathSimplifier<snapped_t>          simplify_t;
+    typedef PathColumnDecimator<snapped_t>     decimated_t;
+    typedef PathSimplifier<decimated_t>        simplify_t;
     typedef Sketch<simplify_t>                 sketch_t;
 
     Py::Object         m_path_obj;
@@ -25,6 +26,7 @@ class PathCleanupIterator
     nan_removal_t      m_nan_removed;
     clipped_t          m_clipped;
     snapped_t          m_snapped;
+    decimated_t        m_decimated;
     simplify_t         m_simplify;
     sketch_t           m_sketch;
 
@@ -43,7 +45,9 @@ public:
         m_clipped(m_nan_removed, do_clip, rect),
         m_snapped(m_clipped, snap_mode, m_path_iter.total_vertices(),
                   stroke_width),
-        m_simplify(m_snapped, do_simplify && m_path_iter.should_simplify(),
+        m_decimated(m_snapped, do_simplify && m_path_iter.should_simplify() &&
+                    m_path_iter.should_decimate()),
+        m_simplify(m_decimated, do_simplify && m_path_iter.should_simplify(),
                    m_path_iter.simplify_threshold()),
         m_sketch(m_simplify, sketch_scale, sketch_length, sketch_randomness)
     {
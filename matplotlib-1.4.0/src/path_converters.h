@@ -4,10 +4,13 @@
 #define __PATH_CONVERTERS_H__
 
 #include <stdlib.h>
+#include <math.h>
+#include <limits>
 #include "CXX/Objects.hxx"
 #include "numpy/arrayobject.h"
 #include "agg_path_storage.h"
 #include "agg_clip_liang_barsky.h"
+#include "agg_trans_affine.h"
 #include "MPL_isnan.h"
 #include "mplutils.h"
 #include "agg_conv_segmentator.h"
@@ -25,6 +28,9 @@
    2. PathNanRemover: skips over segments containing non-finite numbers
       by inserting MOVETO commands
 
+      For paths without curves, PathBlockTransformer does both 1. and
+      2., a block of vertices at a time.
+
    3. PathClipper: Clips line segments to a given rectangle.  This is
       helpful for data reduction, and also to avoid a limitation in
       Agg where coordinates can not be larger than 24-bit signed
@@ -33,13 +39,19 @@
    4. PathSnapper: Rounds the path to the nearest center-pixels.
       This makes rectilinear curves look much better.
 
-   5. PathSimplifier: Removes line segments from highly dense paths
+   5. PathColumnDecimator: Reduces each run of vertices that fall
+      within the same pixel column to its first, minimum, maximum and
+      last vertices.  For paths with monotonic x, such as long time
+      series, this bounds the output to a few vertices per column.
+      It is only applied to paths that ask for it (should_decimate).
+
+   6. PathSimplifier: Removes line segments from highly dense paths
       that would not have an impact on their appearance.  Speeds up
       rendering and reduces file sizes.
 
-   6. curve-to-line-segment conversion (implemented in Agg, not here)
+   7. curve-to-line-segment conversion (implemented in Agg, not here)
 
-   7. stroking (implemented in Agg, not here)
+   8. stroking (implemented in Agg, not here)
  */
 
 /************************************************************
@@ -269,6 +281,139 @@ const unsigned char PathNanRemover<VertexSource>::num_extra_points_map[] =
      0, 0, 0, 0
     };
 
+/************************************************************
+ PathBlockTransformer does the work of an agg::conv_transform followed
+ by a PathNanRemover for a path without curves, but a block of
+ PATH_BLOCK_SIZE vertices at a time: it reads them from the source all
+ at once (see PathIterator::vertex_block), transforms them in one
+ tight loop, drops the non-finite ones in another, and then hands out
+ what is left one vertex at a time.  The output is exactly that of the
+ two converters it stands in for.
+ */
+#define PATH_BLOCK_SIZE 256
+
+template<class VertexSource>
+class PathBlockTransformer
+{
+    VertexSource*     m_source;
+    agg::trans_affine m_trans;
+    bool              m_remove_nans;
+    bool              m_skipping;
+    size_t            m_read;
+    size_t            m_size;
+    double            m_xy[PATH_BLOCK_SIZE * 2];
+    unsigned          m_codes[PATH_BLOCK_SIZE];
+
+public:
+    PathBlockTransformer(VertexSource& source, const agg::trans_affine& trans,
+                         bool remove_nans) :
+        m_source(&source), m_trans(trans), m_remove_nans(remove_nans),
+        m_skipping(false), m_read(0), m_size(0)
+    {
+        // empty
+    }
+
+    inline void
+    rewind(unsigned path_id)
+    {
+        m_skipping = false;
+        m_read = m_size = 0;
+        m_source->rewind(path_id);
+    }
+
+    inline unsigned
+    vertex(double* x, double* y)
+    {
+        if (m_read == m_size && !next_block())
+        {
+            return agg::path_cmd_stop;
+        }
+
+        *x = m_xy[2 * m_read];
+        *y = m_xy[2 * m_read + 1];
+        return m_codes[m_read++];
+    }
+
+private:
+    bool
+    next_block()
+    {
+        // A block may be nothing but NaNs
+        do
+        {
+            m_read = 0;
+            m_size = m_source->vertex_block(m_xy, m_codes, PATH_BLOCK_SIZE);
+            if (m_size == 0)
+            {
+                return false;
+            }
+            transform_block();
+            if (m_remove_nans)
+            {
+                remove_nans_from_block();
+            }
+        }
+        while (m_size == 0);
+
+        return true;
+    }
+
+    void
+    transform_block()
+    {
+        const double sx = m_trans.sx, shx = m_trans.shx, tx = m_trans.tx;
+        const double shy = m_trans.shy, sy = m_trans.sy, ty = m_trans.ty;
+        double* xy = m_xy;
+        for (size_t i = 0; i < m_size; ++i, xy += 2)
+        {
+            // The same arithmetic as trans_affine::transform
+            if (agg::is_vertex(m_codes[i]))
+            {
+                double tmp = xy[0];
+                xy[0] = tmp * sx + xy[1] * shx + tx;
+                xy[1] = tmp * shy + xy[1] * sy + ty;
+            }
+        }
+    }
+
+    /* As PathNanRemover without curves: a run of non-finite vertices
+       is dropped, and the vertex after it becomes a MOVETO, unless it
+       is a stop or a CLOSEPOLY, which always pass through and end the
+       run.  The run may carry on into the next block. */
+    void
+    remove_nans_from_block()
+    {
+        size_t out = 0;
+        for (size_t i = 0; i < m_size; ++i)
+        {
+            unsigned code = m_codes[i];
+            double x = m_xy[2 * i];
+            double y = m_xy[2 * i + 1];
+            if (code == agg::path_cmd_stop ||
+                code == (agg::path_cmd_end_poly | agg::path_flags_close))
+            {
+                m_skipping = false;
+            }
+            else if (!(fabs(x) <= std::numeric_limits<double>::max() &&
+                       fabs(y) <= std::numeric_limits<double>::max()))
+            {
+                m_skipping = true;
+                continue;
+            }
+            else if (m_skipping)
+            {
+                code = agg::path_cmd_move_to;
+                m_skipping = false;
+            }
+            m_codes[out] = code;
+            m_xy[2 * out] = x;
+            m_xy[2 * out + 1] = y;
+            ++out;
+        }
+        m_size = out;
+    }
+};
+
 /************************************************************
  PathClipper uses the Liang-Barsky line clipping algorithm (as
  implemented in Agg) to clip the path to a given rectangle.  Lines
@@ -529,6 +674,172 @@ public:
     }
 };
 
+/************************************************************
+ PathColumnDecimator is a level-of-detail stage for dense line paths.
+ Consecutive line_to vertices whose x coordinates fall into the same
+ pixel column (the same integer part) form a run, and each run is
+ replaced by its first, minimum, maximum and last vertices, in the
+ order they occurred.  The segments of a run all lie within the
+ column, so this keeps both the vertical extent drawn in every column
+ and the segments joining neighboring columns.
+
+ When x is monotonic every column holds a single run, so no more than
+ four vertices per column are emitted however many the input has.
+ Otherwise runs are just shorter, and the output is still correct.
+ Runs of four vertices or less are passed through unchanged.
+
+ The result is not quite pixel identical: a stroked zig-zag that fills
+ a column has more ink than the few segments that replace it, so very
+ dense lines come out lighter.  That is why this is opt-in.
+*/
+template<class VertexSource>
+class PathColumnDecimator : protected EmbeddedQueue<5>
+{
+public:
+    /* Set do_decimate to true to perform decimation */
+    PathColumnDecimator(VertexSource& source, bool do_decimate) :
+        m_source(&source), m_decimate(do_decimate), m_count(0),
+        m_column(0.0), m_imin(0), m_imax(0)
+    {
+        // empty
+    }
+
+    inline void
+    rewind(unsigned path_id)
+    {
+        queue_clear();
+        m_count = 0;
+        m_source->rewind(path_id);
+    }
+
+    unsigned
+    vertex(double* x, double* y)
+    {
+        unsigned cmd;
+
+        if (!m_decimate)
+        {
+            return m_source->vertex(x, y);
+        }
+
+        if (queue_pop(&cmd, x, y))
+        {
+            return cmd;
+        }
+
+        while (true)
+        {
+            cmd = m_source->vertex(x, y);
+
+            if (m_count && cmd == agg::path_cmd_line_to &&
+                floor(*x) == m_column && !MPL_notisfinite64(*y))
+            {
+                _add(*x, *y);
+                continue;
+            }
+
+            _flush();
+
+            if (cmd == agg::path_cmd_line_to ||
+                cmd == agg::path_cmd_move_to)
+            {
+                /* The first vertex of a run is emitted right away */
+                queue_push(cmd, *x, *y);
+                m_column = floor(*x);
+                m_count = 0;
+                _add(*x, *y);
+            }
+            else
+            {
+                queue_push(cmd, *x, *y);
+            }
+            break;
+        }
+
+        queue_pop(&cmd, x, y);
+        return cmd;
+    }
+
+private:
+    VertexSource* m_source;
+    bool          m_decimate;
+
+    /* The current run: its vertex count, its first four vertices,
+       and its extremes and last vertex */
+    int           m_count;
+    double        m_column;
+    double        m_x[4], m_y[4];
+    int           m_imin, m_imax;
+    double        m_minx, m_miny, m_maxx, m_maxy;
+    double        m_lastx, m_lasty;
+
+    inline void
+    _add(double x, double y)
+    {
+        if (m_count < 4)
+        {
+            m_x[m_count] = x;
+            m_y[m_count] = y;
+        }
+        /* Only the first vertex of a run can be NaN (when NaNs are not
+           removed); the extremes are then seeded by the next vertex */
+        if (m_count == 0 || y < m_miny || m_miny != m_miny)
+        {
+            m_imin = m_count;
+            m_minx = x;
+            m_miny = y;
+        }
+        if (m_count == 0 || y > m_maxy || m_maxy != m_maxy)
+        {
+            m_imax = m_count;
+            m_maxx = x;
+            m_maxy = y;
+        }
+        m_lastx = x;
+        m_lasty = y;
+        ++m_count;
+    }
+
+    /* Queue the rest of the current run (its first vertex has already
+       been emitted) */
+    inline void
+    _flush()
+    {
+        if (m_count <= 4)
+        {
+            for (int i = 1; i < m_count; ++i)
+            {
+                queue_push(agg::path_cmd_line_to, m_x[i], m_y[i]);
+            }
+        }
+        else
+        {
+            int last = m_count - 1;
+            if (m_imin < m_imax)
+            {
+                _push_inner(m_imin, m_minx, m_miny, last);
+                _push_inner(m_imax, m_maxx, m_maxy, last);
+            }
+            else
+            {
+                _push_inner(m_imax, m_maxx, m_maxy, last);
+                _push_inner(m_imin, m_minx, m_miny, last);
+            }
+            queue_push(agg::path_cmd_line_to, m_lastx, m_lasty);
+        }
+        m_count = 0;
+    }
+
+    inline void
+    _push_inner(int i, double x, double y, int last)
+    {
+        if (i != 0 && i != last)
+        {
+            queue_push(agg::path_cmd_line_to, x, y);
+        }
+    }
+};
+
 /************************************************************
  PathSimplifier reduces the number of vertices in a dense path without
  changing its appearance.
@@ -0,0 +1,323 @@
+/* -*- mode: c++; c-basic-offset: 4 -*- */
+
+/* pixfmt_simd.h
+
+   mpl::pixfmt_rgba32_plain is a drop-in replacement for Agg's
+   pixfmt_rgba32_plain whose span blenders (blend_hline,
+   blend_solid_hspan and blend_color_hspan, which is where the Agg
+   renderers spend nearly all of their time) work on four pixels at a
+   time with SSE2.
+
+   The results are bit-identical to blender_rgba_plain: the three
+   integer divisions of every blended pixel are computed from a single
+   precision reciprocal, which is never more than one off, and then
+   corrected exactly in integer arithmetic.  Opaque pixels are copied
+   and fully transparent ones left alone, as the scalar code does.
+
+   SSE2 is part of every x86-64 processor, so it is selected at compile
+   time; on other platforms, and for the pixels left over at the end of
+   a span, the scalar Agg implementation is used.
+
+   The rgba32_to_* functions convert a run of order_rgba pixels to the
+   other channel orders the canvas is exported in, with the same
+   vectorization.
+*/
+
+#ifndef __PIXFMT_SIMD_H
+#define __PIXFMT_SIMD_H
+
+#include <string.h>
+#include "agg_pixfmt_rgba.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MPL_PIXFMT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace mpl
+{
+
+class pixfmt_rgba32_plain : public agg::pixfmt_rgba32_plain
+{
+public:
+    typedef agg::pixfmt_rgba32_plain base_type;
+
+    pixfmt_rgba32_plain() : base_type() {}
+    explicit pixfmt_rgba32_plain(rbuf_type& rb) : base_type(rb) {}
+
+#ifdef MPL_PIXFMT_SSE2
+    void blend_hline(int x, int y, unsigned len,
+                     const color_type& c, agg::int8u cover)
+    {
+        if (!c.a)
+        {
+            return;
+        }
+        unsigned alpha = (unsigned(c.a) * (unsigned(cover) + 1)) >> 8;
+        if (alpha == base_mask || len < 4)
+        {
+            base_type::blend_hline(x, y, len, c, cover);
+            return;
+        }
+
+        agg::int8u* p = pix_ptr(x, y);
+        __m128i cr = _mm_set1_epi32(c.r);
+        __m128i cg = _mm_set1_epi32(c.g);
+        __m128i cb = _mm_set1_epi32(c.b);
+        __m128i va = _mm_set1_epi32(alpha);
+        unsigned i = 0;
+        for (; i + 4 <= len; i += 4, p += 16)
+        {
+            __m128i pix = _mm_loadu_si128((const __m128i*)p);
+            _mm_storeu_si128((__m128i*)p, blend_pix4(pix, cr, cg, cb, va));
+        }
+        if (i < len)
+        {
+            base_type::blend_hline(x + i, y, len - i, c, cover);
+        }
+    }
+
+    void blend_solid_hspan(int x, int y, unsigned len,
+                           const color_type& c, const agg::int8u* covers)
+    {
+        if (!c.a)
+        {
+            return;
+        }
+        if (len < 4)
+        {
+            base_type::blend_solid_hspan(x, y, len, c, covers);
+            return;
+        }
+
+        agg::int8u* p = pix_ptr(x, y);
+        __m128i cr = _mm_set1_epi32(c.r);
+        __m128i cg = _mm_set1_epi32(c.g);
+        __m128i cb = _mm_set1_epi32(c.b);
+        __m128i ca = _mm_set1_epi32(c.a);
+        unsigned i = 0;
+        for (; i + 4 <= len; i += 4, p += 16)
+        {
+            __m128i alpha = scale_alpha(ca, load_covers(covers + i));
+            __m128i pix = _mm_loadu_si128((const __m128i*)p);
+            _mm_storeu_si128((__m128i*)p, blend_pix4(pix, cr, cg, cb, alpha));
+        }
+        if (i < len)
+        {
+            base_type::blend_solid_hspan(x + i, y, len - i, c, covers + i);
+        }
+    }
+
+    void blend_color_hspan(int x, int y, unsigned len,
+                           const color_type* colors,
+                           const agg::int8u* covers, agg::int8u cover)
+    {
+        if (len < 4)
+        {
+            base_type::blend_color_hspan(x, y, len, colors, covers, cover);
+            return;
+        }
+
+        // rgba8 is laid out in memory exactly like an order_rgba pixel
+        agg::int8u* p = pix_ptr(x, y);
+        __m128i vcover = _mm_set1_epi32(cover);
+        unsigned i = 0;
+        for (; i + 4 <= len; i += 4, p += 16)
+        {
+            __m128i color = _mm_loadu_si128((const __m128i*)(colors + i));
+            __m128i alpha = scale_alpha(_mm_srli_epi32(color, 24),
+                                        covers ? load_covers(covers + i) : vcover);
+            __m128i pix = _mm_loadu_si128((const __m128i*)p);
+            _mm_storeu_si128((__m128i*)p,
+                             blend_pix4(pix, channel<0>(color), channel<8>(color),
+                                        channel<16>(color), alpha));
+        }
+        if (i < len)
+        {
+            base_type::blend_color_hspan(x + i, y, len - i, colors + i,
+                                         covers ? covers + i : 0, cover);
+        }
+    }
+
+private:
+    // The byte at bit offset Shift of each 32 bit lane; x86 is little
+    // endian, so an order_rgba pixel has R in the lowest byte
+    template<int Shift>
+    static inline __m128i
+    channel(__m128i v)
+    {
+        return _mm_and_si128(_mm_srli_epi32(v, Shift), _mm_set1_epi32(0xff));
+    }
+
+    // Four coverage values, one per 32 bit lane
+    static inline __m128i
+    load_covers(const agg::int8u* covers)
+    {
+        int v;
+        memcpy(&v, covers, sizeof(v));
+        __m128i zero = _mm_setzero_si128();
+        return _mm_unpacklo_epi16(
+            _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero), zero);
+    }
+
+    // (alpha * (cover + 1)) >> 8, which is also what the scalar code
+    // uses when the cover is 255
+    static inline __m128i
+    scale_alpha(__m128i alpha, __m128i cover)
+    {
+        return _mm_srli_epi32(
+            _mm_mullo_epi16(alpha, _mm_add_epi32(cover, _mm_set1_epi32(1))), 8);
+    }
+
+    // The full 32 bit product of lanes holding values below 2^16
+    static inline __m128i
+    mul_u16(__m128i a, __m128i b)
+    {
+        return _mm_or_si128(_mm_mullo_epi16(a, b),
+                            _mm_slli_epi32(_mm_mulhi_epu16(a, b), 16));
+    }
+
+    // n / d, truncated, for 0 <= n < 2^31, 0 < d < 2^16 and a quotient
+    // below 2^16; rcp holds 1 / d.  The single precision estimate is
+    // within one of the true quotient, so one correction step each way
+    // makes it exact.
+    static inline __m128i
+    div_u32(__m128i n, __m128i d, __m128 rcp)
+    {
+        __m128i q = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(n), rcp));
+        __m128i qd = mul_u16(q, d);
+        __m128i over = _mm_cmpgt_epi32(qd, n);
+        q = _mm_add_epi32(q, over);
+        qd = _mm_sub_epi32(qd, _mm_and_si128(over, d));
+        __m128i under = _mm_cmpgt_epi32(
+            n, _mm_sub_epi32(_mm_add_epi32(qd, d), _mm_set1_epi32(1)));
+        return _mm_sub_epi32(q, under);
+    }
+
+    // blender_rgba_plain::blend_pix on four pixels, including the copy
+    // of opaque colors done by the callers
+    static inline __m128i
+    blend_pix4(__m128i pix, __m128i cr, __m128i cg, __m128i cb, __m128i alpha)
+    {
+        __m128i a = _mm_srli_epi32(pix, 24);
+        __m128i r = _mm_mullo_epi16(channel<0>(pix), a);
+        __m128i g = _mm_mullo_epi16(channel<8>(pix), a);
+        __m128i b = _mm_mullo_epi16(channel<16>(pix), a);
+
+        // a = ((alpha + a) << 8) - alpha * a
+        a = _mm_sub_epi32(_mm_slli_epi32(_mm_add_epi32(alpha, a), 8),
+                          _mm_mullo_epi16(alpha, a));
+        // One Newton-Raphson step refines the reciprocal estimate to
+        // about 22 bits, plenty for quotients below 256
+        __m128 ad = _mm_cvtepi32_ps(a);
+        __m128 rcp = _mm_rcp_ps(ad);
+        rcp = _mm_sub_ps(_mm_add_ps(rcp, rcp), _mm_mul_ps(ad, _mm_mul_ps(rcp, rcp)));
+
+        // ((c << 8) - r) * alpha + (r << 8) == ((c * alpha) << 8) + r * (256 - alpha)
+        __m128i inv = _mm_sub_epi32(_mm_set1_epi32(256), alpha);
+        r = div_u32(_mm_add_epi32(_mm_slli_epi32(_mm_mullo_epi16(cr, alpha), 8),
+                                  mul_u16(r, inv)), a, rcp);
+        g = div_u32(_mm_add_epi32(_mm_slli_epi32(_mm_mullo_epi16(cg, alpha), 8),
+                                  mul_u16(g, inv)), a, rcp);
+        b = div_u32(_mm_add_epi32(_mm_slli_epi32(_mm_mullo_epi16(cb, alpha), 8),
+                                  mul_u16(b, inv)), a, rcp);
+
+        __m128i blended = _mm_or_si128(
+            _mm_or_si128(r, _mm_slli_epi32(g, 8)),
+            _mm_or_si128(_mm_slli_epi32(b, 16),
+                         _mm_slli_epi32(_mm_srli_epi32(a, 8), 24)));
+        __m128i copied = _mm_or_si128(
+            _mm_or_si128(cr, _mm_slli_epi32(cg, 8)),
+            _mm_or_si128(_mm_slli_epi32(cb, 16), _mm_set1_epi32((int)0xff000000)));
+
+        __m128i opaque = _mm_cmpeq_epi32(alpha, _mm_set1_epi32(base_mask));
+        __m128i clear = _mm_cmpeq_epi32(alpha, _mm_setzero_si128());
+        blended = _mm_or_si128(_mm_and_si128(opaque, copied),
+                               _mm_andnot_si128(opaque, blended));
+        return _mm_or_si128(_mm_and_si128(clear, pix),
+                            _mm_andnot_si128(clear, blended));
+    }
+#endif
+};
+
+
+// Convert n order_rgba pixels at src to order_argb at dst
+inline void
+rgba32_to_argb32(const agg::int8u* src, agg::int8u* dst, size_t n)
+{
+    size_t i = 0;
+#ifdef MPL_PIXFMT_SSE2
+    for (; i + 4 <= n; i += 4, src += 16, dst += 16)
+    {
+        // On a little endian machine, ARGB is RGBA rotated by one byte
+        __m128i v = _mm_loadu_si128((const __m128i*)src);
+        v = _mm_or_si128(_mm_slli_epi32(v, 8), _mm_srli_epi32(v, 24));
+        _mm_storeu_si128((__m128i*)dst, v);
+    }
+#endif
+    for (; i < n; ++i, src += 4, dst += 4)
+    {
+        agg::int8u r = src[0], g = src[1], b = src[2], a = src[3];
+        dst[0] = a;
+        dst[1] = r;
+        dst[2] = g;
+        dst[3] = b;
+    }
+}
+
+// Convert n order_rgba pixels at src to order_bgra at dst
+inline void
+rgba32_to_bgra32(const agg::int8u* src, agg::int8u* dst, size_t n)
+{
+    size_t i = 0;
+#ifdef MPL_PIXFMT_SSE2
+    const __m128i ga = _mm_set1_epi32((int)0xff00ff00);
+    const __m128i byte = _mm_set1_epi32(0xff);
+    for (; i + 4 <= n; i += 4, src += 16, dst += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)src);
+        v = _mm_or_si128(
+            _mm_and_si128(v, ga),
+            _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), byte),
+                         _mm_slli_epi32(_mm_and_si128(v, byte), 16)));
+        _mm_storeu_si128((__m128i*)dst, v);
+    }
+#endif
+    for (; i < n; ++i, src += 4, dst += 4)
+    {
+        agg::int8u r = src[0], g = src[1], b = src[2], a = src[3];
+        dst[0] = b;
+        dst[1] = g;
+        dst[2] = r;
+        dst[3] = a;
+    }
+}
+
+// Convert n order_rgba pixels at src to packed rgb24 at dst
+inline void
+rgba32_to_rgb24(const agg::int8u* src, agg::int8u* dst, size_t n)
+{
+    size_t i = 0;
+#ifdef MPL_PIXFMT_SSE2
+    // Pack four little endian pixels into three words at a time
+    for (; i + 4 <= n; i += 4, src += 16, dst += 12)
+    {
+        agg::int32u p[4], q[3];
+        memcpy(p, src, sizeof(p));
+        q[0] = (p[0] & 0xffffff) | (p[1] << 24);
+        q[1] = ((p[1] >> 8) & 0xffff) | (p[2] << 16);
+        q[2] = ((p[2] >> 16) & 0xff) | (p[3] << 8);
+        memcpy(dst, q, sizeof(q));
+    }
+#endif
+    for (; i < n; ++i, src += 4, dst += 3)
+    {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+    }
+}
+
+}
+
+#endif
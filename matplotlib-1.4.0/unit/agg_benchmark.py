@@ -0,0 +1,299 @@
+"""
+Benchmarks for the Agg renderer and the _path extension module.
+
+Each benchmark drives one of the C++ entry points directly on a
+synthetic workload and reports the latency per call (best and median
+of several calls), the vertices handled per second at the best
+latency, and the peak resident memory of the process.  Every
+benchmark runs in a fresh Python process, so that the peak memory is
+its own.
+
+    python unit/agg_benchmark.py                   # all the benchmarks
+    python unit/agg_benchmark.py draw_path         # those matching a name
+    python unit/agg_benchmark.py --scale 4         # 4x the default sizes
+    python unit/agg_benchmark.py --json out.json   # also save the results
+    python unit/agg_benchmark.py --baseline out.json
+
+With --baseline, the results of an earlier --json run are compared
+against, and the ratio of the best latencies is printed (above 1 is
+slower).
+"""
+
+from __future__ import print_function
+
+import json
+import os
+import subprocess
+import sys
+import time
+
+import numpy as np
+
+BENCHMARKS = []
+
+
+def benchmark(func):
+    BENCHMARKS.append(func)
+    return func
+
+
+def _renderer():
+    from matplotlib.backends.backend_agg import RendererAgg
+    from matplotlib.backend_bases import GraphicsContextBase
+    renderer = RendererAgg(800, 600, 100)
+    gc = GraphicsContextBase()
+    gc.set_linewidth(1.0)
+    return renderer, gc
+
+
+def _line(n):
+    x = np.linspace(0, 1, n)
+    y = np.sin(x * 200) + np.random.RandomState(0).rand(n) * 0.2
+    return np.column_stack([x, y])
+
+
+# Each benchmark takes the size scale and returns the function to time
+# and the number of vertices one call of it handles.
+
+@benchmark
+def draw_path_line(scale):
+    from matplotlib.path import Path
+    from matplotlib.transforms import Affine2D
+    renderer, gc = _renderer()
+    n = int(1000000 * scale)
+    path = Path(_line(n))
+    trans = Affine2D().scale(780, 250).translate(10, 300)
+    return lambda: renderer.draw_path(gc, path, trans), n
+
+
+@benchmark
+def draw_path_filled(scale):
+    from matplotlib.path import Path
+    from matplotlib.transforms import Affine2D
+    renderer, gc = _renderer()
+    n = int(100000 * scale)
+    theta = np.linspace(0, 2 * np.pi, n)
+    r = 1 + 0.1 * np.sin(theta * 50)
+    path = Path(np.column_stack([r * np.cos(theta), r * np.sin(theta)]),
+                closed=True)
+    trans = Affine2D().scale(250).translate(400, 300)
+    return lambda: renderer.draw_path(gc, path, trans, (1, 0, 0, 1)), n
+
+
+@benchmark
+def draw_markers(scale):
+    from matplotlib.path import Path
+    from matplotlib.transforms import Affine2D
+    renderer, gc = _renderer()
+    n = int(100000 * scale)
+    marker = Path.unit_circle()
+    marker_trans = Affine2D().scale(3)
+    path = Path(np.random.RandomState(0).rand(n, 2))
+    trans = Affine2D().scale(800, 600)
+    return (lambda: renderer.draw_markers(gc, marker, marker_trans, path,
+                                          trans, (0, 0, 1, 1)),
+            n * len(marker.vertices))
+
+
+@benchmark
+def draw_path_collection(scale):
+    from matplotlib.path import Path
+    from matplotlib.transforms import Affine2D, IdentityTransform
+    renderer, gc = _renderer()
+    n = int(20000 * scale)
+    rs = np.random.RandomState(0)
+    paths = [Path(rs.rand(4, 2) * 20, closed=True) for i in range(100)]
+    offsets = rs.rand(n, 2) * (800, 600)
+    facecolors = rs.rand(n, 4)
+    edgecolors = np.zeros((1, 4))
+    edgecolors[:, 3] = 1
+
+    def call():
+        renderer.draw_path_collection(
+            gc, IdentityTransform().get_matrix(), paths, [], offsets,
+            IdentityTransform(), facecolors, edgecolors, [1.0],
+            [(None, None)], [True], [None], 'screen')
+    return call, n * 5
+
+
+@benchmark
+def draw_quad_mesh(scale):
+    from matplotlib.transforms import IdentityTransform
+    renderer, gc = _renderer()
+    width = height = int(300 * np.sqrt(scale))
+    y, x = np.mgrid[0:600:(height + 1) * 1j, 0:800:(width + 1) * 1j]
+    coordinates = np.dstack([x, y])
+    facecolors = np.random.RandomState(0).rand(width * height, 4)
+
+    def call():
+        renderer.draw_quad_mesh(
+            gc, IdentityTransform().get_matrix(), width, height,
+            coordinates, np.zeros((1, 2)), IdentityTransform(), facecolors,
+            True, np.zeros((0, 4)))
+    return call, (width + 1) * (height + 1)
+
+
+@benchmark
+def path_cleanup(scale):
+    from matplotlib import _path
+    from matplotlib.path import Path
+    from matplotlib.transforms import Affine2D
+    n = int(2000000 * scale)
+    path = Path(_line(n))
+    trans = Affine2D().scale(780, 250).get_matrix()
+    return (lambda: _path.cleanup_path(path, trans, True, (0, 0, 800, 600),
+                                       False, 1.0, True, False, None),
+            n)
+
+
+@benchmark
+def path_affine_transform(scale):
+    from matplotlib import _path
+    from matplotlib.transforms import Affine2D
+    n = int(4000000 * scale)
+    vertices = _line(n)
+    trans = Affine2D().rotate(0.3).scale(2).get_matrix()
+    return lambda: _path.affine_transform(vertices, trans), n
+
+
+@benchmark
+def path_contains_points(scale):
+    from matplotlib.path import Path
+    n = int(200000 * scale)
+    theta = np.linspace(0, 2 * np.pi, 1000)
+    path = Path(np.column_stack([np.cos(theta), np.sin(theta)]))
+    points = np.random.RandomState(0).rand(n, 2) * 2 - 1
+    return lambda: path.contains_points(points), n
+
+
+@benchmark
+def path_collection_extents(scale):
+    from matplotlib import _path
+    from matplotlib.path import Path
+    from matplotlib.transforms import Affine2D
+    n = int(1000000 * scale)
+    offsets = np.random.RandomState(0).randn(n, 2)
+    path = Path.unit_circle()
+    return (lambda: _path.get_path_collection_extents(
+        Affine2D(), [path], [], offsets, Affine2D()), n)
+
+
+@benchmark
+def path_intersects_path(scale):
+    from matplotlib.path import Path
+    n = int(100000 * scale)
+    a = Path(_line(n))
+    b = Path(_line(n)[::-1] + (0.5 / n, 0))
+    return lambda: a.intersects_path(b, filled=False), 2 * n
+
+
+@benchmark
+def path_convert_to_svg(scale):
+    from matplotlib import _path
+    from matplotlib.path import Path
+    from matplotlib.transforms import Affine2D
+    n = int(1000000 * scale)
+    path = Path(_line(n))
+    trans = Affine2D().scale(780, 250).get_matrix()
+    return lambda: _path.convert_to_svg(path, trans, None, False, 6), n
+
+
+def peak_memory_kb():
+    try:
+        import resource
+    except ImportError:
+        return None
+    peak = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    if sys.platform == 'darwin':
+        peak //= 1024  # bytes there, kilobytes elsewhere
+    return peak
+
+
+def run_one(name, scale, repeat):
+    import matplotlib
+    matplotlib.use('Agg')
+    func = dict((f.__name__, f) for f in BENCHMARKS)[name]
+    call, vertices = func(scale)
+    call()  # warm up
+    setup_memory = peak_memory_kb()
+    times = []
+    for i in range(repeat):
+        start = time.time()
+        call()
+        times.append(time.time() - start)
+    times.sort()
+    best = max(times[0], 1e-9)
+    peak = peak_memory_kb()
+    return {'name': name,
+            'scale': scale,
+            'vertices': vertices,
+            'best_s': times[0],
+            'median_s': times[len(times) // 2],
+            'vertices_per_s': vertices / best,
+            'peak_memory_kb': peak,
+            'call_memory_kb': (peak - setup_memory
+                               if peak is not None else None)}
+
+
+def main(argv):
+    import argparse
+    parser = argparse.ArgumentParser(
+        description=__doc__.split('\n\n')[0].strip())
+    parser.add_argument('names', nargs='*',
+                        help='run only the benchmarks containing these')
+    parser.add_argument('--scale', type=float, default=1.0,
+                        help='multiply the default workload sizes')
+    parser.add_argument('--repeat', type=int, default=5,
+                        help='timed calls per benchmark')
+    parser.add_argument('--json', help='save the results to this file')
+    parser.add_argument('--baseline',
+                        help='compare with the results in this file')
+    parser.add_argument('--run-one', help=argparse.SUPPRESS)
+    args = parser.parse_args(argv)
+
+    if args.run_one:
+        json.dump(run_one(args.run_one, args.scale, args.repeat), sys.stdout)
+        return 0
+
+    baseline = {}
+    if args.baseline:
+        with open(args.baseline) as fd:
+            baseline = dict((r['name'], r) for r in json.load(fd)['results'])
+
+    print('%-26s %10s %10s %12s %10s %8s' %
+          ('benchmark', 'best ms', 'median ms', 'Mvertex/s', 'peak MB',
+           'ratio' if baseline else ''))
+    results = []
+    for func in BENCHMARKS:
+        name = func.__name__
+        if args.names and not any(n in name for n in args.names):
+            continue
+        # A fresh process each, for the peak memory
+        output = subprocess.check_output(
+            [sys.executable, os.path.abspath(__file__), '--run-one', name,
+             '--scale', repr(args.scale), '--repeat', str(args.repeat)])
+        result = json.loads(output.decode('ascii'))
+        results.append(result)
+        ratio = ''
+        if name in baseline:
+            ratio = '%.2f' % (result['best_s'] / baseline[name]['best_s'])
+        peak = result['peak_memory_kb']
+        print('%-26s %10.2f %10.2f %12.2f %10s %8s' %
+              (name, result['best_s'] * 1e3, result['median_s'] * 1e3,
+               result['vertices_per_s'] / 1e6,
+               '%.1f' % (peak / 1024.0) if peak is not None else '-',
+               ratio))
+        sys.stdout.flush()
+
+    if args.json:
+        import matplotlib
+        with open(args.json, 'w') as fd:
+            json.dump({'matplotlib': matplotlib.__version__,
+                       'python': sys.version.split()[0],
+                       'platform': sys.platform,
+                       'results': results}, fd, indent=1)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))